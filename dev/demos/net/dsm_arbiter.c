@@ -1,16 +1,22 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
 
 #include <signal.h>
+#include <setjmp.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <sys/mman.h>
+#include <sys/eventfd.h>
 
 #include "dsm_util.h"
 #include "dsm_inet.h"
 #include "dsm_queue.h"
 #include "dsm_msg.h"
 #include "dsm_poll.h"
+#include "dsm_stats.h"
+#include "dsm_ring.h"
 
 #include "dsm_arbiter.h"
 #include "dsm_types.h"
@@ -28,6 +34,10 @@
 // Minimum number of concurrent pollable connections.
 #define DSM_MIN_POLLABLE		32
 
+// Smallest update forwarded straight from the shared file (zero-copy).
+// Smaller updates are cheaper to copy than to send with sendfile.
+#define DSM_ZEROCOPY_MIN		1024
+
 
 /*
  *******************************************************************************
@@ -36,35 +46,122 @@
 */
 
 
+// [Thread-local: A host arbiter service runs each session on a thread].
+
 // Boolean flag indicating if program should continue polling.
-int alive = 1;
+__thread int alive = 1;
 
 // Boolean flag indicating if program has started.
-int started;
+__thread int started;
 
 // Process table. Indexed by file-descriptor.
-dsm_ptab ptab;
+__thread dsm_ptab ptab;
 
 // Pollable file-descriptors.
-pollset *pollableSet;
+__thread pollset *pollableSet;
 
 // The operation queue.
-dsm_opqueue *opqueue;
+__thread dsm_opqueue *opqueue;
 
 // Function map.
-dsm_msg_func fmap[MSG_MAX_VALUE];
+__thread dsm_msg_func fmap[MSG_MAX_VALUE];
+
+// Server-socket. Connects to the first session-server: It registers
+// processes, and keeps the barriers and locks of the session.
+__thread int sock_server;
+
+// Sockets of all session-servers. Each serves a partition of the pages.
+__thread int sock_servers[DSM_MAX_SERVERS];
+
+// Number of session-servers.
+__thread unsigned int nservers;
+
+// Listener-socket. Handles local processes (unix domain, named by session).
+__thread int sock_listen;
+
+// Peer listener socket. Peers push updates to it.
+__thread int sock_peer;
+
+// The shared file. Updates are sent to server and peers from it.
+__thread int shm_fd;
+
+// Process rings (in the shared file).
+__thread dsm_ring_pair *rings;
+
+// Eventfd processes wake the arbiter with, while it sleeps.
+__thread int rings_efd;
+
+// Nonzero if this round released parked processes: They are woken together.
+__thread int unpark;
+
+// Local processes waiting for each lock token to arrive.
+__thread dsm_opqueue *lockqueue[DSM_MAX_LOCKS];
+
+// Nonzero if a lock token has been requested from the server.
+__thread int lock_requested[DSM_MAX_LOCKS];
+
+// Peer arbiters. Indexed by peer identifier.
+__thread dsm_peer *peers;
+
+// Length of the peer table.
+__thread int peers_length;
+
+// Peers the pending update is pushed to (named by the write grant).
+__thread int *push_peers;
 
-// Server-socket. Connects to session-server.
-int sock_server;
+// Number of peers to push to, and capacity of the push list.
+__thread unsigned int push_length, push_size;
 
-// Listener-socket. Handles local processes.
-int sock_listen;
+// Parent in the arbiter tree. Acknowledgements are summed up to it (or the
+// server if -1).
+__thread int parent = -1;
 
-// [EXTERN] Initialization semaphore. 
-extern sem_t *sem_start;
+// Barrier arrivals to pass up the tree.
+__thread unsigned int pending_barr;
 
-// [EXTERN] Shared memory map.
-extern dsm_smap *smap;
+// Sync acknowledgements to pass up the tree. Summed per update.
+__thread dsm_msg_done *pending_acks;
+
+// Number of updates with pending acknowledgements, and capacity of the list.
+__thread unsigned int acks_length, acks_size;
+
+// Last update applied to each page. Updates are applied in page order.
+__thread unsigned int page_seq[DSM_SHM_NPAGES];
+
+// The last write grant (offset and sequence numbers).
+__thread dsm_msg_sync grant;
+
+// Write tokens held, by page: Grants of the next write of the page, made by
+// its server ahead of a request. Not held if seq is 0. Local writers take
+// them through the page words in the map header.
+__thread dsm_msg_sync tokens[DSM_SHM_NPAGES];
+
+// Update written under the write token of each page (0 if none). Once it is
+// done, the page's word goes back to the server unless a new token came.
+__thread unsigned int token_update[DSM_SHM_NPAGES];
+
+// Write token recalled while deferred, by page (its seq, or 0). It is
+// returned unused once in order: The server recalls only once.
+__thread unsigned int token_recalls[DSM_SHM_NPAGES];
+
+// Updates and grants received ahead of the previous update of their page.
+// Their data is copied.
+__thread dsm_msg *deferred;
+
+// Number of deferred messages, and capacity of the list.
+__thread unsigned int deferred_length, deferred_size;
+
+// Initialization semaphore (named by session).
+static __thread sem_t *sem_start;
+
+// Name of the initialization semaphore.
+static __thread char sem_name[DSM_SHM_NAME_SIZE];
+
+// Shared memory map (named by session).
+static __thread dsm_smap *smap;
+
+// Name of the shared file.
+static __thread char shm_name[DSM_SHM_NAME_SIZE];
 
 
 /*
@@ -75,11 +172,24 @@ extern dsm_smap *smap;
 
 
 // Sends fd a dsm_msg_done message.
-static void send_doneMsg (int fd, dsm_msg_t type, unsigned int nproc);
+static void send_doneMsg (int fd, dsm_msg_t type, unsigned int nproc, 
+	unsigned int seq);
 
-// Sends basic message 'type' to fd. If fd == -1, sends to all file-descriptors.
+// Sends basic message 'type' to fd. If fd == -1, sends to all processes.
 static void send_simpleMsg (int fd, dsm_msg_t type);
 
+// Sends lock message 'type' for lock 'id' to fd.
+static void send_lockMsg (int fd, dsm_msg_t type, unsigned int id, int flag);
+
+// Sends the server the address of the listener socket (for peers).
+static void send_peerMsg (void);
+
+// Sends message to process p: Over its ring if it has one.
+static void send_procMsg (dsm_proc *p, dsm_msg *mp);
+
+// Sends the server the write request of process p.
+static void send_syncRequest (dsm_proc *p);
+
 /******************************************************************************/
 
 // Initializes the global process table.
@@ -100,15 +210,56 @@ static void unregisterProcess (int fd);
 // Prints the process table.
 static void showProcessTable (void);
 
+// Returns the number of registered processes.
+static unsigned int countProcesses (void);
+
+// Returns the process table entry of the given gid. Exits fatally if missing.
+static dsm_proc *getProcessByGID (int gid);
+
+// Returns the number of local processes holding a copy of the given page.
+static unsigned int countPageHolders (int page);
+
+// Returns nonzero if fd is the connection of a registered process.
+static int isProcess (int fd);
+
+// Gives process p a free ring pair, if there is one.
+static void assignRing (dsm_proc *p);
+
+// Returns nonzero if a process ring holds a request.
+static int hasRingInput (void);
+
+// Handles the requests in all process rings.
+static void processRings (void);
+
+/******************************************************************************/
+
+// Records the address of a peer arbiter.
+static void setPeer (dsm_msg_peer *pp);
+
+// Returns the connection to a peer arbiter. Connects on first use.
+static int getPeerSocket (int id);
+
+// Returns the connection to the parent in the arbiter tree.
+static int getParentSocket (void);
+
+// Returns the number of (live) children in the arbiter tree.
+static unsigned int countChildren (void);
+
+// Sends message to each child in the arbiter tree.
+static void send_childrenMsg (dsm_msg *mp);
+
+// Passes the acknowledgements summed this round up the tree.
+static void send_treeAcks (void);
+
+// Deallocates the peer table, closing connections to peers.
+static void freePeerTable (void);
+
 /******************************************************************************/
 
 // [P->A] Checking-in message from process to arbiter.
 static void msg_addProc (int fd, dsm_msg *mp);
 
-// [S->A] Message requesting arbiter stop all processes and send ack.
-static void msg_stopAll (int fd, dsm_msg *mp);
-
-// [S->A] Message requesting arbiter continue all stopped processes.
+// [S->A] Message requesting arbiter continue the writer of an update.
 static void msg_contAll (int fd, dsm_msg *mp);
 
 // [S->A] Message requesting arbiter continue all waiting processes.
@@ -120,6 +271,21 @@ static void msg_writeOkay (int fd, dsm_msg *mp);
 // [S->A->S] Message from writer with write data. Can be in or out.
 static void msg_syncInfo (int fd, dsm_msg *mp);
 
+// [A->A] Message from the writer's arbiter with write data.
+static void msg_syncPush (int fd, dsm_msg *mp);
+
+// [S->A] Message with the listener address of a peer arbiter.
+static void msg_setPeer (int fd, dsm_msg *mp);
+
+// [A->A] Message from a child with summed sync acknowledgements.
+static void msg_syncDone (int fd, dsm_msg *mp);
+
+// [P->A->S] Message from process requesting a copy of a page.
+static void msg_pageReq (int fd, dsm_msg *mp);
+
+// [S->A->P] Message from server validating a page copy (data may follow).
+static void msg_pageData (int fd, dsm_msg *mp);
+
 // [P->A] Message from process requesting write-access.
 static void msg_syncRequest (int fd, dsm_msg *mp);
 
@@ -131,19 +297,102 @@ static void msg_prgmDone (int fd, dsm_msg *mp);
 
 /******************************************************************************/
 
-// Sends signal to 'fd'. If -1 is specified, sends to all fds in ptab.
-static void signalProcess (int fd, int signal);
+// [P->A->S] Message from process requesting a lock token.
+static void msg_lockReq (int fd, dsm_msg *mp);
+
+// [S->A->P] Message from server granting a lock token.
+static void msg_lockGrant (int fd, dsm_msg *mp);
+
+// [S->A] Message from server recalling a lock token.
+static void msg_lockRecall (int fd, dsm_msg *mp);
+
+// [S->A] Message from server recalling a write token.
+static void msg_writeRecall (int fd, dsm_msg *mp);
+
+// [P->A] Message from process that released a recalled lock.
+static void msg_lockRel (int fd, dsm_msg *mp);
+
+// [P->A->S] Message from process requesting an atomic operation.
+static void msg_atomicReq (int fd, dsm_msg *mp);
+
+// [S->A->P] Message from server with the result of an atomic operation.
+static void msg_atomicDone (int fd, dsm_msg *mp);
+
+// [P->A->S->A] Message waking processes waiting on a shared word.
+static void msg_notify (int fd, dsm_msg *mp);
+
+/******************************************************************************/
+
+// Returns a recalled lock token to the server if the lock is free.
+static void releaseLockToken (unsigned int id);
 
-// Contacts daemon with sid, sets session details. Exits fatally on error.
-static int getServerSocket (const char *sid, const char *addr, 
-	const char *port, unsigned int nproc);
+// Queues update mp (data in the shared file) to fd. Sends it coded, or from
+// the shared file, if large. Only for the server: The bytes must not change
+// until it has them all.
+static void queueUpdate (int fd, dsm_msg *mp);
+
+// Applies update mp to the shared file, and acknowledges it up the tree.
+// Defers it if the previous update of its page is still missing.
+static void applyUpdate (dsm_msg *mp);
+
+// Forwards write grant mp to the queued writer.
+static void grantWrite (dsm_msg *mp);
+
+// Sends the server the write request of process p. If its page's word is
+// on the host, p retries locally instead: The next queued writer is up.
+static void requestWrite (dsm_proc *p);
+
+// Keeps write token mp for local writers. Wakes one waiting on its page.
+// Returns it unused if it was recalled while deferred.
+static void holdToken (dsm_msg *mp);
+
+// Returns nonzero if update (or grant) mp follows the last applied update of
+// its page (or is already covered by it).
+static int isInOrder (dsm_msg *mp);
+
+// Keeps a copy of update (or grant) mp until it is in order.
+static void deferMsg (dsm_msg *mp);
+
+// Handles the deferred updates and grants that are now in order.
+static void runDeferred (void);
+
+// Adds nproc acknowledgements of update seq, to pass up the tree.
+static void addAck (unsigned int seq, unsigned int nproc);
+
+// Unregisters and closes a connection.
+static void dropConnection (int fd);
+
+// Stops once no processes, and no children in the tree, remain.
+static void checkAlive (void);
+
+// Returns nonzero if fd is a connection to a session-server.
+static int isServer (int fd);
+
+// Returns the server of the page at offset.
+static int getPageServer (off_t offset);
+
+// Returns the server that ordered update seq.
+static int getSeqServer (unsigned int seq);
+
+// Connects to the servers in sp.
+static void connectServers (const dsm_servers *sp);
+
+// Closes the connections, sockets and files of the arbiter, and frees its
+// state. Also tidies up an arbiter that panicked partway.
+static void freeArbiter (const char *sid);
+
+// Updates the poll events of fd. Called when its queued output changes.
+static void setPollEvents (int fd, short events);
 
 // Accepts incoming connection, and updates the list of pollable descriptors.
 static void processConnection (int sock_listen);
 
-// Reads message from fd. Decodes and selects appropriate action.
+// Reads available input from fd. Decodes and handles each complete message.
 static void processMessage (int fd);
 
+// Polls for events. Sleeps only while all rings are empty.
+static int pollEvents (void);
+
 
 /*
  *******************************************************************************
@@ -153,19 +402,21 @@ static void processMessage (int fd);
 
 
 // Sends fd a dsm_msg_done message.
-static void send_doneMsg (int fd, dsm_msg_t type, unsigned int nproc) {
+static void send_doneMsg (int fd, dsm_msg_t type, unsigned int nproc, 
+	unsigned int seq) {
 	dsm_msg msg;
 
 	// Configure message.
 	memset(&msg, 0, sizeof(msg));
 	msg.type = type;
 	msg.payload.done.nproc = nproc;
+	msg.payload.done.seq = seq;
 
 	// Send the message.
-	dsm_sendall(fd, &msg, sizeof(msg));
+	dsm_queuemsg(fd, &msg);
 }
 
-// Sends basic message 'type' to fd. If fd == -1, sends to all file-descriptors.
+// Sends basic message 'type' to fd. If fd == -1, sends to all processes.
 static void send_simpleMsg (int fd, dsm_msg_t type) {
 	dsm_msg msg;
 
@@ -175,14 +426,77 @@ static void send_simpleMsg (int fd, dsm_msg_t type) {
 
 	// If fd is non-negative, send just to fd.
 	if (fd >= 0) {
-		dsm_sendall(fd, &msg, sizeof(msg));
+		dsm_queuemsg(fd, &msg);
+		return;
+	}
+
+	// Otherwise, send to all processes (not to peers).
+	for (int i = 0; i < ptab.length; i++) {
+		if (ptab.processes[i].pid != 0) {
+			dsm_queuemsg(ptab.processes[i].fd, &msg);
+		}
+	}
+}
+
+
+// Sends lock message 'type' for lock 'id' to fd.
+static void send_lockMsg (int fd, dsm_msg_t type, unsigned int id, int flag) {
+	dsm_msg msg;
+
+	// Configure message.
+	memset(&msg, 0, sizeof(msg));
+	msg.type = type;
+	msg.payload.lock.id = id;
+	msg.payload.lock.flag = flag;
+
+	// Send the message.
+	dsm_queuemsg(fd, &msg);
+}
+
+// Sends the server the address of the listener socket (for peers).
+static void send_peerMsg (void) {
+	dsm_msg msg;
+
+	// Configure message: Peers reach the host at its address to the server.
+	memset(&msg, 0, sizeof(msg));
+	msg.type = MSG_ADD_PEER;
+	msg.payload.peer.id = -1;
+	dsm_getSocketInfo(sock_server, msg.payload.peer.addr, INET6_ADDRSTRLEN, 
+		NULL);
+	dsm_getSocketInfo(sock_peer, NULL, 0, &msg.payload.peer.port);
+
+	// Send the message.
+	dsm_queuemsg(sock_server, &msg);
+}
+
+// Sends message to process p: Over its ring if it has one.
+static void send_procMsg (dsm_proc *p, dsm_msg *mp) {
+
+	if (p->ring == -1) {
+		dsm_queuemsg(p->fd, mp);
 		return;
 	}
 
-	// Otherwise, send to all (skip listener + server socket at 0 and 1).
-	for (int i = 2; i < pollableSet->fp; i++) {
-		dsm_sendall(pollableSet->fds[i].fd, &msg, sizeof(msg));
+	// Each request is answered once: The ring can't fill.
+	if (dsm_ringPut(&rings[p->ring].rsp, mp) != 0) {
+		dsm_cpanic("send_procMsg", "Ring is full!");
 	}
+
+	// Wake it at the end of the round (if parked).
+	unpark = 1;
+}
+
+// Sends the server the write request of process p.
+static void send_syncRequest (dsm_proc *p) {
+	dsm_msg msg;
+
+	// Configure message.
+	memset(&msg, 0, sizeof(msg));
+	msg.type = MSG_SYNC_REQ;
+	msg.payload.sync.offset = p->offset;
+
+	// Send the message to the server of the page.
+	dsm_queuemsg(getPageServer(p->offset), &msg);
 }
 
 
@@ -248,7 +562,8 @@ static void registerProcess (int fd, int pid) {
 		.fd = fd,
 		.gid = -1,
 		.pid = pid,
-		.flags = (dsm_pstate){.is_stopped = 0, .is_waiting = 0, .is_queued = 0}
+		.flags = (dsm_pstate){.is_parked = 0, .is_waiting = 0, .is_queued = 0},
+		.ring = -1
 	};
 }
 
@@ -261,6 +576,11 @@ static void unregisterProcess (int fd) {
 		dsm_cpanic("unregisterProcess", "Location inaccessible!");
 	}
 
+	// Free its ring pair.
+	if (ptab.processes[fd].ring != -1) {
+		dsm_ringReset(rings + ptab.processes[fd].ring);
+	}
+
 	memset(ptab.processes + fd, 0, sizeof(dsm_proc));
 }
 
@@ -268,14 +588,14 @@ static void unregisterProcess (int fd) {
 static void showProcessTable (void) {
 	int n = 0;
 	printf("------------------------------- Process Table ---------------------------------\n");
-	printf("\tFD\tGID\tPID\tSTOP\tWAIT\tQUEUE\n");
+	printf("\tFD\tGID\tPID\tPARK\tWAIT\tQUEUE\n");
 	for (int i = 0; i < ptab.length; i++) {
 		if (ptab.processes[i].pid == 0) {
 			continue;
 		}
 		n++;
 		dsm_proc p = ptab.processes[i];
-		char s = (p.flags.is_stopped ? 'Y' : 'N');
+		char s = (p.flags.is_parked ? 'Y' : 'N');
 		char w = (p.flags.is_waiting ? 'Y' : 'N');
 		char q = (p.flags.is_queued ? 'Y' : 'N');
 		printf("\t%d\t%d\t%d\t%c\t%c\t%c\n", i, p.gid, p.pid, s, w, q);
@@ -285,6 +605,195 @@ static void showProcessTable (void) {
 	fflush(stdout);
 }
 
+// Returns the number of registered processes.
+static unsigned int countProcesses (void) {
+	unsigned int n = 0;
+	for (int i = 0; i < ptab.length; i++) {
+		n += (ptab.processes[i].pid != 0);
+	}
+	return n;
+}
+
+// Returns the process table entry of the given gid. Exits fatally if missing.
+static dsm_proc *getProcessByGID (int gid) {
+	for (int i = 0; i < ptab.length; i++) {
+		if (ptab.processes[i].pid != 0 && ptab.processes[i].gid == gid) {
+			return ptab.processes + i;
+		}
+	}
+	dsm_cpanic("getProcessByGID", "Table doesn't contain GID!");
+	return NULL;
+}
+
+// Returns the number of local processes holding a copy of the given page.
+static unsigned int countPageHolders (int page) {
+	unsigned int n = 0;
+	for (int i = 0; i < ptab.length; i++) {
+		n += (ptab.processes[i].pid != 0 && ptab.processes[i].valid[page]);
+	}
+	return n;
+}
+
+// Returns nonzero if fd is the connection of a registered process.
+static int isProcess (int fd) {
+	return (fd >= 0 && fd < ptab.length && ptab.processes[fd].pid != 0);
+}
+
+// Gives process p a free ring pair, if there is one.
+static void assignRing (dsm_proc *p) {
+	for (int i = 0; i < DSM_MAX_RINGS; i++) {
+		if (rings[i].pid == 0) {
+			dsm_ringReset(rings + i);
+			rings[i].pid = p->pid;
+			p->ring = i;
+			return;
+		}
+	}
+}
+
+// Returns nonzero if a process ring holds a request.
+static int hasRingInput (void) {
+	for (int i = 0; i < DSM_MAX_RINGS; i++) {
+		if (rings[i].pid != 0 && !dsm_isRingEmpty(&rings[i].req)) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+// Handles the requests in all process rings, as if received on the socket
+// of each process.
+static void processRings (void) {
+	void (*action)(int, dsm_msg *);
+	dsm_proc *p;
+	dsm_msg msg;
+
+	for (int i = 0; i < ptab.length; i++) {
+		p = ptab.processes + i;
+
+		// Skip unused slots, and processes without a ring.
+		if (p->pid == 0 || p->ring == -1) {
+			continue;
+		}
+
+		while (p->pid != 0 && dsm_ringGet(&rings[p->ring].req, &msg) == 0) {
+			if ((action = dsm_getMsgFunc(msg.type, fmap)) == NULL) {
+				dsm_warning("No action for message type!");
+				continue;
+			}
+			action(p->fd, &msg);
+		}
+	}
+}
+
+
+/*
+ *******************************************************************************
+ *                             Peer Table Functions                            *
+ *******************************************************************************
+*/
+
+
+// Records the address of a peer arbiter.
+static void setPeer (dsm_msg_peer *pp) {
+	dsm_peer *new_peers;
+	int new_length;
+
+	// Verify the identifier.
+	if (pp->id < 0) {
+		dsm_cpanic("setPeer", "Bad peer identifier!");
+	}
+
+	// Grow the table to include the peer.
+	if (pp->id >= peers_length) {
+		new_length = MAX(pp->id + 1, 2 * peers_length);
+		new_peers = dsm_zalloc(new_length * sizeof(dsm_peer));
+		memcpy(new_peers, peers, peers_length * sizeof(dsm_peer));
+		for (int i = peers_length; i < new_length; i++) {
+			new_peers[i].fd = -1;
+		}
+		free(peers);
+		peers = new_peers;
+		peers_length = new_length;
+	}
+
+	// Record the address (connected on first use), and the tree link.
+	snprintf(peers[pp->id].addr, INET6_ADDRSTRLEN, "%.*s", 
+		INET6_ADDRSTRLEN - 1, pp->addr);
+	peers[pp->id].port = pp->port;
+	peers[pp->id].link = pp->link;
+	if (pp->link == TREE_PARENT) {
+		parent = pp->id;
+	}
+}
+
+// Returns the connection to a peer arbiter. Connects on first use.
+static int getPeerSocket (int id) {
+	dsm_peer *p;
+
+	// Verify the peer is known.
+	if (id < 0 || id >= peers_length || peers[id].port == 0) {
+		dsm_cpanic("getPeerSocket", "Unknown peer!");
+	}
+	p = peers + id;
+
+	// Connect. Never block on it (replies aren't expected, but closes are).
+	if (p->fd == -1) {
+		p->fd = dsm_getConnectedSocket(p->addr, dsm_portToString(p->port));
+		dsm_setNonBlocking(p->fd);
+		dsm_setPollable(p->fd, POLLIN, pollableSet);
+	}
+
+	return p->fd;
+}
+
+// Returns the connection to the parent in the arbiter tree.
+static int getParentSocket (void) {
+	return (parent == -1 ? sock_server : getPeerSocket(parent));
+}
+
+// Returns the number of (live) children in the arbiter tree.
+static unsigned int countChildren (void) {
+	unsigned int n = 0;
+	for (int i = 0; i < peers_length; i++) {
+		n += (peers[i].link == TREE_CHILD);
+	}
+	return n;
+}
+
+// Sends message to each child in the arbiter tree.
+static void send_childrenMsg (dsm_msg *mp) {
+	for (int i = 0; i < peers_length; i++) {
+		if (peers[i].link == TREE_CHILD) {
+			dsm_queuemsg(getPeerSocket(i), mp);
+		}
+	}
+}
+
+// Passes the acknowledgements summed this round up the tree.
+static void send_treeAcks (void) {
+	if (pending_barr > 0) {
+		send_doneMsg(getParentSocket(), MSG_WAIT_BARR, pending_barr, 0);
+		pending_barr = 0;
+	}
+	for (unsigned int i = 0; i < acks_length; i++) {
+		send_doneMsg((parent == -1 ? getSeqServer(pending_acks[i].seq) :
+			getParentSocket()), MSG_SYNC_DONE, pending_acks[i].nproc,
+			pending_acks[i].seq);
+	}
+	acks_length = 0;
+}
+
+// Deallocates the peer table, closing connections to peers.
+static void freePeerTable (void) {
+	for (int i = 0; i < peers_length; i++) {
+		if (peers[i].fd != -1) {
+			close(peers[i].fd);
+		}
+	}
+	free(peers);
+}
+
 
 /*
  *******************************************************************************
@@ -296,19 +805,31 @@ static void showProcessTable (void) {
 // [P->A] Checking-in message from process to arbiter.
 static void msg_addProc (int fd, dsm_msg *mp) {
 	
-	// Validate: Process cannot already have entry, or session started.
-	if (started == 1 || fd > ptab.length || ptab.processes[fd].pid != 0) {
-		dsm_cpanic("msg_addProc", "Received out-of-order/duplicate message!");
+	// Turn away late processes. (Peers still connect once started).
+	if (started == 1) {
+		dsm_warning("Ignoring process: Session has already started!");
+		dropConnection(fd);
+		return;
+	}
+
+	// Validate: Process cannot already have entry.
+	if (fd < ptab.length && ptab.processes[fd].pid != 0) {
+		dsm_cpanic("msg_addProc", "Received duplicate message!");
 	}
 
 	// Register process in the process-table.
 	registerProcess(fd, mp->payload.proc.pid);
 
+	// Pass it its ring pair (if any), and the eventfd to wake the arbiter.
+	// Nothing else is queued to it yet.
+	assignRing(ptab.processes + fd);
+	dsm_sendfd(fd, rings_efd, ptab.processes[fd].ring);
+
 	// Set the waiting bit: All processes wait before beginning.
 	ptab.processes[fd].flags.is_waiting = 1;
 
 	// Forward registration request to the session-server.
-	dsm_sendall(sock_server, mp, sizeof(*mp));
+	dsm_queuemsg(sock_server, mp);
 
 	printf("[%d] ADD_PROC: Registered new process!\n", getpid()); fflush(stdout);
 }
@@ -338,7 +859,13 @@ static void msg_setgid (int fd, dsm_msg *mp) {
 		ptab.processes[i].gid = mp->payload.proc.gid;
 
 		// Forward message to relevant process.
-		dsm_sendall(ptab.processes[i].fd, mp, sizeof(*mp));
+		dsm_queuemsg(ptab.processes[i].fd, mp);
+
+		// Register it with the other servers: They serve its other pages.
+		mp->type = MSG_ADD_PROC;
+		for (unsigned int s = 1; s < nservers; s++) {
+			dsm_queuemsg(sock_servers[s], mp);
+		}
 
 		return;
 	}
@@ -347,67 +874,47 @@ static void msg_setgid (int fd, dsm_msg *mp) {
 	dsm_cpanic("msg_setgid", "Table doesn't contain PID!");
 }
 
-// [S->A] Message requesting arbiter stop all processes and send ack.
-static void msg_stopAll (int fd, dsm_msg *mp) {
-	dsm_proc *p;
-
-	// Validate message. Only server may send this.
-	if (fd != sock_server) {
-		dsm_cpanic("msg_stopAll", "Unauthorized message!");
-	}
-
-	// Stop all processes. Mark as stopped in table.
-	for (int i = 0; i < ptab.length; i++) {
-		p = ptab.processes + i;
-
-		// Skip unused slots + already stopped processes.
-		if (p->pid == 0 || p->flags.is_stopped == 1) {
-			continue;
-		}
-
-		// Mark stopped.
-		p->flags.is_stopped = 1;
-
-		// Signal only if: not-waiting.
-		if (p->flags.is_waiting == 0) {
-			signalProcess(i, SIGTSTP);
-		}
-	}
-
-	printf("[%d] STOP_ALL: All processes are stopped!\n", getpid()); fflush(stdout);
-
-	// Send response: nproc = pollable - sock_listen and sock_server
-	send_doneMsg(fd, MSG_STOP_DONE, pollableSet->fp - 2);
-}
-
-// [S->A] Message requesting arbiter continue all stopped processes.
+// [S->A] Message requesting arbiter continue the writer of an update.
 static void msg_contAll (int fd, dsm_msg *mp) {
 	dsm_proc *p;
 
 	// Validate message. Only server may send this.
-	if (fd != sock_server) {
+	if (!isServer(fd)) {
 		dsm_cpanic("msg_contAll", "Unauthorized message!");
 	}
 
-	// Unset the stop bit for all processes in the table.
+	// Unset the park bit of the writer that sent the update. (Others may 
+	// have sent updates still being acknowledged).
 	for (int i = 0; i < ptab.length; i++) {
 		p = ptab.processes + i;
 
-		// Skip unused slots + queued processes.
-		if (p->pid == 0 || p->flags.is_queued == 1) {
+		// Skip unused slots, running + queued processes, other updates.
+		if (p->pid == 0 || p->flags.is_parked == 0 || p->flags.is_queued == 1 ||
+			p->seq != mp->payload.done.seq) {
 			continue;
 		}
 
-		// Unset stopped bit.
-		p->flags.is_stopped = 0;
+		// Unset parked bit.
+		p->flags.is_parked = 0;
+
+		// Release writer: It is parked until the message arrives.
+		send_procMsg(p, mp);
+	}
 
-		// Signal only if: not-waiting.
-		if (p->flags.is_waiting == 0) {
-			signalProcess(i, SIGCONT);
+	// An update written under a write token is done, and no token followed
+	// it: The page's word goes back to the server. Local writers waiting on
+	// it request their writes.
+	for (int page = 0; page < DSM_SHM_NPAGES; page++) {
+		if (token_update[page] != 0 && 
+			token_update[page] == mp->payload.done.seq) {
+			token_update[page] = 0;
+			__atomic_store_n(smap->writes + page, WRITE_REMOTE, __ATOMIC_SEQ_CST);
+			dsm_futexWake(smap->writes + page, INT_MAX);
 		}
 	}
 
-	printf("[%d] CONT_ALL: Signalled all stopped non-writing proceses!\n", getpid()); fflush(stdout);
+	printf("[%d] CONT_ALL: Released writer of update %u!\n", getpid(),
+		mp->payload.done.seq); fflush(stdout);
 }
 
 // [S->A] Message requesting arbiter continue all waiting processes.
@@ -416,21 +923,24 @@ static void msg_waitDone (int fd, dsm_msg *mp) {
 
 	printf("[%d] WAIT_DONE: Received!\n", getpid()); fflush(stdout);
 
-	// Validate message. Only server may send this.
-	if (fd != sock_server) {
+	// Validate message. Only server (or the parent in the tree) may send this.
+	if (isProcess(fd)) {
 		dsm_cpanic("msg_waitDone", "Unauthorized message");
 	}
 
+	// Forward down the tree.
+	send_childrenMsg(mp);
+
 	// If session hasn't started. Treat this as start signal.
 	if (started == 0) {
 		printf("[%d] WAIT_DONE: Server sent start signal!\n", getpid());
 		fflush(stdout);
 
 		// Unlink the shared file.
-		dsm_unlinkSharedFile(DSM_SHM_FILE_NAME);
+		dsm_unlinkSharedFile(shm_name);
 
 		// Unlink the initialization-semaphore.
-		dsm_unlinkNamedSem(DSM_SEM_INIT_NAME);
+		dsm_unlinkNamedSem(sem_name);
 	}
 
 	// Unset the waiting bit for all processes in the table.
@@ -444,69 +954,224 @@ static void msg_waitDone (int fd, dsm_msg *mp) {
 
 		// Unset wait-bit.
 		p->flags.is_waiting = 0;
-
-		// Signal only if: not-stopped (shouldn't happen) and started.
-		// Why started? Because first msg_waitDone we send msg not signal.
-		if (p->flags.is_stopped == 0 && started == 1) {
-			signalProcess(i, SIGCONT);
-		}
 	}
 
-	// If session hadn't started, set started now and message all processes.
+	// If session hadn't started: Size the barrier, then message all processes.
 	if (started == 0) {
+		smap->barrier_nproc = countProcesses();
 		send_simpleMsg(-1, MSG_WAIT_DONE);
 		started = 1;
+		return;
 	}
+
+	// Otherwise release the barrier. Waiters are woken at the end of the round.
+	__atomic_add_fetch(&smap->barrier_epoch, 1, __ATOMIC_SEQ_CST);
+	unpark = 1;
 }
 
 // [S->A] Message informing arbiter that a write-operation may now proceed.
 static void msg_writeOkay (int fd, dsm_msg *mp) {
+	unsigned int n = mp->size / sizeof(int);
 
 	// Validate message. Only server may send this.
-	if (fd != sock_server) {
+	if (!isServer(fd) || mp->size % sizeof(int) != 0) {
 		dsm_cpanic("msg_writeOkay", "Unauthorized message!");
 	}
 
+	// A write token is kept for local writers once the page has all previous
+	// updates.
+	if (mp->payload.sync.token) {
+		if (isInOrder(mp)) {
+			holdToken(mp);
+		} else {
+			deferMsg(mp);
+		}
+		return;
+	}
+
 	// Ensure that there is a writer queued.
 	if (dsm_isOpQueueEmpty(opqueue) == 1) {
 		dsm_cpanic("msg_writeOkay", "No writer queued!");
 	}
 
 	printf("[%d] WRITE_OKAY: Received and forwarding!\n", getpid()); fflush(stdout);
-	
-	// Forward message to writer.
-	dsm_sendall(dsm_getOpQueueHead(opqueue), mp, sizeof(*mp));
+
+	// Remember the peers with holders of the page: The update is pushed to
+	// them directly.
+	if (n > push_size) {
+		push_size = n;
+		if ((push_peers = realloc(push_peers, n * sizeof(int))) == NULL) {
+			dsm_cpanic("msg_writeOkay", "realloc failed");
+		}
+	}
+	memcpy(push_peers, mp->data, mp->size);
+	push_length = n;
+	mp->data = NULL;
+	mp->size = 0;
+
+	// Forward grant to writer once the page has all previous updates.
+	grant = mp->payload.sync;
+	if (isInOrder(mp)) {
+		grantWrite(mp);
+	} else {
+		deferMsg(mp);
+	}
 }
 
 // [S->A->S] Message from writer with write data. Can be in or out.
 static void msg_syncInfo (int fd, dsm_msg *mp) {
-	dsm_msg_sync data;
+	dsm_msg_sync data, tag;
+	dsm_proc *p;
+	int page;
 
 	// If it's not from the server, forward to the server.
-	if (fd != sock_server) {
+	if (!isServer(fd)) {
 		printf("[%d] SYNC_INFO: Forwarding syncInfo to server.\n", getpid()); fflush(stdout);
-		dsm_sendall(sock_server, mp, sizeof(*mp));
+		data = mp->payload.sync;
 
-		// Dequeue writer and mark as not-queued.
-		dsm_dequeueOpQueue(opqueue);
-		ptab.processes[fd].flags.is_queued = 0;
+		// Verify the update lies within the shared region.
+		if (data.offset < 0 || data.size > DSM_PAGESIZE || mp->size != 0 ||
+			data.offset + data.size > smap->size - smap->data_off) {
+			dsm_cpanic("msg_syncInfo", "Bad update!");
+		}
 
-		return;
-	}
+		// Attach the written bytes. The server's copy may be sent from the
+		// shared file: Nothing after this update is ordered (or granted)
+		// until the server has all of it, so they can't change meanwhile.
+		mp->data = (void *)smap + smap->data_off + data.offset;
+		mp->size = data.size;
+
+		// A writer that isn't queued took the page's word: It wrote under the
+		// write token. It is continued by the update like any other writer.
+		p = ptab.processes + fd;
+		page = data.offset / DSM_PAGESIZE;
+		if (p->flags.is_queued == 0) {
+			if (tokens[page].seq == 0) {
+				dsm_cpanic("msg_syncInfo", "Writer holds no grant!");
+			}
+			tag = tokens[page];
+			tokens[page].seq = 0;
+			token_update[page] = p->seq = tag.seq;
+			p->offset = data.offset;
+			p->flags.is_parked = 1;
+		} else {
+			tag = grant;
+		}
 
-	// Otherwise: Decode sync data. Prepare to receive.
-	data = mp->payload.sync;
-	printf("[%d] SYNC_INFO: Waiting for %zu bytes at %ld offset.\n", getpid(), data.size, data.offset);
-	fflush(stdout);
+		// Tag it with the grant: The local copy now has the update.
+		mp->payload.sync.seq = tag.seq;
+		mp->payload.sync.prev = tag.prev;
+		page_seq[page] = tag.seq;
 
-	// HACK: Receive data here and insert it.
-	dsm_mprotect((void *)smap + smap->data_off, DSM_PAGESIZE, PROT_WRITE);
-	memcpy((void *)smap + smap->data_off, mp->payload.sync.buf, sizeof(int));
-	dsm_mprotect((void *)smap + smap->data_off, DSM_PAGESIZE, PROT_READ);
-	
-	// Send acknowledgment to server.
-	send_doneMsg(sock_server, MSG_SYNC_DONE, pollableSet->fp - 2);
-	printf("[%d] SYNC_INFO: Sending receival ack!\n", getpid()); fflush(stdout);
+		// Send the server its copy. Updates under a token are relayed by it.
+		queueUpdate(getPageServer(data.offset), mp);
+		if (p->flags.is_queued == 0) {
+			return;
+		}
+
+		// Push the update of the granted writer to peers directly. Copy the
+		// bytes: The next write of the page may be granted before a slow
+		// peer takes them.
+		mp->type = MSG_SYNC_PUSH;
+		for (unsigned int i = 0; i < push_length; i++) {
+			dsm_queuemsg(getPeerSocket(push_peers[i]), mp);
+		}
+		push_length = 0;
+
+		// Dequeue writer and mark as not-queued. Request the next write.
+		dsm_dequeueOpQueue(opqueue);
+		ptab.processes[fd].flags.is_queued = 0;
+		if (dsm_isOpQueueEmpty(opqueue) == 0) {
+			requestWrite(ptab.processes + dsm_getOpQueueHead(opqueue));
+		}
+
+		return;
+	}
+
+	// Otherwise: Relayed by the server. Apply it.
+	applyUpdate(mp);
+}
+
+// [A->A] Message from the writer's arbiter with write data.
+static void msg_syncPush (int fd, dsm_msg *mp) {
+
+	// Validate message. Only peers may send this.
+	if (isServer(fd) || isProcess(fd)) {
+		dsm_cpanic("msg_syncPush", "Unauthorized message!");
+	}
+
+	applyUpdate(mp);
+}
+
+// [S->A] Message with the listener address of a peer arbiter.
+static void msg_setPeer (int fd, dsm_msg *mp) {
+
+	// Validate message. Only server may send this.
+	if (fd != sock_server) {
+		dsm_cpanic("msg_setPeer", "Unauthorized message!");
+	}
+
+	setPeer(&mp->payload.peer);
+}
+
+// [P->A->S] Message from process requesting a copy of a page.
+static void msg_pageReq (int fd, dsm_msg *mp) {
+
+	// Validate message. Only process may issue this.
+	if (isServer(fd)) {
+		dsm_cpanic("msg_pageReq", "Unauthorized page request!");
+	}
+
+	// Verify the page lies within the shared region.
+	if (mp->payload.page.offset < 0 || mp->payload.page.offset >= 
+		smap->size - smap->data_off) {
+		dsm_cpanic("msg_pageReq", "Page out of bounds!");
+	}
+
+	// Forward request on behalf of the process.
+	mp->payload.page.gid = ptab.processes[fd].gid;
+	dsm_queuemsg(getPageServer(mp->payload.page.offset), mp);
+}
+
+// [S->A->P] Message from server validating a page copy (data may follow).
+static void msg_pageData (int fd, dsm_msg *mp) {
+	dsm_msg_page data = mp->payload.page;
+	void *page = (void *)smap + smap->data_off + data.offset;
+	dsm_proc *p;
+
+	// Validate message. Only server may send this.
+	if (!isServer(fd)) {
+		dsm_cpanic("msg_pageData", "Unauthorized message!");
+	}
+
+	// Verify the data lies within the shared region.
+	if (data.offset < 0 || data.size > DSM_PAGESIZE || data.size != mp->size ||
+		data.offset + data.size > smap->size - smap->data_off) {
+		dsm_cpanic("msg_pageData", "Page out of bounds!");
+	}
+
+	// If the local copy is stale, copy the fresh one into the shared page. 
+	// (Unless updates pushed meanwhile already made the local one newer).
+	if (data.size > 0 && data.seq > page_seq[data.offset / DSM_PAGESIZE]) {
+		page_seq[data.offset / DSM_PAGESIZE] = data.seq;
+		dsm_mprotect(page, DSM_PAGESIZE, PROT_WRITE);
+		dsm_seqBegin(smap->seq + data.offset / DSM_PAGESIZE);
+		memcpy(page, mp->data, data.size);
+		dsm_seqEnd(smap->seq + data.offset / DSM_PAGESIZE);
+		dsm_mprotect(page, DSM_PAGESIZE, PROT_READ);
+	}
+
+	// Process now holds a valid copy.
+	p = getProcessByGID(data.gid);
+	p->valid[data.offset / DSM_PAGESIZE] = 1;
+
+	printf("[%d] PAGE_DATA: GID %d now holds page %ld!\n", getpid(), data.gid,
+		data.offset / DSM_PAGESIZE); fflush(stdout);
+
+	// Forward validation (without data) to the process.
+	mp->payload.page.size = mp->size = 0;
+	mp->data = NULL;
+	dsm_queuemsg(p->fd, mp);
 }
 
 // [P->A] Message from process requesting write-access.
@@ -514,58 +1179,267 @@ static void msg_syncRequest (int fd, dsm_msg *mp) {
 	dsm_proc *p = ptab.processes + fd;
 
 	// Validate message. Only process may issue this.
-	if (fd == sock_server) {
+	if (isServer(fd)) {
 		dsm_cpanic("msg_syncRequest", "Unauthorized sychronization message!");
 	}
 
 	// Enqueue process as wanting to write.
 	dsm_enqueueOpQueue(fd, opqueue);
+	p->offset = mp->payload.sync.offset;
 
-	// Mark process as: Stopped + Queued.
-	p->flags.is_stopped = p->flags.is_queued = 1;
+	// Mark process as: Parked + Queued.
+	p->flags.is_parked = p->flags.is_queued = 1;
 
-	// Issue request to the server.
-	send_simpleMsg(sock_server, MSG_SYNC_REQ);
+	// Issue request (with target offset) to the server, if first in line.
+	// Writers here are granted one at a time (there's one grant): The next
+	// request follows the update of the current writer.
+	if (dsm_getOpQueueHead(opqueue) == fd) {
+		requestWrite(p);
+	}
 }
 
-// [P->A] Message from process indicating it is waiting on a barrier.
+// [P->A] Message from last local process to arrive at a barrier. (Or from a
+// child in the tree, with the arrivals of its subtree).
 static void msg_waitBarr (int fd, dsm_msg *mp) {
+	dsm_proc *p;
 
-	// Validate message. Only non-writing process may issue this.
-	if (fd == sock_server) {
+	// Validate message. Only non-writing process (or child) may issue this.
+	if (isServer(fd)) {
 		dsm_cpanic("msg_waitBarr", "Unauthorized barrier message!");
 	}
 
-	printf("[%d] WAIT_BARR received!\n", getpid()); fflush(stdout);
+	printf("[%d] WAIT_BARR received (%u arrived)!\n", getpid(),
+		mp->payload.done.nproc); fflush(stdout);
 
-	// Mark process as waiting.
-	ptab.processes[fd].flags.is_waiting = 1;
+	// Mark all local processes as waiting.
+	for (int i = 0; isProcess(fd) && i < ptab.length; i++) {
+		p = ptab.processes + i;
+		if (p->pid != 0) {
+			p->flags.is_waiting = 1;
+		}
+	}
 
-	// Forward message to session-server. 
-	dsm_sendall(sock_server, mp, sizeof(*mp));
+	// Sum arrivals (nproc = local count): Passed up the tree this round.
+	pending_barr += mp->payload.done.nproc;
+}
+
+// [A->A] Message from a child with summed sync acknowledgements.
+static void msg_syncDone (int fd, dsm_msg *mp) {
+
+	// Validate message. Only children may send this.
+	if (isServer(fd) || isProcess(fd)) {
+		dsm_cpanic("msg_syncDone", "Unauthorized message!");
+	}
+
+	// Sum acknowledgements: Passed up the tree this round.
+	addAck(mp->payload.done.seq, mp->payload.done.nproc);
 }
 
 // [P->A->S] Message from process indicating it is terminating.
 static void msg_prgmDone (int fd, dsm_msg *mp) {
 
 	// Validate message. Only process may issue this.
-	if (fd == sock_server) {
+	if (isServer(fd)) {
 		dsm_cpanic("msg_prgmDone", "Unauthorized termination message!");
 	}
 
 	printf("[%d] PRGM_DONE received!\n", getpid()); fflush(stdout);
 
-	// Close connection and remove from pollable set.
-	close(fd);
-	dsm_removePollable(fd, pollableSet);
+	// Inform the servers so the process is removed from all copysets. Name
+	// the updates already acknowledged for it: Those don't expect one less.
+	mp->type = MSG_DEL_PROC;
+	mp->payload.proc.pid = ptab.processes[fd].pid;
+	mp->payload.proc.gid = ptab.processes[fd].gid;
+	memcpy(mp->payload.proc.seq, page_seq, sizeof(page_seq));
+	for (unsigned int i = 0; i < nservers; i++) {
+		dsm_queuemsg(sock_servers[i], mp);
+	}
 
-	// Remove from the process-table.
+	// Remove from the process-table and from future barriers.
 	unregisterProcess(fd);
+	__atomic_sub_fetch(&smap->barrier_nproc, 1, __ATOMIC_SEQ_CST);
 
-	// If no more connections remain, set the termination flag.
-	if (pollableSet->fp < 3) {
-		alive = 0;
+	// Close connection and remove from pollable set.
+	dropConnection(fd);
+
+	// If no more processes (or children) remain, set the termination flag.
+	checkAlive();
+}
+
+// [P->A->S] Message from process requesting a lock token.
+static void msg_lockReq (int fd, dsm_msg *mp) {
+	unsigned int id = mp->payload.lock.id;
+	dsm_lock_t *lp;
+
+	// Validate message. Only process may issue this.
+	if (isServer(fd) || id >= DSM_MAX_LOCKS) {
+		dsm_cpanic("msg_lockReq", "Unauthorized lock request!");
+	}
+	lp = smap->locks + id;
+
+	// If the token is here and not recalled: Process should just retry.
+	if (lp->word != LOCK_REMOTE && lp->recalled == 0) {
+		send_lockMsg(fd, MSG_LOCK_GRANT, id, 0);
+		return;
+	}
+
+	// Otherwise queue the process until the token (re)arrives.
+	dsm_enqueueOpQueue(fd, lockqueue[id]);
+	if (lock_requested[id] == 0) {
+		send_lockMsg(sock_server, MSG_LOCK_REQ, id, 0);
+		lock_requested[id] = 1;
 	}
+
+	// A recalled token might be free by now.
+	releaseLockToken(id);
+}
+
+// [S->A->P] Message from server granting a lock token.
+static void msg_lockGrant (int fd, dsm_msg *mp) {
+	unsigned int id = mp->payload.lock.id;
+	dsm_lock_t *lp;
+	int owner;
+
+	// Validate message. Only server may send this.
+	if (fd != sock_server || id >= DSM_MAX_LOCKS) {
+		dsm_cpanic("msg_lockGrant", "Unauthorized message!");
+	}
+	lp = smap->locks + id;
+
+	// Token is here. Recalled on arrival if other arbiters queued behind us.
+	lock_requested[id] = 0;
+	__atomic_store_n(&lp->recalled, mp->payload.lock.flag, __ATOMIC_SEQ_CST);
+
+	// No local requester left: Free the lock (and return it if recalled).
+	if (dsm_isOpQueueEmpty(lockqueue[id])) {
+		__atomic_store_n(&lp->word, LOCK_FREE, __ATOMIC_SEQ_CST);
+		dsm_futexWake(&lp->word, INT_MAX);
+		releaseLockToken(id);
+		return;
+	}
+
+	// Hand the lock to the first requester: It is owed at least one turn.
+	__atomic_store_n(&lp->word, LOCK_HELD, __ATOMIC_SEQ_CST);
+	owner = dsm_dequeueOpQueue(lockqueue[id]);
+	send_lockMsg(owner, MSG_LOCK_GRANT, id, 1);
+
+	// Remaining requesters retry locally.
+	while (!dsm_isOpQueueEmpty(lockqueue[id])) {
+		send_lockMsg(dsm_dequeueOpQueue(lockqueue[id]), MSG_LOCK_GRANT, id, 0);
+	}
+}
+
+// [S->A] Message from server recalling a lock token.
+static void msg_lockRecall (int fd, dsm_msg *mp) {
+	unsigned int id = mp->payload.lock.id;
+
+	// Validate message. Only server may send this.
+	if (fd != sock_server || id >= DSM_MAX_LOCKS) {
+		dsm_cpanic("msg_lockRecall", "Unauthorized message!");
+	}
+
+	// Local processes stop taking the lock; return it once free.
+	__atomic_store_n(&smap->locks[id].recalled, 1, __ATOMIC_SEQ_CST);
+	releaseLockToken(id);
+}
+
+// [S->A] Message from server recalling a write token.
+static void msg_writeRecall (int fd, dsm_msg *mp) {
+	int page = mp->payload.sync.offset / DSM_PAGESIZE, word;
+
+	// Validate message. Only server may send this.
+	if (!isServer(fd) || page < 0 || page >= DSM_SHM_NPAGES) {
+		dsm_cpanic("msg_writeRecall", "Unauthorized message!");
+	}
+
+	// A token not yet held is still deferred (or was used already): Return
+	// it once held.
+	if (tokens[page].seq != mp->payload.sync.seq) {
+		token_recalls[page] = mp->payload.sync.seq;
+		return;
+	}
+
+	// A token already taken by a local writer is returned by its update:
+	// Ignore the recall. Otherwise local writers stop taking it.
+	word = WRITE_FREE;
+	if (!__atomic_compare_exchange_n(smap->writes + page, &word, WRITE_REMOTE,
+		0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+		return;
+	}
+
+	// Sleeping local writers must now request their writes. (One woken by
+	// the token's arrival may not have taken it yet).
+	dsm_futexWake(smap->writes + page, INT_MAX);
+
+	// Return it unused.
+	mp->type = MSG_WRITE_REL;
+	dsm_queuemsg(fd, mp);
+	tokens[page].seq = 0;
+}
+
+// [P->A] Message from process that released a recalled lock.
+static void msg_lockRel (int fd, dsm_msg *mp) {
+
+	// Validate message. Only process may issue this.
+	if (isServer(fd) || mp->payload.lock.id >= DSM_MAX_LOCKS) {
+		dsm_cpanic("msg_lockRel", "Unauthorized lock release!");
+	}
+
+	releaseLockToken(mp->payload.lock.id);
+}
+
+// [P->A->S] Message from process requesting an atomic operation.
+static void msg_atomicReq (int fd, dsm_msg *mp) {
+	off_t offset = mp->payload.atomic.offset;
+
+	// Validate message. Only process may issue this.
+	if (isServer(fd)) {
+		dsm_cpanic("msg_atomicReq", "Unauthorized atomic request!");
+	}
+
+	// Verify the word lies within the shared region.
+	if (offset < 0 || offset % sizeof(int) != 0 ||
+		offset + sizeof(int) > smap->size - smap->data_off) {
+		dsm_cpanic("msg_atomicReq", "Word out of bounds!");
+	}
+
+	// Forward request on behalf of the process.
+	mp->payload.atomic.gid = ptab.processes[fd].gid;
+	dsm_queuemsg(getPageServer(offset), mp);
+}
+
+// [S->A->P] Message from server with the result of an atomic operation.
+static void msg_atomicDone (int fd, dsm_msg *mp) {
+
+	// Validate message. Only server may send this.
+	if (!isServer(fd)) {
+		dsm_cpanic("msg_atomicDone", "Unauthorized message!");
+	}
+
+	// Forward result to the requester. The new value is applied everywhere.
+	dsm_queuemsg(getProcessByGID(mp->payload.atomic.gid)->fd, mp);
+}
+
+// [P->A->S->A] Message waking processes waiting on a shared word.
+static void msg_notify (int fd, dsm_msg *mp) {
+	off_t offset = mp->payload.notify.offset;
+
+	// Verify the word lies within the shared region.
+	if (offset < 0 || offset % sizeof(int) != 0 ||
+		offset + sizeof(int) > smap->size - smap->data_off) {
+		dsm_cpanic("msg_notify", "Word out of bounds!");
+	}
+
+	// From a process: Local waiters are already woken. Pass on to the server
+	// of the page.
+	if (!isServer(fd)) {
+		dsm_queuemsg(getPageServer(offset), mp);
+		return;
+	}
+
+	// From the server: Wake local waiters.
+	dsm_futexWake((int *)((void *)smap + smap->data_off + offset),
+		mp->payload.notify.n);
 }
 
 
@@ -576,101 +1450,303 @@ static void msg_prgmDone (int fd, dsm_msg *mp) {
 */
 
 
-// Sends signal to 'fd'. If -1 is specified, sends to all fds in ptab.
-static void signalProcess (int fd, int signal) {
-	int pid = -1;
+// Returns a recalled lock token to the server if the lock is free.
+static void releaseLockToken (unsigned int id) {
+	dsm_lock_t *lp = smap->locks + id;
+	int c = LOCK_FREE;
 
-	// If file-descriptor is a natural number, send to it only.
-	if (fd >= 0) {
-		
-		// Validate file-descriptor.
-		if (fd > ptab.length) {
-			dsm_cpanic("signalProcess", "Specified file not in table!");
+	// Keep the token unless recalled.
+	if (__atomic_load_n(&lp->recalled, __ATOMIC_SEQ_CST) == 0) {
+		return;
+	}
+
+	// Take the token off the host only if no local process holds the lock.
+	if (!__atomic_compare_exchange_n(&lp->word, &c, LOCK_REMOTE, 0,
+		__ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+		return;
+	}
+	__atomic_store_n(&lp->recalled, 0, __ATOMIC_SEQ_CST);
+
+	// Sleeping local waiters must now ask for the token.
+	dsm_futexWake(&lp->word, INT_MAX);
+
+	// Return token to the server.
+	send_lockMsg(sock_server, MSG_LOCK_REL, id, 0);
+}
+
+// Queues update mp (data in the shared file) to fd. Sends it coded, or from
+// the shared file, if large. Only for the server: The bytes must not change
+// until it has them all.
+static void queueUpdate (int fd, dsm_msg *mp) {
+	off_t offset = smap->data_off + mp->payload.sync.offset;
+
+	if (mp->size < DSM_ZEROCOPY_MIN) {
+		dsm_queuemsg(fd, mp);
+	} else if (dsm_queuecompressed(fd, mp) == 0) {
+		dsm_queuefile(fd, mp, shm_fd, offset, mp->size);
+	}
+}
+
+// Applies update mp to the shared file, and acknowledges it up the tree.
+// Defers it if the previous update of its page is still missing.
+static void applyUpdate (dsm_msg *mp) {
+	dsm_msg_sync data = mp->payload.sync;
+	int page = data.offset / DSM_PAGESIZE;
+
+	printf("[%d] SYNC_INFO: Received %zu bytes at %ld offset.\n", getpid(), data.size, data.offset);
+	fflush(stdout);
+
+	// Verify the update lies within the shared region.
+	if (data.offset < 0 || data.size != mp->size ||
+		data.offset + data.size > smap->size - smap->data_off) {
+		dsm_cpanic("applyUpdate", "Update out of bounds!");
+	}
+
+	// Updates of a page are applied in order: Keep it until its turn.
+	if (isInOrder(mp) == 0) {
+		deferMsg(mp);
+		return;
+	}
+
+	// A fresh page copy may already contain it. Otherwise insert the data. 
+	// Readers retry around the update.
+	if (data.seq <= page_seq[page]) {
+		addAck(data.seq, countPageHolders(page));
+		return;
+	}
+	page_seq[page] = data.seq;
+	dsm_mprotect((void *)smap + smap->data_off, smap->size - smap->data_off, PROT_WRITE);
+	dsm_seqBegin(smap->seq + data.offset / DSM_PAGESIZE);
+	memcpy((void *)smap + smap->data_off + data.offset, mp->data, data.size);
+	dsm_seqEnd(smap->seq + data.offset / DSM_PAGESIZE);
+	dsm_wakeWaiters(smap, data.offset, data.size);
+	dsm_mprotect((void *)smap + smap->data_off, smap->size - smap->data_off, PROT_READ);
+	
+	// Acknowledge up the tree: nproc = local holders of the page.
+	addAck(data.seq, countPageHolders(page));
+	printf("[%d] SYNC_INFO: Sending receival ack!\n", getpid()); fflush(stdout);
+}
+
+// Forwards write grant mp to the queued writer.
+static void grantWrite (dsm_msg *mp) {
+	dsm_proc *p = ptab.processes + dsm_getOpQueueHead(opqueue);
+
+	// Remember the update: The server continues its writer by it.
+	p->seq = mp->payload.sync.seq;
+	send_procMsg(p, mp);
+}
+
+// Sends the server the write request of process p. If its page's word is
+// on the host, p retries locally instead: The next queued writer is up.
+static void requestWrite (dsm_proc *p) {
+	dsm_msg msg;
+
+	while (__atomic_load_n(smap->writes + p->offset / DSM_PAGESIZE,
+		__ATOMIC_SEQ_CST) != WRITE_REMOTE) {
+
+		// Tell the writer to take the word (no grant). Dequeue it.
+		memset(&msg, 0, sizeof(msg));
+		msg.type = MSG_WRITE_OKAY;
+		msg.payload.sync.offset = p->offset;
+		msg.payload.sync.token = 1;
+		send_procMsg(p, &msg);
+		dsm_dequeueOpQueue(opqueue);
+		p->flags.is_queued = p->flags.is_parked = 0;
+
+		if (dsm_isOpQueueEmpty(opqueue)) {
+			return;
 		}
+		p = ptab.processes + dsm_getOpQueueHead(opqueue);
+	}
 
-		printf("[%d] BZZT! Sent signal to [%d]!\n", getpid(), ptab.processes[fd].pid); fflush(stdout);
-		// Send the signal.
-		if (kill(ptab.processes[fd].pid, signal) == -1) {
-			dsm_panicf("Couldn't signal process (%d)!", 
-				ptab.processes[fd].pid);
+	send_syncRequest(p);
+}
+
+// Keeps write token mp for local writers. Wakes one waiting on its page.
+// Returns it unused if it was recalled while deferred.
+static void holdToken (dsm_msg *mp) {
+	int page = mp->payload.sync.offset / DSM_PAGESIZE;
+	dsm_proc *p;
+
+	// Recalled while deferred: Return it. The word is left as it is.
+	if (token_recalls[page] == mp->payload.sync.seq) {
+		token_recalls[page] = 0;
+		mp->type = MSG_WRITE_REL;
+		dsm_queuemsg(getPageServer(mp->payload.sync.offset), mp);
+
+	// Otherwise the update before it was written here: Its word stays on the
+	// host.
+	} else {
+		tokens[page] = mp->payload.sync;
+		token_update[page] = 0;
+		if (__atomic_exchange_n(smap->writes + page, WRITE_FREE,
+			__ATOMIC_SEQ_CST) == WRITE_CONTENDED) {
+			dsm_futexWake(smap->writes + page, 1);
 		}
+	}
 
-		return;
+	// A queued writer of the page retries locally, or requests again. (The
+	// server drops requests while the token is out).
+	if (dsm_isOpQueueEmpty(opqueue) == 0) {
+		p = ptab.processes + dsm_getOpQueueHead(opqueue);
+		if (p->offset / DSM_PAGESIZE == page) {
+			requestWrite(p);
+		}
 	}
+}
 
-	// Signal all processes in the table.
-	for (int i = 0; i < ptab.length; i++) {
-		pid = ptab.processes[i].pid;
+// Returns nonzero if update (or grant) mp follows the last applied update of
+// its page (or is already covered by it).
+static int isInOrder (dsm_msg *mp) {
+	unsigned int last = page_seq[mp->payload.sync.offset / DSM_PAGESIZE];
+
+	return (mp->payload.sync.prev == last || mp->payload.sync.seq <= last);
+}
+
+// Keeps a copy of update (or grant) mp until it is in order.
+static void deferMsg (dsm_msg *mp) {
+	dsm_msg *dp;
+
+	// Grow the list as needed.
+	if (deferred_length >= deferred_size) {
+		deferred_size = MAX(8, 2 * deferred_size);
+		if ((deferred = realloc(deferred, deferred_size * sizeof(dsm_msg)))
+			== NULL) {
+			dsm_cpanic("deferMsg", "realloc failed");
+		}
+	}
 
-		// Ignore unused slots.
-		if (pid == 0) {
+	// Copy the data: The receive buffer is reused.
+	dp = deferred + deferred_length++;
+	*dp = *mp;
+	dp->data = NULL;
+	if (mp->size > 0) {
+		dp->data = dsm_zalloc(mp->size);
+		memcpy(dp->data, mp->data, mp->size);
+	}
+
+	printf("[%d] Deferred update %u (page awaits %u)!\n", getpid(), 
+		mp->payload.sync.seq, mp->payload.sync.prev); fflush(stdout);
+}
+
+// Handles the deferred updates and grants that are now in order. Each may
+// put others in order: Repeat until none is.
+static void runDeferred (void) {
+	dsm_msg msg;
+
+	for (unsigned int i = 0; i < deferred_length; i++) {
+		if (isInOrder(deferred + i) == 0) {
 			continue;
 		}
 
-		printf("[%d] BZZT! Sent signal to [%d]!\n", getpid(), pid); fflush(stdout);
-		// Send the signal.
-		if (kill(pid, signal) == -1) {
-			dsm_panicf("Couldn't signal process (%d)!", pid);
+		// Remove it (the last takes its place), then handle it.
+		msg = deferred[i];
+		deferred[i] = deferred[--deferred_length];
+		if (msg.type == MSG_WRITE_OKAY && msg.payload.sync.token) {
+			holdToken(&msg);
+		} else if (msg.type == MSG_WRITE_OKAY) {
+			grantWrite(&msg);
+		} else {
+			applyUpdate(&msg);
 		}
+		free(msg.data);
+		i = -1;
 	}
 }
 
-// Contacts daemon with sid, sets session details. Exits fatally on error.
-static int getServerSocket (const char *sid, const char *addr, 
-	const char *port, unsigned int nproc) {
-	dsm_msg msg;
-	int s;
+// Adds nproc acknowledgements of update seq, to pass up the tree.
+static void addAck (unsigned int seq, unsigned int nproc) {
+	unsigned int i;
 
-	/*
-		****************************
+	if (nproc == 0) {
+		return;
+	}
 
-	// 1. Construct GET request.
-	memset(&msg, 0, sizeof(msg));
-	msg.type = MSG_GET_SESSION;
-	sprintf(msg.payload.get.sid, "%*s", DSM_SID_SIZE, sid);
-	msg.payload.get.nproc = nproc;
+	// Sum into the entry of the update, if there is one.
+	for (i = 0; i < acks_length && pending_acks[i].seq != seq; i++)
+		;
+	if (i < acks_length) {
+		pending_acks[i].nproc += nproc;
+		return;
+	}
 
-	// 2. Connect to session daemon.
-	s = dsm_getConnectedSocket(addr, port);
-	printf("[%d] Connected to daemon!\n", getpid()); fflush(stdout);
+	// Otherwise add one. Grow the list as needed.
+	if (acks_length >= acks_size) {
+		acks_size = MAX(8, 2 * acks_size);
+		if ((pending_acks = realloc(pending_acks, 
+			acks_size * sizeof(dsm_msg_done))) == NULL) {
+			dsm_cpanic("addAck", "realloc failed");
+		}
+	}
+	pending_acks[acks_length].seq = seq;
+	pending_acks[acks_length++].nproc = nproc;
+}
 
-	// 3. Send request.
-	dsm_sendall(s, &msg, sizeof(msg));
+// Unregisters and closes a connection.
+static void dropConnection (int fd) {
 
-	// 4. Read reply.
-	dsm_recvall(s, &msg, sizeof(msg));
+	// Forget it as a peer connection. A closed child has exited.
+	for (int i = 0; i < peers_length; i++) {
+		if (peers[i].fd == fd) {
+			peers[i].fd = -1;
+			peers[i].link = (peers[i].link == TREE_CHILD ? TREE_NONE : 
+				peers[i].link);
+		}
+	}
 
-	// 5. Verify reply.
-	if (msg.type != DSM_SET_SESSION) {
-		dsm_cpanic("getServerSocket", "Unrecognized response!");
+	// Close connection and remove from pollable set.
+	dsm_removePollable(fd, pollableSet);
+	dsm_dropmsgs(fd);
+	close(fd);
+}
+
+// Stops once no processes, and no children in the tree, remain. Inner
+// arbiters keep forwarding for their subtree.
+static void checkAlive (void) {
+	if (started == 1 && countProcesses() == 0 && countChildren() == 0) {
+		alive = 0;
 	}
+}
 
-	printf("[%d] Received reply from daemon!\n", getpid());
-	dsm_showMsg(&msg);
+// Returns nonzero if fd is a connection to a session-server.
+static int isServer (int fd) {
+	for (unsigned int i = 0; i < nservers; i++) {
+		if (sock_servers[i] == fd) {
+			return 1;
+		}
+	}
+	return 0;
+}
 
-	// 6. Close connection.
-	close(s);
+// Returns the server of the page at offset.
+static int getPageServer (off_t offset) {
+	return sock_servers[dsm_getPagePart(offset / DSM_PAGESIZE, nservers)];
+}
 
-		****************************
-	*/
+// Returns the server that ordered update seq: Server k takes those equal to
+// k + 1 modulo nservers.
+static int getSeqServer (unsigned int seq) {
+	return sock_servers[(seq - 1) % nservers];
+}
 
-	char addrbuf[INET6_ADDRSTRLEN];
-	printf("Enter the address of the server: "); fflush(stdout);
-	scanf("%s", addrbuf);
-	addrbuf[INET6_ADDRSTRLEN - 1] = '\0'; 
 
-	printf("Enter the port of the server: "); fflush(stdout);
-	scanf("%u", &(msg.payload.set.port));
-	putchar('\n');
+// Connects to the servers in sp.
+static void connectServers (const dsm_servers *sp) {
 
-	// 7. Connect to session server.
-	s = dsm_getConnectedSocket(addrbuf, 
-			dsm_portToString(msg.payload.set.port));
+	// Connect to each server. (Counted as connected: A panic closes them).
+	for (nservers = 0; nservers < sp->n; nservers++) {
+		sock_servers[nservers] = dsm_getConnectedSocket(sp->addr, 
+			dsm_portToString(sp->ports[nservers]));
+	}
+	sock_server = sock_servers[0];
 
-	printf("[%d] Connected to server!\n", getpid()); fflush(stdout);
+	printf("[%d] Connected to %u server(s)!\n", getpid(), nservers);
+	fflush(stdout);
+}
 
-	// 8. Return connected socket.
-	return s; 
+// Updates the poll events of fd. Called when its queued output changes.
+static void setPollEvents (int fd, short events) {
+	dsm_setPollable(fd, events, pollableSet);
 }
 
 // Accepts incoming connection, and updates the list of pollable descriptors.
@@ -679,45 +1755,135 @@ static void processConnection (int sock_listen) {
 	socklen_t newAddrSize = sizeof(newAddr);
 	int sock_new;
 
-	// If the session has started. Ignore connection.
-	if (started) {
-		dsm_warning("Ignoring connection: Session has already started!");
-		return;
-	}
-
 	// Try accepting connection.
 	if ((sock_new = accept(sock_listen, (struct sockaddr *)&newAddr,
 		&newAddrSize)) == -1) {
 		dsm_panic("Couldn't accept connection!");
 	}
 
-	// Register connection in pollable descriptor list.
+	// Register connection in pollable descriptor list. Never block on it.
+	dsm_setNonBlocking(sock_new);
 	dsm_setPollable(sock_new, POLLIN, pollableSet);	
 }
 
-// Reads message from fd. Decodes and selects appropriate action.
+// Reads available input from fd. Decodes and handles each complete message.
 static void processMessage (int fd) {
 	dsm_msg msg;
 	void (*action)(int, dsm_msg *);
 
-	// Read in message: If no connection -> Panic.
-	if (dsm_recvall(fd, &msg, sizeof(msg)) != 0) {
+	// Read in available input: If no connection -> Panic.
+	if (dsm_fillmsgs(fd) != 0) {
 		// TODO: GRACEFULLY STOP ALL OTHER PROCESSES HERE.
-		if (fd == sock_server) {
+		if (isServer(fd)) {
 			dsm_cpanic("Lost connection to server!", "Terminating!");
-		} else {
+		} else if (isProcess(fd)) {
 			dsm_cpanic("Lost connection to process!", "Terminating!");
 		}
-	}
 
-	// Determine action based on message type.
-	if ((action = dsm_getMsgFunc(msg.type, fmap)) == NULL) {
-		dsm_warning("No action for message type!");
+		// Peers close their connections as they exit.
+		dropConnection(fd);
+		checkAlive();
 		return;
 	}
 
-	// Execute action.
-	action(fd, &msg);
+	// Handle each complete message. (A handler closing fd drops its input).
+	while (dsm_nextmsg(fd, &msg)) {
+
+		// Determine action based on message type.
+		if ((action = dsm_getMsgFunc(msg.type, fmap)) == NULL) {
+			dsm_warning("No action for message type!");
+			continue;
+		}
+
+		// Execute action.
+		action(fd, &msg);
+	}
+}
+
+// Polls for events. Sleeps only while all rings are empty: Processes wake
+// the arbiter over its eventfd while it sleeps.
+static int pollEvents (void) {
+	int new;
+
+	// Announce the sleep, then check the rings (processes do the reverse).
+	__atomic_store_n(&smap->arb_sleeping, 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	new = dsm_poll(pollableSet, (hasRingInput() ? 0 : -1));
+	__atomic_store_n(&smap->arb_sleeping, 0, __ATOMIC_RELAXED);
+
+	return new;
+}
+
+// Closes the connections, sockets and files of the arbiter, and frees its
+// state. Also tidies up an arbiter that panicked partway.
+static void freeArbiter (const char *sid) {
+	char path[DSM_ARB_PATH_SIZE];
+
+	// Hang up on remaining processes and on the servers.
+	for (int i = 0; i < ptab.length; i++) {
+		if (ptab.processes[i].pid != 0) {
+			close(ptab.processes[i].fd);
+		}
+	}
+	for (unsigned int i = 0; i < nservers; i++) {
+		close(sock_servers[i]);
+	}
+
+	// Disconnect from peers.
+	freePeerTable();
+	free(push_peers);
+
+	// Free acknowledgement and deferred lists.
+	free(pending_acks);
+	for (unsigned int i = 0; i < deferred_length; i++) {
+		free(deferred[i].data);
+	}
+	free(deferred);
+
+	// Close the eventfd.
+	if (rings_efd != -1) {
+		close(rings_efd);
+	}
+
+	// Close listener sockets. Remove the local socket file.
+	if (sock_listen != -1) {
+		close(sock_listen);
+		snprintf(path, DSM_ARB_PATH_SIZE, DSM_ARB_PATH_FMT, DSM_SID_SIZE, sid);
+		unlink(path);
+	}
+	if (sock_peer != -1) {
+		close(sock_peer);
+	}
+
+	// Close the shared file.
+	if (shm_fd != -1) {
+		close(shm_fd);
+	}
+
+	// Free operation-queue.
+	dsm_freeOpQueue(opqueue);
+
+	// Free lock queues.
+	for (int i = 0; i < DSM_MAX_LOCKS; i++) {
+		dsm_freeOpQueue(lockqueue[i]);
+	}
+
+	// Free the pollable set.
+	dsm_freePollSet(pollableSet);
+
+	// Free the process table.
+	freeProcessTable();
+
+	// Free the connection buffers.
+	dsm_freemsgs();
+
+	// Unmap shared memory object. Close the semaphore.
+	if (smap != NULL && munmap(smap, DSM_SHM_FILE_SIZE) == -1) {
+		dsm_warning("Couldn't unmap shared file!");
+	}
+	if (sem_start != NULL) {
+		sem_close(sem_start);
+	}
 }
 
 
@@ -727,28 +1893,104 @@ static void processMessage (int fd) {
  *******************************************************************************
 */
 
-void arbiter (
+/* Finds the servers of a session. Asks the session-daemon, which starts them
+ * if needed. If no daemon listens, asks the user.
+*/
+void dsm_findServers (const char *sid, unsigned int nproc, const char *addr,
+	const char *port, dsm_servers *sp) {
+	char line[256], *p = line, *end;
+	dsm_msg msg;
+	int s;
+
+	memset(sp, 0, sizeof(dsm_servers));
+
+	// Ask the daemon: It starts the servers of the session if needed.
+	if ((s = dsm_getSocketIfListening(addr, port)) != -1) {
+		memset(&msg, 0, sizeof(msg));
+		msg.type = MSG_GET_SESSION;
+		snprintf(msg.payload.get.sid, DSM_SID_SIZE + 1, "%s", sid);
+		msg.payload.get.nproc = nproc;
+		dsm_sendmsg(s, &msg);
+
+		// The reply holds the ports of all servers.
+		if (dsm_recvmsg(s, &msg) != 0 || msg.type != MSG_SET_SESSION ||
+			msg.size == 0 || msg.size % sizeof(unsigned int) != 0 ||
+			msg.size > sizeof(sp->ports)) {
+			dsm_cpanic("dsm_findServers", "Unrecognized response!");
+		}
+		sp->n = msg.size / sizeof(unsigned int);
+		memcpy(sp->ports, msg.data, msg.size);
+		snprintf(sp->addr, INET6_ADDRSTRLEN, "%s", addr);
+		close(s);
+		printf("[%d] Received %u server(s) from daemon!\n", getpid(), sp->n);
+		return;
+	}
+
+	// Otherwise ask the user: The ports of all servers, in partition order.
+	printf("Enter the address of the server: "); fflush(stdout);
+	scanf("%45s", sp->addr);
+
+	printf("Enter the port(s) of the server(s): "); fflush(stdout);
+	scanf(" %255[^\n]", line);
+	putchar('\n');
+
+	for (sp->n = 0; sp->n < DSM_MAX_SERVERS; sp->n++) {
+		sp->ports[sp->n] = strtoul(p, &end, 10);
+		if (end == p) {
+			break;
+		}
+		p = end;
+	}
+	if (sp->n == 0) {
+		dsm_cpanic("dsm_findServers", "No server port given!");
+	}
+}
+
+int arbiter (
 	const char *sid,		// Session identifier.
 	unsigned int nproc,		// Total number of expected processes.
-	const char *addr,		// Daemon address.
-	const char *port		// Daemon port.
+	const dsm_servers *sp	// Servers of the session.
 	) {
 
 	int new;								// Count of active file-descriptors.
 	struct pollfd *pfd;						// Pointer to poll structure.
+	char path[DSM_ARB_PATH_SIZE];			// Local socket path.
+	jmp_buf fail;							// Where panics jump to.
 
 	// ------------------------------ Setup ------------------------------------
 
+	// A panic ends only this arbiter: Tidy up, then report the failure. (Its
+	// host may run other sessions).
+	sock_listen = sock_peer = shm_fd = rings_efd = -1;
+	if (setjmp(fail) != 0) {
+		dsm_setPanicJump(NULL);
+		freeArbiter(sid);
+		return -1;
+	}
+	dsm_setPanicJump(&fail);
+
 	// Register functions.
 	if (dsm_setMsgFunc(MSG_ADD_PROC, msg_addProc, fmap) 	!= 0 ||
 		dsm_setMsgFunc(MSG_SET_GID, msg_setgid, fmap)		!= 0 ||
-		dsm_setMsgFunc(MSG_STOP_ALL, msg_stopAll, fmap)		!= 0 ||
+		dsm_setMsgFunc(MSG_SET_PEER, msg_setPeer, fmap)		!= 0 ||
 		dsm_setMsgFunc(MSG_CONT_ALL, msg_contAll, fmap) 	!= 0 ||
 		dsm_setMsgFunc(MSG_WAIT_DONE, msg_waitDone, fmap) 	!= 0 ||
 		dsm_setMsgFunc(MSG_WRITE_OKAY, msg_writeOkay, fmap) != 0 ||
 		dsm_setMsgFunc(MSG_SYNC_INFO, msg_syncInfo, fmap) 	!= 0 ||
+		dsm_setMsgFunc(MSG_SYNC_PUSH, msg_syncPush, fmap) 	!= 0 ||
 		dsm_setMsgFunc(MSG_SYNC_REQ, msg_syncRequest, fmap) != 0 ||
+		dsm_setMsgFunc(MSG_PAGE_REQ, msg_pageReq, fmap) 	!= 0 ||
+		dsm_setMsgFunc(MSG_PAGE_DATA, msg_pageData, fmap) 	!= 0 ||
+		dsm_setMsgFunc(MSG_LOCK_REQ, msg_lockReq, fmap) 	!= 0 ||
+		dsm_setMsgFunc(MSG_LOCK_GRANT, msg_lockGrant, fmap) != 0 ||
+		dsm_setMsgFunc(MSG_LOCK_RECALL, msg_lockRecall, fmap) != 0 ||
+		dsm_setMsgFunc(MSG_WRITE_RECALL, msg_writeRecall, fmap) != 0 ||
+		dsm_setMsgFunc(MSG_LOCK_REL, msg_lockRel, fmap) 	!= 0 ||
+		dsm_setMsgFunc(MSG_ATOMIC_REQ, msg_atomicReq, fmap) != 0 ||
+		dsm_setMsgFunc(MSG_ATOMIC_DONE, msg_atomicDone, fmap) != 0 ||
+		dsm_setMsgFunc(MSG_NOTIFY, msg_notify, fmap) 		!= 0 ||
 		dsm_setMsgFunc(MSG_WAIT_BARR, msg_waitBarr, fmap) 	!= 0 ||
+		dsm_setMsgFunc(MSG_SYNC_DONE, msg_syncDone, fmap) 	!= 0 ||
 		dsm_setMsgFunc(MSG_PRGM_DONE, msg_prgmDone, fmap) 	!= 0) {
 		dsm_cpanic("Couldn't set functions", "Unknown!");
 	}
@@ -756,29 +1998,77 @@ void arbiter (
 	// Initialize process table.
 	initProcessTable(DSM_MIN_NPROC);
 
-	// Initialize pollable-set.
+	// Initialize pollable-set. Queued output updates its events.
 	pollableSet = dsm_initPollSet(DSM_MIN_POLLABLE);
+	dsm_setMsgEventsFunc(setPollEvents);
 
 	// Initialize operation-queue.
 	opqueue = dsm_initOpQueue(DSM_MIN_OPQUEUE_SIZE);
 
-	// Setup server socket.
-	sock_server = getServerSocket(sid, addr, port, nproc);
+	// Initialize lock queues.
+	for (int i = 0; i < DSM_MAX_LOCKS; i++) {
+		lockqueue[i] = dsm_initOpQueue(DSM_MIN_OPQUEUE_SIZE);
+	}
+
+	// Name the semaphore and shared file of the session.
+	snprintf(sem_name, DSM_SHM_NAME_SIZE, DSM_SEM_INIT_FMT, DSM_SID_SIZE, sid);
+	snprintf(shm_name, DSM_SHM_NAME_SIZE, DSM_SHM_FILE_FMT, DSM_SID_SIZE, sid);
+
+	// Open the initialization semaphore (created by the first process).
+	if ((sem_start = sem_open(sem_name, O_RDWR)) == SEM_FAILED) {
+		sem_start = NULL;
+		dsm_panicf("Couldn't open named-semaphore: \"%s\"!", sem_name);
+	}
+
+	// Open and map the shared file (before it is unlinked). It is kept open
+	// for sending updates.
+	if ((shm_fd = shm_open(shm_name, O_RDWR, 0)) == -1) {
+		dsm_panic("Couldn't open the shared file!");
+	}
+	if ((smap = mmap(NULL, DSM_SHM_FILE_SIZE, PROT_READ | PROT_WRITE,
+		MAP_SHARED, shm_fd, 0)) == MAP_FAILED) {
+		smap = NULL;
+		dsm_panic("Couldn't map the shared file!");
+	}
+
+	// Locate the process rings. Processes wake the arbiter with the eventfd.
+	rings = (dsm_ring_pair *)((void *)smap + smap->ring_off);
+	if ((rings_efd = eventfd(0, EFD_NONBLOCK)) == -1) {
+		dsm_panic("Couldn't create eventfd!");
+	}
+
+	// Setup server sockets.
+	connectServers(sp);
 
-	// Setup listener socket: Designated port.
-	sock_listen = dsm_getBoundSocket(AI_PASSIVE, AF_UNSPEC, SOCK_STREAM,
-		DSM_DEF_ARB_PORT);
+	// Setup listener socket: Local processes skip the TCP stack.
+	snprintf(path, DSM_ARB_PATH_SIZE, DSM_ARB_PATH_FMT, DSM_SID_SIZE, sid);
+	sock_listen = dsm_getBoundUnixSocket(path);
 
-	// Listen on socket.
-	if (listen(sock_listen, DSM_DEF_BACKLOG) == -1) {
+	// Setup peer listener socket: Any port.
+	sock_peer = dsm_getBoundSocket(AI_PASSIVE, AF_UNSPEC, SOCK_STREAM,
+		DSM_ARB_PEER_PORT);
+
+	// Listen on sockets.
+	if (listen(sock_listen, DSM_DEF_BACKLOG) == -1 ||
+		listen(sock_peer, DSM_DEF_BACKLOG) == -1) {
 		dsm_panic("Couldn't listen on socket!");
 	}
 
-	// Set listener socket as pollable.
+	// Set listener sockets as pollable.
 	dsm_setPollable(sock_listen, POLLIN, pollableSet);
+	dsm_setPollable(sock_peer, POLLIN, pollableSet);
+
+	// Set the eventfd as pollable.
+	dsm_setPollable(rings_efd, POLLIN, pollableSet);
 
-	// Set server socket as pollable.
-	dsm_setPollable(sock_server, POLLIN, pollableSet);
+	// Set server sockets as pollable. Never block on them.
+	for (unsigned int i = 0; i < nservers; i++) {
+		dsm_setNonBlocking(sock_servers[i]);
+		dsm_setPollable(sock_servers[i], POLLIN, pollableSet);
+	}
+
+	// Register the listener with the server: Peers push updates to it.
+	send_peerMsg();
 
 	// Up the initialization semaphore.
 	for (int i = 0; i < nproc; i++) {
@@ -786,9 +2076,11 @@ void arbiter (
 	}
 
 	printf("=================================== ARBITER ===================================\n");
-	printf("Listener socket: "); dsm_showSocketInfo(sock_listen);
+	printf("Listener socket: %s\n", path);
+	printf("Peer listener socket: "); dsm_showSocketInfo(sock_peer);
 	printf("sid = %s\n", sid);
 	printf("nproc = %u\n", nproc);
+	printf("servers = %u\n", nservers);
 	dsm_showPollable(pollableSet);
 	dsm_showOpQueue(opqueue);
 	showProcessTable();
@@ -797,9 +2089,9 @@ void arbiter (
 
 	// ---------------------------- Main Body -----------------------------------
 
-	while (alive && (new = poll(pollableSet->fds, pollableSet->fp, -1)) != -1) {
-		for (int i = 0; i < pollableSet->fp; i++) {
-			pfd = pollableSet->fds + i;
+	while (alive && (new = pollEvents()) != -1) {
+		for (int i = 0; i < new; i++) {
+			pfd = pollableSet->ready + i;
 
 			// If nothing to read, ignore file-descriptor.
 			if ((pfd->revents & POLLIN) == 0) {
@@ -807,8 +2099,14 @@ void arbiter (
 			}
 
 			// If listener socket: Process connection.
-			if (pfd->fd == sock_listen) {
-				processConnection(sock_listen);
+			if (pfd->fd == sock_listen || pfd->fd == sock_peer) {
+				processConnection(pfd->fd);
+				continue;
+			}
+
+			// If eventfd: Clear it. The rings are checked below.
+			if (pfd->fd == rings_efd) {
+				eventfd_read(rings_efd, &(eventfd_t){0});
 				continue;
 			}
 
@@ -816,6 +2114,19 @@ void arbiter (
 			processMessage(pfd->fd);
 		}
 
+		// Handle ring requests, and what this round put in order. Then send
+		// all replies of this round: One send per connection.
+		processRings();
+		runDeferred();
+		send_treeAcks();
+		dsm_flushmsgs();
+
+		// Wake all processes released this round: One wake-up.
+		if (unpark) {
+			dsm_unpark(smap);
+			unpark = 0;
+		}
+
 		//printf("[%d] Arbiter State\n", getpid());
 		//dsm_showPollable(pollableSet);
 		//dsm_showOpQueue(opqueue);
@@ -829,41 +2140,30 @@ void arbiter (
 	// ----------------------------- Cleanup ------------------------------------
 
 	// Send disconnect message.
-	send_simpleMsg(sock_server, MSG_PRGM_DONE);
-
-	// Disconnect from server.
-	close(sock_server);
-
-	// Close listener socket.
-	close(sock_listen);
-
-	// Free operation-queue.
-	dsm_freeOpQueue(opqueue);
+	send_treeAcks();
+	for (unsigned int i = 0; i < nservers; i++) {
+		send_simpleMsg(sock_servers[i], MSG_PRGM_DONE);
+		dsm_drainmsgs(sock_servers[i]);
+	}
 
-	// Free the pollable set.
-	dsm_freePollSet(pollableSet);
+	// Show message statistics.
+	dsm_showStats("Arbiter");
 
-	// Free the process table.
-	freeProcessTable();
+	// Wait for the servers to hang up. (A write token may arrive after the
+	// last write).
+	for (unsigned int i = 0; i < nservers; i++) {
+		dsm_discardmsgs(sock_servers[i]);
+	}
 
-	// Unmap shared memory object.
-	//if (munmap(smap, smap->size) == -1) {
-	//	dsm_panic("Couldn't unmap shared file!");
-	//}
+	// Send peers what is still queued for them.
+	for (int i = 0; i < peers_length; i++) {
+		if (peers[i].fd != -1) {
+			dsm_drainmsgs(peers[i].fd);
+		}
+	}
 
-	// Exit.
-	exit(EXIT_SUCCESS);
+	// Disconnect, and free the arbiter state.
+	dsm_setPanicJump(NULL);
+	freeArbiter(sid);
+	return 0;
 }
-
-
-/*
- *******************************************************************************
- *                                    Main                                     *
- *******************************************************************************
-*/
-
-
-//int main (int argc, const char *argv[]) {
-//	arbiter("arethusa", 2, "127.0.0.1", "4200");
-//	return 0;
-//}
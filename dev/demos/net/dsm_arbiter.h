@@ -1,6 +1,24 @@
 #if !defined(DSM_ARBITER_H)
 #define DSM_ARBITER_H
 
+#include <netinet/in.h>
+#include "dsm_htab.h"
+
+
+/*
+ *******************************************************************************
+ *                              Type Definitions                               *
+ *******************************************************************************
+*/
+
+
+// The session servers of an arbiter.
+typedef struct dsm_servers {
+	char addr[INET6_ADDRSTRLEN];			// Address of the servers.
+	unsigned int ports[DSM_MAX_SERVERS];	// Server ports, in partition order.
+	unsigned int n;							// Number of servers.
+} dsm_servers;
+
 
 /*
  *******************************************************************************
@@ -9,14 +27,27 @@
 */
 
 
-/* Runs the arbiter routine. This function does not return. 
+/* Finds the servers of a session. Asks the session-daemon, which starts them
+ * if needed. If no daemon listens, asks the user.
  * - sid: The session identifier
  * - nproc: The total number of expected participant processes (across network).
  * - addr: The address of the session-daemon.
  * - port: The port of the session-daemon.
+ * - sp: Set to the servers of the session.
+*/
+void dsm_findServers (const char *sid, unsigned int nproc, const char *addr,
+	const char *port, dsm_servers *sp);
+
+/* Runs the arbiter routine until all processes of the session have exited.
+ * Maps the shared file and opens the semaphore of the session by name. The
+ * arbiter state is thread-local: Several sessions may run on threads.
+ * Returns 0 when done, or -1 if it failed: A panic ends only the arbiter (and
+ * not the process it runs in).
+ * - sid: The session identifier
+ * - nproc: The total number of expected participant processes (across network).
+ * - sp: The servers of the session (see dsm_findServers).
 */
-void arbiter (const char *sid, unsigned int nproc, const char *addr,
-	const char *port);
+int arbiter (const char *sid, unsigned int nproc, const dsm_servers *sp);
 
 
 #endif
\ No newline at end of file
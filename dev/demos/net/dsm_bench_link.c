@@ -0,0 +1,152 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netdb.h>
+
+#include "dsm_inet.h"
+#include "dsm_msg.h"
+#include "dsm_util.h"
+
+
+/*
+ *******************************************************************************
+ *                             Symbolic Constants                              *
+ *******************************************************************************
+*/
+
+
+// Round trips measured per configuration.
+#define BENCH_ROUNDS			20000
+
+// Round trips before measuring.
+#define BENCH_WARMUP			1000
+
+// Path of the unix domain socket.
+#define BENCH_PATH				"/tmp/dsm_bench_link.sock"
+
+
+/*
+ *******************************************************************************
+ *                            Function Definitions                             *
+ *******************************************************************************
+*/
+
+
+// Sends back every message received on s until it is closed. Then exits.
+static void echo (int s) {
+	dsm_msg msg;
+
+	while (dsm_recvmsg(s, &msg) == 0) {
+		dsm_sendmsg(s, &msg);
+	}
+	exit(EXIT_SUCCESS);
+}
+
+// Returns a connection to a forked echo process: Over a unix domain socket
+// if withUnix is nonzero, otherwise over loopback TCP. Sets its pid.
+static int getLink (int withUnix, pid_t *pid) {
+	unsigned int port;
+	int l, s;
+
+	// Listen like the arbiter does.
+	if (withUnix) {
+		l = dsm_getBoundUnixSocket(BENCH_PATH);
+	} else {
+		l = dsm_getBoundSocket(AI_PASSIVE, AF_INET, SOCK_STREAM, "0");
+	}
+	if (listen(l, 1) == -1) {
+		dsm_panic("Couldn't listen on socket!");
+	}
+
+	// Fork the echo process. (It mustn't inherit unflushed output).
+	fflush(stdout);
+	if ((*pid = fork()) == 0) {
+		if ((s = accept(l, NULL, NULL)) == -1) {
+			dsm_panic("Couldn't accept connection!");
+		}
+		close(l);
+		echo(s);
+	}
+
+	// Connect like a process does.
+	if (withUnix) {
+		s = dsm_getConnectedUnixSocket(BENCH_PATH);
+	} else {
+		dsm_getSocketInfo(l, NULL, 0, &port);
+		s = dsm_getConnectedSocket(DSM_LOOPBACK_ADDR, dsm_portToString(port));
+	}
+	close(l);
+
+	return s;
+}
+
+// Measures the round trip of a message with 'size' bytes of data. Returns
+// nanoseconds per round trip.
+static double measure (int withUnix, size_t size) {
+	unsigned char *data = dsm_zalloc(MAX(size, 1));
+	dsm_msg msg, reply;
+	pid_t pid;
+	int s = getLink(withUnix, &pid);
+	double t;
+
+	// Random bytes: Nothing to gain from coding.
+	for (size_t i = 0; i < size; i++) {
+		data[i] = rand();
+	}
+
+	// An update as sent by a writer (a write request if without data).
+	memset(&msg, 0, sizeof(msg));
+	msg.type = (size > 0 ? MSG_SYNC_INFO : MSG_SYNC_REQ);
+	msg.payload.sync.size = msg.size = size;
+	msg.data = data;
+
+	// Warm up, then measure.
+	for (int r = 0; r < BENCH_WARMUP + BENCH_ROUNDS; r++) {
+		if (r == BENCH_WARMUP) {
+			t = dsm_now();
+		}
+		dsm_sendmsg(s, &msg);
+		if (dsm_recvmsg(s, &reply) != 0 || reply.size != size) {
+			dsm_panic("Round trip failed!");
+		}
+	}
+	t = (dsm_now() - t) / BENCH_ROUNDS;
+
+	// Clean up.
+	close(s);
+	waitpid(pid, NULL, 0);
+	if (withUnix) {
+		unlink(BENCH_PATH);
+	}
+	free(data);
+
+	return t;
+}
+
+
+/*
+ *******************************************************************************
+ *                                    Main                                     *
+ *******************************************************************************
+*/
+
+
+// Prints the round trip latency of the process to arbiter link, over a unix
+// domain socket and over loopback TCP, as the data size grows.
+int main (void) {
+	size_t sizes[] = {0, 64, 512, 4096};
+	double unix_ns, tcp_ns;
+
+	printf("%10s %16s %16s %10s\n", "bytes", "unix ns", "tcp ns", "speedup");
+	for (int i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		unix_ns = measure(1, sizes[i]);
+		tcp_ns = measure(0, sizes[i]);
+		printf("%10zu %16.0f %16.0f %9.2fx\n", sizes[i], unix_ns, tcp_ns,
+			tcp_ns / unix_ns);
+	}
+
+	return EXIT_SUCCESS;
+}
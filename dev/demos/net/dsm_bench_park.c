@@ -0,0 +1,182 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "dsm_types.h"
+#include "dsm_util.h"
+
+
+/*
+ *******************************************************************************
+ *                             Symbolic Constants                              *
+ *******************************************************************************
+*/
+
+
+// Stop + continue rounds measured per configuration.
+#define BENCH_ROUNDS			200
+
+// Largest number of processes measured.
+#define BENCH_MAX_PROCS			32
+
+
+/*
+ *******************************************************************************
+ *                              Type Definitions                               *
+ *******************************************************************************
+*/
+
+
+// State shared by the measuring process and the measured processes.
+typedef struct bench_shared {
+	int stop;				// Rounds in which the processes were stopped.
+	int cont;				// Rounds in which the processes were continued.
+	int resumed;			// Continues noticed, over all processes.
+	dsm_smap smap;			// Park word and count.
+} bench_shared;
+
+
+/*
+ *******************************************************************************
+ *                            Function Definitions                             *
+ *******************************************************************************
+*/
+
+
+// Runs until continued in each round, as suspended by job-control signals.
+static void runSignaled (bench_shared *b) {
+	for (int r = 0; r < BENCH_ROUNDS; r++) {
+		while (__atomic_load_n(&b->cont, __ATOMIC_SEQ_CST) <= r) {
+			sched_yield();
+		}
+		__atomic_add_fetch(&b->resumed, 1, __ATOMIC_SEQ_CST);
+	}
+	exit(EXIT_SUCCESS);
+}
+
+// Runs until stopped in each round, then parks until continued.
+static void runParked (bench_shared *b) {
+	int park;
+
+	for (int r = 0; r < BENCH_ROUNDS; r++) {
+		while (__atomic_load_n(&b->stop, __ATOMIC_SEQ_CST) <= r) {
+			sched_yield();
+		}
+		while (1) {
+			park = __atomic_load_n(&b->smap.park_epoch, __ATOMIC_SEQ_CST);
+			if (__atomic_load_n(&b->cont, __ATOMIC_SEQ_CST) > r) {
+				break;
+			}
+			dsm_park(&b->smap, park);
+		}
+		__atomic_add_fetch(&b->resumed, 1, __ATOMIC_SEQ_CST);
+	}
+	exit(EXIT_SUCCESS);
+}
+
+// Waits until all 'n' processes noticed continue round r.
+static void waitResumed (bench_shared *b, int n, int r) {
+	while (__atomic_load_n(&b->resumed, __ATOMIC_SEQ_CST) < n * (r + 1)) {
+		sched_yield();
+	}
+}
+
+// Measures stopping and continuing 'n' processes: With SIGTSTP and SIGCONT
+// sent to each if withSignals is nonzero, otherwise by parking on a futex
+// word. Sets the nanoseconds per stop and per continue.
+static void measure (int withSignals, int n, double *stop_ns, double *cont_ns) {
+	bench_shared *b;
+	pid_t pids[BENCH_MAX_PROCS];
+	double t;
+
+	// Map the shared state.
+	if ((b = mmap(NULL, sizeof(*b), PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED) {
+		dsm_panic("Couldn't map shared state!");
+	}
+	memset(b, 0, sizeof(*b));
+
+	// Fork the processes. (They mustn't inherit unflushed output).
+	fflush(stdout);
+	for (int i = 0; i < n; i++) {
+		if ((pids[i] = fork()) == 0) {
+			if (withSignals) {
+				runSignaled(b);
+			} else {
+				runParked(b);
+			}
+		}
+	}
+
+	*stop_ns = *cont_ns = 0;
+	for (int r = 0; r < BENCH_ROUNDS; r++) {
+
+		// Stop all: Until every process is suspended.
+		t = dsm_now();
+		if (withSignals) {
+			for (int i = 0; i < n; i++) {
+				kill(pids[i], SIGTSTP);
+			}
+			for (int i = 0; i < n; i++) {
+				waitpid(pids[i], NULL, WUNTRACED);
+			}
+		} else {
+			__atomic_store_n(&b->stop, r + 1, __ATOMIC_SEQ_CST);
+			while (__atomic_load_n(&b->smap.nparked, __ATOMIC_SEQ_CST) < n) {
+				sched_yield();
+			}
+		}
+		*stop_ns += dsm_now() - t;
+
+		// Continue all: Until every process runs again.
+		t = dsm_now();
+		__atomic_store_n(&b->cont, r + 1, __ATOMIC_SEQ_CST);
+		if (withSignals) {
+			for (int i = 0; i < n; i++) {
+				kill(pids[i], SIGCONT);
+			}
+		} else {
+			dsm_unpark(&b->smap);
+		}
+		waitResumed(b, n, r);
+		*cont_ns += dsm_now() - t;
+	}
+	*stop_ns /= BENCH_ROUNDS;
+	*cont_ns /= BENCH_ROUNDS;
+
+	// Clean up.
+	for (int i = 0; i < n; i++) {
+		waitpid(pids[i], NULL, 0);
+	}
+	munmap(b, sizeof(*b));
+}
+
+
+/*
+ *******************************************************************************
+ *                                    Main                                     *
+ *******************************************************************************
+*/
+
+
+// Prints the latency of stopping and continuing all processes, with job-
+// control signals and with futex parking, as the process count grows.
+int main (void) {
+	double sig_stop, sig_cont, park_stop, park_cont;
+
+	printf("%6s %14s %14s %14s %14s\n", "nproc", "sig stop ns", "sig cont ns",
+		"park stop ns", "park cont ns");
+	for (int n = 1; n <= BENCH_MAX_PROCS; n *= 2) {
+		measure(1, n, &sig_stop, &sig_cont);
+		measure(0, n, &park_stop, &park_cont);
+		printf("%6d %14.0f %14.0f %14.0f %14.0f\n", n, sig_stop, sig_cont,
+			park_stop, park_cont);
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,134 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+
+#include "dsm_poll.h"
+#include "dsm_util.h"
+
+
+/*
+ *******************************************************************************
+ *                             Symbolic Constants                              *
+ *******************************************************************************
+*/
+
+
+// Wakeups measured per configuration.
+#define BENCH_ROUNDS			20000
+
+// Largest number of idle connections.
+#define BENCH_MAX_IDLE			8192
+
+
+/*
+ *******************************************************************************
+ *                            Function Definitions                             *
+ *******************************************************************************
+*/
+
+
+// Raises the file-descriptor limit to fit nidle connections.
+static void raiseFileLimit (unsigned int nidle) {
+	struct rlimit rl;
+
+	if (getrlimit(RLIMIT_NOFILE, &rl) == -1) {
+		dsm_panic("Couldn't get file limit!");
+	}
+	rl.rlim_cur = MIN(rl.rlim_max, 2 * nidle + 64);
+	if (setrlimit(RLIMIT_NOFILE, &rl) == -1) {
+		dsm_panic("Couldn't set file limit!");
+	}
+}
+
+// Measures the cost of one wakeup with nidle idle connections registered.
+// Returns nanoseconds per wakeup for dsm_poll, and for poll(2) in *poll_ns.
+static double measure (unsigned int nidle, double *poll_ns) {
+	int (*idle)[2] = malloc(MAX(nidle, 1) * sizeof(int[2]));
+	int active[2];
+	pollset *p = dsm_initPollSet(16);
+	char c = 0;
+	double t, epoll_ns;
+
+	// Register idle connections, and one active one.
+	for (unsigned int i = 0; i < nidle; i++) {
+		if (socketpair(AF_UNIX, SOCK_STREAM, 0, idle[i]) == -1) {
+			dsm_panic("Couldn't create socket pair!");
+		}
+		dsm_setPollable(idle[i][0], POLLIN, p);
+	}
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, active) == -1) {
+		dsm_panic("Couldn't create socket pair!");
+	}
+	dsm_setPollable(active[0], POLLIN, p);
+
+	// Wake on the active connection: dsm_poll.
+	t = dsm_now();
+	for (int r = 0; r < BENCH_ROUNDS; r++) {
+		if (write(active[1], &c, 1) != 1 || dsm_poll(p, -1) != 1 ||
+			read(p->ready[0].fd, &c, 1) != 1) {
+			dsm_panic("dsm_poll round failed!");
+		}
+	}
+	epoll_ns = (dsm_now() - t) / BENCH_ROUNDS;
+
+	// Wake on the active connection: poll(2) over the same set.
+	t = dsm_now();
+	for (int r = 0; r < BENCH_ROUNDS; r++) {
+		if (write(active[1], &c, 1) != 1 || poll(p->fds, p->fp, -1) != 1) {
+			dsm_panic("poll round failed!");
+		}
+		for (int i = 0; i < p->fp; i++) {
+			if ((p->fds[i].revents & POLLIN) != 0 &&
+				read(p->fds[i].fd, &c, 1) != 1) {
+				dsm_panic("poll round failed!");
+			}
+		}
+	}
+	*poll_ns = (dsm_now() - t) / BENCH_ROUNDS;
+
+	// Clean up.
+	for (unsigned int i = 0; i < nidle; i++) {
+		dsm_removePollable(idle[i][0], p);
+		close(idle[i][0]);
+		close(idle[i][1]);
+	}
+	close(active[0]);
+	close(active[1]);
+	dsm_freePollSet(p);
+	free(idle);
+
+	return epoll_ns;
+}
+
+
+/*
+ *******************************************************************************
+ *                                    Main                                     *
+ *******************************************************************************
+*/
+
+
+// Prints the wakeup cost of a pollset as the number of idle connections
+// grows. The cost of dsm_poll should stay flat, while poll(2) grows.
+int main (int argc, const char *argv[]) {
+	unsigned int max_idle = BENCH_MAX_IDLE;
+	double epoll_ns, poll_ns;
+
+	// Optional argument: Largest number of idle connections.
+	if (argc > 1 && (max_idle = atoi(argv[1])) == 0) {
+		fprintf(stderr, "usage: %s [<max-idle-connections>]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+	raiseFileLimit(max_idle);
+
+	printf("%10s %16s %16s\n", "idle", "dsm_poll ns", "poll(2) ns");
+	for (unsigned int n = 0; n <= max_idle; n = (n == 0 ? 128 : 2 * n)) {
+		epoll_ns = measure(n, &poll_ns);
+		printf("%10u %16.0f %16.0f\n", n, epoll_ns, poll_ns);
+	}
+
+	return EXIT_SUCCESS;
+}
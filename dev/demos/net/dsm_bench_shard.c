@@ -0,0 +1,241 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "dsm_types.h"
+#include "dsm_inet.h"
+#include "dsm_msg.h"
+#include "dsm_util.h"
+
+
+/*
+ *******************************************************************************
+ *                             Symbolic Constants                              *
+ *******************************************************************************
+*/
+
+
+// Updates written per arbiter and configuration.
+#define BENCH_ROUNDS			2000
+
+// Arbiters writing at once: One per page.
+#define BENCH_ARBITERS			DSM_SHM_NPAGES
+
+// Largest number of server workers measured.
+#define BENCH_MAX_WORKERS		16
+
+// Bytes written per update.
+#define BENCH_UPDATE_SIZE		64
+
+// Path of the server binary, and of its output.
+#define BENCH_SERVER			"./server"
+#define BENCH_LOG				"/tmp/dsm_bench_shard.log"
+
+
+/*
+ *******************************************************************************
+ *                            Function Definitions                             *
+ *******************************************************************************
+*/
+
+
+// Starts a server for the arbiters with 'nworkers' workers. Sets its pid.
+// Returns its port.
+static unsigned int startServer (int nworkers, pid_t *pid) {
+	char nproc_arg[32], workers_arg[32], fanout_arg[32], line[256];
+	unsigned int port = 0;
+	FILE *log;
+	int fd;
+
+	// Every arbiter at the top of the tree: Nothing to forward.
+	snprintf(nproc_arg, sizeof(nproc_arg), "-nproc=%d", BENCH_ARBITERS);
+	snprintf(workers_arg, sizeof(workers_arg), "-workers=%d", nworkers);
+	snprintf(fanout_arg, sizeof(fanout_arg), "-fanout=%d", BENCH_ARBITERS);
+
+	// Run it with its output to the log. (It mustn't inherit unflushed
+	// output).
+	fflush(stdout);
+	if ((*pid = fork()) == 0) {
+		if ((fd = open(BENCH_LOG, O_WRONLY | O_CREAT | O_TRUNC, 0644)) == -1) {
+			dsm_panic("Couldn't open log!");
+		}
+		dup2(fd, STDOUT_FILENO);
+		close(fd);
+		execl(BENCH_SERVER, BENCH_SERVER, nproc_arg, workers_arg, fanout_arg,
+			(char *)NULL);
+		dsm_panic("Couldn't run server!");
+	}
+
+	// Read its port from the log.
+	while (port == 0) {
+		usleep(10000);
+		if ((log = fopen(BENCH_LOG, "r")) == NULL) {
+			continue;
+		}
+		while (port == 0 && fgets(line, sizeof(line), log) != NULL) {
+			if (strstr(line, "PORT: ") != NULL) {
+				sscanf(strstr(line, "PORT: "), "PORT: %u", &port);
+			}
+		}
+		fclose(log);
+	}
+
+	return port;
+}
+
+// Receives messages on s until one of 'type'. Exits fatally on a hang-up.
+static void recvType (int s, dsm_msg_t type, dsm_msg *mp) {
+	do {
+		if (dsm_recvmsg(s, mp) != 0) {
+			dsm_panic("Server hung up!");
+		}
+	} while (mp->type != type);
+}
+
+// Acts as the arbiter of one process writing page 'page' over and over.
+// Sets the nanoseconds taken once the session starts.
+static void runArbiter (unsigned int port, int page, double *ns) {
+	unsigned char data[BENCH_UPDATE_SIZE];
+	int s, gid, held = 0;
+	dsm_msg msg, token;
+	double t;
+
+	// Random bytes: Nothing to gain from coding.
+	for (int i = 0; i < BENCH_UPDATE_SIZE; i++) {
+		data[i] = rand();
+	}
+
+	// Register a listener (never used: nobody shares the page), and the
+	// process.
+	s = dsm_getConnectedSocket(DSM_LOOPBACK_ADDR, dsm_portToString(port));
+	memset(&msg, 0, sizeof(msg));
+	msg.type = MSG_ADD_PEER;
+	msg.payload.peer.port = 1;
+	snprintf(msg.payload.peer.addr, INET6_ADDRSTRLEN, DSM_LOOPBACK_ADDR);
+	dsm_sendmsg(s, &msg);
+	memset(&msg, 0, sizeof(msg));
+	msg.type = MSG_ADD_PROC;
+	msg.payload.proc.pid = getpid();
+	dsm_sendmsg(s, &msg);
+	recvType(s, MSG_SET_GID, &msg);
+	gid = msg.payload.proc.gid;
+
+	// Wait for the start, then become the holder of the page.
+	recvType(s, MSG_WAIT_DONE, &msg);
+	memset(&msg, 0, sizeof(msg));
+	msg.type = MSG_PAGE_REQ;
+	msg.payload.page.gid = gid;
+	msg.payload.page.offset = page * DSM_PAGESIZE;
+	dsm_sendmsg(s, &msg);
+	recvType(s, MSG_PAGE_DATA, &msg);
+
+	// Write: Request (unless a write token is held), update, and wait until
+	// it is done. The server may hand over a token for the next write
+	// meanwhile. (It drops requests while the token is out).
+	t = dsm_now();
+	for (int r = 0; r < BENCH_ROUNDS; r++) {
+		if (held) {
+			msg = token;
+			held = 0;
+		} else {
+			memset(&msg, 0, sizeof(msg));
+			msg.type = MSG_SYNC_REQ;
+			msg.payload.sync.offset = page * DSM_PAGESIZE;
+			dsm_sendmsg(s, &msg);
+			recvType(s, MSG_WRITE_OKAY, &msg);
+		}
+
+		msg.type = MSG_SYNC_INFO;
+		msg.payload.sync.token = 0;
+		msg.payload.sync.size = msg.size = BENCH_UPDATE_SIZE;
+		msg.data = data;
+		dsm_sendmsg(s, &msg);
+		do {
+			if (dsm_recvmsg(s, &msg) != 0) {
+				dsm_panic("Server hung up!");
+			}
+			if (msg.type == MSG_WRITE_OKAY) {
+				token = msg;
+				held = 1;
+			}
+		} while (msg.type != MSG_CONT_ALL);
+	}
+	*ns = dsm_now() - t;
+
+	// Exit.
+	memset(&msg, 0, sizeof(msg));
+	msg.type = MSG_DEL_PROC;
+	msg.payload.proc.gid = gid;
+	dsm_sendmsg(s, &msg);
+	msg.type = MSG_PRGM_DONE;
+	dsm_sendmsg(s, &msg);
+
+	// Close once the server hangs up. (It may have granted a write token
+	// since the last write).
+	while (dsm_recvmsg(s, &msg) == 0);
+	close(s);
+
+	exit(EXIT_SUCCESS);
+}
+
+// Measures the update throughput of a server with 'nworkers' workers, with
+// all arbiters writing their own page at once. Returns updates per second.
+static double measure (int nworkers) {
+	pid_t server, pids[BENCH_ARBITERS];
+	unsigned int port;
+	double *ns, slowest = 0;
+
+	// Map the times of the arbiters.
+	if ((ns = mmap(NULL, BENCH_ARBITERS * sizeof(double), PROT_READ |
+		PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED) {
+		dsm_panic("Couldn't map shared state!");
+	}
+
+	// Start the server, then the arbiters.
+	port = startServer(nworkers, &server);
+	for (int i = 0; i < BENCH_ARBITERS; i++) {
+		if ((pids[i] = fork()) == 0) {
+			runArbiter(port, i, ns + i);
+		}
+	}
+
+	// The server exits once all arbiters have.
+	for (int i = 0; i < BENCH_ARBITERS; i++) {
+		waitpid(pids[i], NULL, 0);
+		slowest = MAX(slowest, ns[i]);
+	}
+	waitpid(server, NULL, 0);
+
+	// Clean up.
+	munmap(ns, BENCH_ARBITERS * sizeof(double));
+	unlink(BENCH_LOG);
+
+	return BENCH_ARBITERS * BENCH_ROUNDS / (slowest / 1e9);
+}
+
+
+/*
+ *******************************************************************************
+ *                                    Main                                     *
+ *******************************************************************************
+*/
+
+
+// Prints the update throughput of the server as its worker count grows.
+// Run from the directory of the server binary.
+int main (void) {
+	double base = 0, rate;
+
+	printf("%8s %16s %10s\n", "workers", "updates/s", "speedup");
+	for (int n = 1; n <= BENCH_MAX_WORKERS; n *= 2) {
+		rate = measure(n);
+		base = (n == 1 ? rate : base);
+		printf("%8d %16.0f %9.2fx\n", n, rate, rate / base);
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -26,6 +26,8 @@
 
 // Configures message payload depending on the type.
 void configMsg (int i, dsm_msg *mp) {
+	static int word;
+
 	memset(mp, 0, sizeof(*mp));
 	switch (i) {
 		case 0: {
@@ -39,8 +41,8 @@ void configMsg (int i, dsm_msg *mp) {
 			break;
 		}
 		case 2: {
-			mp->type = MSG_STOP_DONE;
-			mp->payload.done.nproc = 1;
+			mp->type = MSG_WRITE_REL;
+			mp->payload.sync.offset = 32;
 			break;
 		}
 		case 3: {
@@ -55,12 +57,13 @@ void configMsg (int i, dsm_msg *mp) {
 		case 5: {
 			mp->type = MSG_SYNC_INFO;
 			mp->payload.sync.offset = 32;
-			mp->payload.sync.size = 4;
+			mp->payload.sync.size = mp->size = sizeof(word);
+			mp->data = &word;
 			break;
 		}
 		case 6: {
 			mp->type = MSG_WAIT_BARR;
-			mp->payload.barr.nproc = 1;
+			mp->payload.done.nproc = 1;
 			break;
 		}
 		case 7: {
@@ -98,7 +101,7 @@ void sendMsg (int i, int s) {
 	dsm_showMsg(&msg);
 
 	// Send message.
-	dsm_sendall(s, &msg, sizeof(msg));
+	dsm_sendmsg(s, &msg);
 }
 
 
@@ -113,7 +116,9 @@ void getReply (int s) {
 	dsm_msg msg;
 
 	// Receive message.
-	dsm_recvall(s, &msg, sizeof(msg));
+	if (dsm_recvmsg(s, &msg) != 0) {
+		dsm_cpanic("getReply", "Connection closed!");
+	}
 
 	printf("Received a reply:\n");
 	dsm_showMsg(&msg);
@@ -128,7 +133,7 @@ unsigned int getInput (void) {
 		printf(" :: PROCESS <-> ARBITER <-> SERVER ::\n");
 		printf("0 - MSG_SET_GID: Set process global ID.\n");
 		printf("1 - MSG_SYNC_REQ: (Arbiter/Process) wants to write.\n");
-		printf("2 - MST_STOP_DONE: Arbiter has stopped all processes.\n");
+		printf("2 - MSG_WRITE_REL: Arbiter returns an unused write token.\n");
 		printf("3 - MSG_SYNC_DONE: Arbiter has received all update data.\n");
 		printf("4 - MSG_PRGM_DONE: (Arbiter/Process) is exiting.\n");
 		printf("5 - MSG_SYNC_INFO: (Arbiter/Process) is sending sync information.\n");
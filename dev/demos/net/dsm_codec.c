@@ -0,0 +1,226 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <arpa/inet.h>
+
+#include "dsm_codec.h"
+
+
+/*
+ *******************************************************************************
+ *                              Global Variables                               *
+ *******************************************************************************
+*/
+
+
+// Moving average of the RLE coded size (percent of raw).
+static __thread unsigned int rle_ratio = 50;
+
+// Messages since RLE was last tried.
+static __thread unsigned int rle_skipped;
+
+
+/*
+ *******************************************************************************
+ *                        Internal Function Definitions                        *
+ *******************************************************************************
+*/
+
+
+// Writes the raw length prefix n to dst. Returns the prefix size.
+static size_t putRawSize (void *dst, size_t n) {
+	uint32_t raw = htonl(n);
+	memcpy(dst, &raw, sizeof(raw));
+	return sizeof(raw);
+}
+
+// Returns nonzero if all n bytes of src are zero.
+static int isZero (const unsigned char *src, size_t n) {
+	for (size_t i = 0; i < n; i++) {
+		if (src[i] != 0) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+// Returns nonzero if n bytes of src are one repeated 32-bit word.
+static int isWord (const unsigned char *src, size_t n) {
+	if (n % sizeof(uint32_t) != 0) {
+		return 0;
+	}
+	for (size_t i = sizeof(uint32_t); i < n; i += sizeof(uint32_t)) {
+		if (memcmp(src, src + i, sizeof(uint32_t)) != 0) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+// Codes n bytes of src as runs and literals into dst, of at most 'limit'
+// bytes. A control byte c < 128 precedes c + 1 literal bytes. A control byte
+// c >= 128 precedes a byte repeated c - 125 times. Returns the coded size,
+// or zero if it exceeds limit.
+static size_t encodeRLE (const unsigned char *src, size_t n,
+	unsigned char *dst, size_t limit) {
+	size_t i = 0, lit = 0, o = 0, r;
+
+	while (i < n || lit < i) {
+
+		// Measure the run at i (up to 130 bytes).
+		for (r = 1; i + r < n && r < 130 && src[i + r] == src[i]; r++)
+			;
+
+		// Flush literals before a run, when full, or at the end.
+		if (lit < i && (r >= 3 || i - lit == 128 || i == n)) {
+			if (o + 1 + (i - lit) > limit) {
+				return 0;
+			}
+			dst[o++] = i - lit - 1;
+			memcpy(dst + o, src + lit, i - lit);
+			o += i - lit;
+			lit = i;
+		}
+		if (i == n) {
+			break;
+		}
+
+		// Emit a run, or take the byte as a literal.
+		if (r >= 3) {
+			if (o + 2 > limit) {
+				return 0;
+			}
+			dst[o++] = 128 + r - 3;
+			dst[o++] = src[i];
+			lit = (i += r);
+		} else {
+			i++;
+		}
+	}
+
+	return o;
+}
+
+// Decodes 'size' bytes of RLE src into n bytes of dst. Returns nonzero on
+// a bad encoding.
+static int decodeRLE (const unsigned char *src, size_t size,
+	unsigned char *dst, size_t n) {
+	size_t i = 0, o = 0, r;
+
+	while (i < size) {
+		if (src[i] < 128) {
+			r = src[i++] + 1;
+			if (i + r > size || o + r > n) {
+				return -1;
+			}
+			memcpy(dst + o, src + i, r);
+			i += r;
+		} else {
+			r = src[i++] - 125;
+			if (i >= size || o + r > n) {
+				return -1;
+			}
+			memset(dst + o, src[i++], r);
+		}
+		o += r;
+	}
+
+	return (o == n ? 0 : -1);
+}
+
+
+/*
+ *******************************************************************************
+ *                            Function Definitions                             *
+ *******************************************************************************
+*/
+
+
+// Codes n bytes of src into dst (of at least DSM_CODEC_BOUND(n) bytes) with
+// the cheapest codec that saves space: Zero and repeated-word data are
+// always detected. RLE is tried while its measured ratio pays off (and
+// probed now and then otherwise). Returns the codec, and the coded size in
+// *size. Returns DSM_CODEC_RAW if nothing saves space.
+dsm_codec dsm_compress (const void *src, size_t n, void *dst, size_t *size) {
+	size_t o, coded;
+
+	// Too small to pay off.
+	if (n < DSM_CODEC_MIN_SIZE) {
+		return DSM_CODEC_RAW;
+	}
+	o = putRawSize(dst, n);
+
+	// Zero-filled.
+	if (isZero(src, n)) {
+		*size = o;
+		return DSM_CODEC_ZERO;
+	}
+
+	// One repeated word (e.g. a filled buffer).
+	if (isWord(src, n)) {
+		memcpy(dst + o, src, sizeof(uint32_t));
+		*size = o + sizeof(uint32_t);
+		return DSM_CODEC_WORD;
+	}
+
+	// Skip RLE while it isn't paying off, except for a periodic probe.
+	if (rle_ratio > DSM_CODEC_RLE_CUTOFF &&
+		++rle_skipped < DSM_CODEC_RLE_PROBE) {
+		return DSM_CODEC_RAW;
+	}
+	rle_skipped = 0;
+
+	// Runs and literals. Track the ratio (failure counts as 100%).
+	coded = encodeRLE(src, n, dst + o, n - o - 1);
+	rle_ratio = (3 * rle_ratio + (coded ? 100 * (o + coded) / n : 100)) / 4;
+	if (coded == 0) {
+		return DSM_CODEC_RAW;
+	}
+	*size = o + coded;
+	return DSM_CODEC_RLE;
+}
+
+// Returns the raw length of 'size' bytes of src coded with codec. Returns
+// zero on a bad encoding.
+size_t dsm_getRawSize (dsm_codec codec, const void *src, size_t size) {
+	uint32_t raw;
+
+	if (codec <= DSM_CODEC_RAW || codec >= DSM_CODEC_MAX ||
+		size < sizeof(raw)) {
+		return 0;
+	}
+	memcpy(&raw, src, sizeof(raw));
+	return ntohl(raw);
+}
+
+// Decodes 'size' bytes of src coded with codec into dst, of the raw length.
+// Returns nonzero on a bad encoding.
+int dsm_decompress (dsm_codec codec, const void *src, size_t size, void *dst) {
+	size_t n = dsm_getRawSize(codec, src, size), o = sizeof(uint32_t);
+
+	if (n == 0) {
+		return -1;
+	}
+
+	switch (codec) {
+		case DSM_CODEC_ZERO:
+			memset(dst, 0, n);
+			return (size == o ? 0 : -1);
+
+		case DSM_CODEC_WORD:
+			if (size != o + sizeof(uint32_t) || n % sizeof(uint32_t) != 0) {
+				return -1;
+			}
+			for (size_t i = 0; i < n; i += sizeof(uint32_t)) {
+				memcpy(dst + i, src + o, sizeof(uint32_t));
+			}
+			return 0;
+
+		case DSM_CODEC_RLE:
+			return decodeRLE(src + o, size - o, dst, n);
+
+		default:
+			return -1;
+	}
+}
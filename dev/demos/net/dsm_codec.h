@@ -0,0 +1,68 @@
+#if !defined(DSM_CODEC_H)
+#define DSM_CODEC_H
+
+
+#include <sys/types.h>
+
+
+/*
+ *******************************************************************************
+ *                             Symbolic Constants                              *
+ *******************************************************************************
+*/
+
+
+// Smallest data worth compressing.
+#define DSM_CODEC_MIN_SIZE		64
+
+// Largest coded size of 'n' bytes (raw length prefix + worst case RLE).
+#define DSM_CODEC_BOUND(n)		(4 + (n) + (n) / 128 + 1)
+
+// Run-length ratio (percent of raw) above which RLE is only probed.
+#define DSM_CODEC_RLE_CUTOFF	90
+
+// Probe RLE once every this many messages while it isn't paying off.
+#define DSM_CODEC_RLE_PROBE		16
+
+
+/*
+ *******************************************************************************
+ *                              Type Definitions                               *
+ *******************************************************************************
+*/
+
+
+// Codecs. Carried in the flags of a message frame header.
+typedef enum dsm_codec {
+	DSM_CODEC_RAW = 0,		// Not coded.
+	DSM_CODEC_ZERO,			// All zero: Only the raw length is sent.
+	DSM_CODEC_WORD,			// One repeated 32-bit word: Length and word.
+	DSM_CODEC_RLE,			// Byte runs and literals.
+	DSM_CODEC_MAX
+} dsm_codec;
+
+
+/*
+ *******************************************************************************
+ *                            Function Declarations                            *
+ *******************************************************************************
+*/
+
+
+// Codes n bytes of src into dst (of at least DSM_CODEC_BOUND(n) bytes) with
+// the cheapest codec that saves space: Zero and repeated-word data are
+// always detected. RLE is tried while its measured ratio pays off (and
+// probed now and then otherwise). Returns the codec, and the coded size in
+// *size. Returns DSM_CODEC_RAW if nothing saves space.
+dsm_codec dsm_compress (const void *src, size_t n, void *dst, size_t *size);
+
+// Returns the raw length of 'size' bytes of src coded with codec. Returns
+// zero on a bad encoding.
+size_t dsm_getRawSize (dsm_codec codec, const void *src, size_t size);
+
+// Decodes 'size' bytes of src coded with codec into dst, of the raw length.
+// Returns nonzero on a bad encoding.
+int dsm_decompress (dsm_codec codec, const void *src, size_t size, void *dst);
+
+
+#endif
\ No newline at end of file
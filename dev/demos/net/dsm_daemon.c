@@ -34,6 +34,9 @@
 // Minimum number of concurrent pollable connections.
 #define	DSM_MIN_POLLABLE		64
 
+// Default number of servers per session.
+#define DSM_DEF_SERVERS			1
+
 
 /*
  *******************************************************************************
@@ -51,6 +54,9 @@ dsm_msg_func fmap[MSG_MAX_VALUE];
 // The listener socket.
 int sock_listen;
 
+// Number of servers started per session: Each serves a partition of pages.
+unsigned int nservers = DSM_DEF_SERVERS;
+
 
 /*
  *******************************************************************************
@@ -59,9 +65,10 @@ int sock_listen;
 */
 
 
-// Exec's to session server. Supplies address, port, and SID as input.
+// Exec's to session server. Supplies address, port, SID, and page partition
+// as input.
 static void execServer (const char *address, const char *port, const char *sid, 
-	int nproc);
+	int nproc, unsigned int part, unsigned int nparts);
 
 
 /*
@@ -71,17 +78,26 @@ static void execServer (const char *address, const char *port, const char *sid,
 */
 
 
-// Sends a response message to fd informing it to connect to port.
-static void send_getSessionReply (int fd, unsigned int port) {
+// Sends a response message to fd informing it to connect to the servers of
+// the given session. The first is also set as the port.
+static void send_getSessionReply (int fd, dsm_session *entry) {
+	unsigned int ports[DSM_MAX_SERVERS];
 	dsm_msg msg;
 	memset(&msg, 0, sizeof(msg));
 
 	// Set type, port.
 	msg.type = MSG_SET_SESSION;
-	msg.payload.set.port = port;
+	msg.payload.set.port = entry->ports[0];
+
+	// Attach the ports of all servers.
+	for (unsigned int i = 0; i < entry->nservers; i++) {
+		ports[i] = entry->ports[i];
+	}
+	msg.data = ports;
+	msg.size = entry->nservers * sizeof(unsigned int);
 
 	// Dispatch.
-	dsm_sendall(fd, &msg, sizeof(msg));
+	dsm_sendmsg(fd, &msg);
 }
 
 
@@ -105,7 +121,7 @@ static void msg_getSession (int fd, dsm_msg *mp) {
 		printf("[%d] No Session: \"%s\", creating!\n", getpid(), data.sid);
 		
 		// Verify entry could be created.
-		if ((entry = dsm_newTableEntry(data.sid, -1, data.nproc)) == NULL) {
+		if ((entry = dsm_newTableEntry(data.sid, nservers, data.nproc)) == NULL) {
 			dsm_cpanic("Couldn't create new entry!", "Limit reached?");
 		}
 
@@ -117,16 +133,19 @@ static void msg_getSession (int fd, dsm_msg *mp) {
 		// Get current connection details.
 		dsm_getSocketInfo(sock_listen, addr_buf, sizeof(addr_buf), NULL);
 
-		// Fork a session server.
-		if (fork() == 0) {
-			execServer(addr_buf, DSM_DEF_PORT, data.sid, data.nproc);
+		// Fork the session servers: One per page partition.
+		for (unsigned int i = 0; i < nservers; i++) {
+			if (fork() == 0) {
+				execServer(addr_buf, DSM_DEF_PORT, data.sid, data.nproc, i,
+					nservers);
+			}
 		}
 
 		return;
 	}
 
-	// If entry exists, but unset port. Then queue for notification.
-	if (entry->port == -1) {
+	// If entry exists, but servers yet to check in. Then queue for notification.
+	if (!dsm_isTableEntryReady(entry)) {
 		printf("[%d] Session but no port. Queueing!\n", getpid());
 
 		// Verify file-descriptor could be queued for notification.
@@ -139,7 +158,7 @@ static void msg_getSession (int fd, dsm_msg *mp) {
 
 	// Otherwise entry exists and has valid port.
 	printf("[%d] Session \"%s\" is available. Replying!\n", getpid(), data.sid);
-	send_getSessionReply(fd, entry->port);
+	send_getSessionReply(fd, entry);
 	dsm_removePollable(fd, pollableSet);
 	close(fd);	
 }
@@ -155,13 +174,21 @@ static void msg_setSession (int fd, dsm_msg *mp) {
 		dsm_cpanic("Bad table entry", "Unknown");
 	}
 
+	// Verify the partition.
+	if (data.part >= entry->nservers) {
+		dsm_cpanic("Bad server partition", "Unknown");
+	}
+
 	// Update the port.
-	entry->port = data.port;
+	entry->ports[data.part] = data.port;
+
+	printf("[%d] Received check-in from Session Server %u for \"%s\"\n", getpid(),
+		data.part, data.sid);
 
-	printf("[%d] Received check-in from Session Server for \"%s\"\n", getpid(), data.sid);
-	// Notify and close queued file-descriptors.
-	while (dsm_dequeueTableEntryFD(&waiting_fd, entry) == 0) {
-		send_getSessionReply(waiting_fd, entry->port);
+	// Notify and close queued file-descriptors once all servers are in.
+	while (dsm_isTableEntryReady(entry) &&
+		dsm_dequeueTableEntryFD(&waiting_fd, entry) == 0) {
+		send_getSessionReply(waiting_fd, entry);
 		dsm_removePollable(waiting_fd, pollableSet);
 		close(waiting_fd);
 	}
@@ -208,21 +235,24 @@ void msg_delSession (int fd, dsm_msg *mp) {
  *******************************************************************************
 */
 
-// Exec's to session server. Supplies address, port, and SID as input.
+// Exec's to session server. Supplies address, port, SID, and page partition
+// as input.
 static void execServer (const char *address, const char *port, const char *sid, 
-	int nproc) {
-	char *argv[5 + 1];						// Argument vector: 4 arg + NULL.
+	int nproc, unsigned int part, unsigned int nparts) {
+	char *argv[6 + 1];						// Argument vector: 5 arg + NULL.
 	char *filename = "server";				// Executable filename.
 	char buf_sid[5 + DSM_SID_SIZE + 1];		// -sid= + <sid> + \0.
 	char buf_addr[6 + INET6_ADDRSTRLEN];	// -addr= + <addr>.
 	char buf_port[6 + 6];					// -port= + <port> + \0.
 	char buf_nproc[7 + 10 + 1];				// -nproc= + <nproc> + \0.
+	char buf_part[6 + 10 + 1 + 10 + 1];		// -part= + <k> + / + <n> + \0.
 
 	// Configure argument buffers.
 	sprintf(buf_sid, "-sid=%s", sid);
 	sprintf(buf_addr, "-addr=%s", address);
 	sprintf(buf_port, "-port=%s", port);
 	sprintf(buf_nproc, "-nproc=%d", nproc);
+	sprintf(buf_part, "-part=%u/%u", part, nparts);
 
 	// Set program arguments.
 	argv[0] = filename;
@@ -230,7 +260,8 @@ static void execServer (const char *address, const char *port, const char *sid,
 	argv[2] = buf_port;
 	argv[3] = buf_sid;
 	argv[4] = buf_nproc;
-	argv[5] = NULL;
+	argv[5] = buf_part;
+	argv[6] = NULL;
 
 	// Exec the session server.
 	execve(filename, argv, NULL);
@@ -265,7 +296,7 @@ static void processMessage (int fd) {
 	printf("[%d] Receiving message...\n", getpid());
 
 	// Read in message.
-	if (dsm_recvall(fd, &msg, sizeof(msg)) != 0) {
+	if (dsm_recvmsg(fd, &msg) != 0) {
 		dsm_warning("Alien party closed connection: Closing socket!");
 		dsm_removePollable(fd, pollableSet);
 		close(fd);
@@ -297,6 +328,13 @@ int main (int argc, const char *argv[]) {
 	int new = 0;								// New count.
 	struct pollfd *pfd;							// Pointer to poll structure.
 
+	// Parse the number of servers per session, if given.
+	if (argc > 2 || (argc == 2 && (sscanf(argv[1], "-servers=%u", &nservers)
+		!= 1 || nservers == 0 || nservers > DSM_MAX_SERVERS))) {
+		dsm_panicf("Bad arguments. Format is: [-servers=<1-%d>]",
+			DSM_MAX_SERVERS);
+	}
+
 	// Initialize pollable set.
 	pollableSet = dsm_initPollSet(DSM_MIN_POLLABLE);
 
@@ -319,13 +357,14 @@ int main (int argc, const char *argv[]) {
 	// Register as a pollable socket.
 	dsm_setPollable(sock_listen, POLLIN, pollableSet);
 
-	printf("[%d] Server is ready...\n", getpid());
+	printf("[%d] Server is ready (%u server(s) per session)...\n", getpid(),
+		nservers);
 
 	// Poll as long as no error occurs.
-	while ((new = poll(pollableSet->fds, pollableSet->fp, -1)) != -1) {
+	while ((new = dsm_poll(pollableSet, -1)) != -1) {
 		
-		for (int i = 0; i < pollableSet->fp; i++) {
-			pfd = pollableSet->fds + i;
+		for (int i = 0; i < new; i++) {
+			pfd = pollableSet->ready + i;
 			
 			// If nothing to read, ignore file-descriptor.
 			if ((pfd->revents & POLLIN) == 0) {
@@ -0,0 +1,220 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <setjmp.h>
+#include <sys/socket.h>
+
+#include "dsm_arbiter.h"
+#include "dsm_types.h"
+#include "dsm_inet.h"
+#include "dsm_msg.h"
+#include "dsm_util.h"
+#include "dsm_signal.h"
+
+
+/*
+ *******************************************************************************
+ *                             Symbolic Constants                              *
+ *******************************************************************************
+*/
+
+
+// Default listener socket backlog.
+#define DSM_DEF_BACKLOG			32
+
+
+/*
+ *******************************************************************************
+ *                              Type Definitions                               *
+ *******************************************************************************
+*/
+
+
+// A session hosted by the service: The arguments of its arbiter.
+typedef struct dsm_hosted {
+	char sid[DSM_SID_SIZE + 1];			// Session identifier.
+	unsigned int nproc;					// Total number of expected processes.
+	dsm_servers servers;				// Servers of the session.
+} dsm_hosted;
+
+
+/*
+ *******************************************************************************
+ *                              Global Variables                               *
+ *******************************************************************************
+*/
+
+
+// The listener socket (unix domain, at DSM_HOST_PATH).
+int sock_host;
+
+
+/*
+ *******************************************************************************
+ *                            Forward Declarations                             *
+ *******************************************************************************
+*/
+
+
+// Runs the arbiter of a hosted session. Frees the session when done.
+static void *runSession (void *arg);
+
+// Reads a session request from connection s. Returns the session to host, or
+// NULL on a bad request.
+static dsm_hosted *recv_hostSession (int s);
+
+// Tells the process on connection s that its session is hosted.
+static void send_hostSession (int s, const char *sid);
+
+// Accepts a connection. Hosts the session it asks for on a new thread. A
+// failure drops the request: The process then forks its own arbiter.
+static void processConnection (int fd);
+
+
+/*
+ *******************************************************************************
+ *                            Function Definitions                             *
+ *******************************************************************************
+*/
+
+
+// Runs the arbiter of a hosted session. Frees the session when done.
+static void *runSession (void *arg) {
+	dsm_hosted *hp = (dsm_hosted *)arg;
+
+	printf("[%d] Hosting session \"%s\"!\n", getpid(), hp->sid); fflush(stdout);
+	if (arbiter(hp->sid, hp->nproc, &hp->servers) != 0) {
+		fprintf(stderr, "[%d] Session \"%s\" failed!\n", getpid(), hp->sid);
+	} else {
+		printf("[%d] Session \"%s\" ended!\n", getpid(), hp->sid);
+	}
+	fflush(stdout);
+
+	free(hp);
+	return NULL;
+}
+
+// Reads a session request from connection s. Returns the session to host, or
+// NULL on a bad request.
+static dsm_hosted *recv_hostSession (int s) {
+	dsm_hosted *hp;
+	dsm_msg msg;
+	size_t addr_size, ports_size;
+
+	// Receive message.
+	if (dsm_recvmsg(s, &msg) != 0 || msg.type != MSG_GET_SESSION) {
+		return NULL;
+	}
+
+	// Verify the server address string, and the ports after it.
+	addr_size = strnlen(msg.data, msg.size) + 1;
+	ports_size = msg.size - MIN(addr_size, msg.size);
+	if (addr_size > INET6_ADDRSTRLEN || addr_size > msg.size ||
+		ports_size == 0 || ports_size % sizeof(unsigned int) != 0 ||
+		ports_size > DSM_MAX_SERVERS * sizeof(unsigned int)) {
+		return NULL;
+	}
+
+	// Copy the arguments out of the receive buffer.
+	hp = dsm_zalloc(sizeof(dsm_hosted));
+	snprintf(hp->sid, DSM_SID_SIZE + 1, "%s", msg.payload.get.sid);
+	hp->nproc = msg.payload.get.nproc;
+	memcpy(hp->servers.addr, msg.data, addr_size);
+	memcpy(hp->servers.ports, msg.data + addr_size, ports_size);
+	hp->servers.n = ports_size / sizeof(unsigned int);
+
+	return hp;
+}
+
+// Tells the process on connection s that its session is hosted.
+static void send_hostSession (int s, const char *sid) {
+	dsm_msg msg;
+
+	// Configure message.
+	memset(&msg, 0, sizeof(msg));
+	msg.type = MSG_SET_SESSION;
+	snprintf(msg.payload.set.sid, DSM_SID_SIZE + 1, "%s", sid);
+
+	// Send message.
+	dsm_sendmsg(s, &msg);
+}
+
+// Accepts a connection. Hosts the session it asks for on a new thread.
+static void processConnection (int fd) {
+	dsm_hosted *volatile hp = NULL;
+	pthread_t thread;
+	pthread_attr_t attr;
+	jmp_buf fail;
+	int s;
+
+	// Accept the connection. (Failures, such as running out of descriptors,
+	// must not end the sessions already hosted).
+	if ((s = accept(fd, NULL, NULL)) == -1) {
+		dsm_warning("Couldn't accept connection!");
+		return;
+	}
+
+	// A failed exchange (the process hung up, or sent a bad frame) drops the
+	// request, like a bad request: The process forks its own arbiter.
+	if (setjmp(fail) != 0) {
+		dsm_setPanicJump(NULL);
+		free(hp);
+		hp = NULL;
+	} else {
+		dsm_setPanicJump(&fail);
+		if ((hp = recv_hostSession(s)) != NULL) {
+			send_hostSession(s, hp->sid);
+		}
+		dsm_setPanicJump(NULL);
+	}
+	close(s);
+	if (hp == NULL) {
+		fprintf(stderr, "[%d] Bad session request!\n", getpid());
+		return;
+	}
+
+	// Run the arbiter on a detached thread.
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	if ((errno = pthread_create(&thread, &attr, runSession, hp)) != 0) {
+		dsm_warning("Couldn't create session thread!");
+		free(hp);
+	}
+	pthread_attr_destroy(&attr);
+}
+
+
+/*
+ *******************************************************************************
+ *                                    Main                                     *
+ *******************************************************************************
+*/
+
+
+// Runs the host arbiter service: Hosts the arbiter of each session started
+// on this host, on its own thread, in this one process.
+int main (void) {
+
+	// A process may hang up before its reply is sent.
+	dsm_sigignore(SIGPIPE);
+
+	// Listen on the host socket.
+	sock_host = dsm_getBoundUnixSocket(DSM_HOST_PATH);
+	if (listen(sock_host, DSM_DEF_BACKLOG) == -1) {
+		dsm_panic("Couldn't listen on socket!");
+	}
+
+	printf("[%d] Host arbiter service is ready (%s)...\n", getpid(),
+		DSM_HOST_PATH); fflush(stdout);
+
+	// Host sessions until killed.
+	while (1) {
+		processConnection(sock_host);
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -43,8 +43,8 @@ static unsigned int DJBHash (const char *s, size_t length) {
 }
 
 // [ALLOC] Creates a new dsm_session instance. Returns pointer.
-static dsm_session *newTableEntry (const char *sid, int port, int nproc,
-	dsm_session *next) {
+static dsm_session *newTableEntry (const char *sid, unsigned int nservers,
+	int nproc, dsm_session *next) {
 	dsm_session *entry;
 
 	// Allocate the entry.
@@ -57,7 +57,10 @@ static dsm_session *newTableEntry (const char *sid, int port, int nproc,
 	memcpy(entry->sid, sid, DSM_SID_SIZE);
 	entry->sid[DSM_SID_SIZE] = '\0';
 	entry->qp = 0;
-	entry->port = port;
+	for (int i = 0; i < DSM_MAX_SERVERS; i++) {
+		entry->ports[i] = -1;
+	}
+	entry->nservers = nservers;
 	entry->nproc = nproc;
 	entry->next = next;
 
@@ -68,7 +71,11 @@ static dsm_session *newTableEntry (const char *sid, int port, int nproc,
 // [DEBUG] Prints a linked list of dsm_session objects to stdout.
 static void printList (dsm_session *p) {
 	while (p != NULL) {
-		printf("[\"%s\" | port: %d | nproc: %d | {", p->sid, p->port, p->nproc);
+		printf("[\"%s\" | ports: {", p->sid);
+		for (int i = 0; i < p->nservers; i++) {
+			printf("%d%s", p->ports[i], (i < (p->nservers - 1)) ? "," : "");
+		}
+		printf("} | nproc: %d | {", p->nproc);
 		for (int i = 0; i < p->qp; i++) {
 			printf("%d", p->queue[i]);
 			if (i < (p->qp - 1)) {
@@ -149,19 +156,30 @@ dsm_session *dsm_getTableEntry (const char *sid) {
 }
 
 // Creates table entry with session information. Returns NULL on error.
-dsm_session *dsm_newTableEntry (const char *sid, int port, int nproc) {
+dsm_session *dsm_newTableEntry (const char *sid, unsigned int nservers,
+	int nproc) {
 	unsigned int i;
 
 	// Compute index.
 	i = (DJBHash(sid, DSM_SID_SIZE) % DSM_TAB_SIZE);
 
 	// Set head of list to new entry.
-	table[i] = newTableEntry(sid, port, nproc, table[i]);
+	table[i] = newTableEntry(sid, nservers, nproc, table[i]);
 
 	// Return pointer to entry.
 	return table[i];
 }
 
+// Returns nonzero if all servers of the given session have checked in.
+int dsm_isTableEntryReady (dsm_session *sp) {
+	for (unsigned int i = 0; i < sp->nservers; i++) {
+		if (sp->ports[i] == -1) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
 // Removes the table entry for the given process SID. Returns nonzero on error.
 int dsm_removeTableEntry (const char *sid) {
 	unsigned int i;
@@ -13,6 +13,10 @@
 // Maximum number of file-descriptors that can be queued.
 #define DSM_MAX_SESSION_QUEUE					64
 
+// Maximum number of servers of a session. Each serves a partition of the
+// pages (see dsm_getPagePart).
+#define DSM_MAX_SERVERS							8
+
 
 /*
  *******************************************************************************
@@ -25,7 +29,8 @@ typedef struct dsm_session {
 	char sid[DSM_SID_SIZE + 1];			// Session identifier.
 	int queue[DSM_MAX_SESSION_QUEUE];	// Queue of waiting file-descriptors.
 	unsigned int qp;					// Queue pointer.
-	int port;							// Session port.
+	int ports[DSM_MAX_SERVERS];			// Server ports (-1 until checked in).
+	unsigned int nservers;				// Number of servers.
 	int nproc;							// Number of expected processes.
 	struct dsm_session *next;			// Linked session.
 } dsm_session;
@@ -45,7 +50,11 @@ void dsm_showTable (void);
 dsm_session *dsm_getTableEntry (const char *sid);
 
 // Creates table entry with session information. Returns NULL on error.
-dsm_session *dsm_newTableEntry (const char *sid, int port, int nproc);
+dsm_session *dsm_newTableEntry (const char *sid, unsigned int nservers,
+	int nproc);
+
+// Returns nonzero if all servers of the given session have checked in.
+int dsm_isTableEntryReady (dsm_session *sp);
 
 // Removes the table entry for the given process SID. Returns nonzero on error.
 int dsm_removeTableEntry (const char *sid);
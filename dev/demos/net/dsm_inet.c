@@ -4,9 +4,11 @@
 #include <unistd.h>
 #include <ctype.h>
 #include <errno.h>
+#include <fcntl.h>
 
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/un.h>
 #include <netinet/in.h>
 #include <netdb.h>
 #include <arpa/inet.h>
@@ -15,6 +17,7 @@
 
 #include "dsm_inet.h"
 #include "dsm_util.h"
+#include "dsm_stats.h"
 
 
 /*
@@ -95,8 +98,20 @@ int dsm_getBoundSocket (int flags, int family, int socktype, const char *port) {
 
 // Returns a socket connected to given address and port. Exits fatally on error.
 int dsm_getConnectedSocket (const char *addr, const char *port) {
+	int s;
+
+	if ((s = dsm_getSocketIfListening(addr, port)) == -1) {
+		dsm_panicf("Couldn't connect to %s on %s", addr, port);
+	}
+
+	return s;
+}
+
+// Returns a socket connected to given address and port, or -1 if nothing
+// listens there.
+int dsm_getSocketIfListening (const char *addr, const char *port) {
 	struct addrinfo hints, *res, *p;
-	int s, stat;
+	int s = -1, stat;
 
 	// Setup hints. 
 	memset(&hints, 0, sizeof(hints));
@@ -119,7 +134,9 @@ int dsm_getConnectedSocket (const char *addr, const char *port) {
 
 		// Try connecting to the socket.
 		if (connect(s, p->ai_addr, p->ai_addrlen) == -1) {
-			dsm_panicf("Couldn't connect to %s on %s", addr, port);
+			close(s);
+			s = -1;
+			continue;
 		}
 
 		break;
@@ -129,7 +146,118 @@ int dsm_getConnectedSocket (const char *addr, const char *port) {
 	freeaddrinfo(res);
 
 	// Return result.
-	return ((p == NULL) ? -1 : s);
+	return s;
+}
+
+// Sets the unix domain socket address of path. Exits fatally if too long.
+static void setUnixAddr (struct sockaddr_un *ap, const char *path) {
+	memset(ap, 0, sizeof(*ap));
+	ap->sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(ap->sun_path)) {
+		dsm_panicf("Socket path too long (%s)", path);
+	}
+	strcpy(ap->sun_path, path);
+}
+
+// Returns a unix domain socket bound to path. A stale socket file is replaced.
+// Exits fatally on error.
+int dsm_getBoundUnixSocket (const char *path) {
+	struct sockaddr_un addr;
+	int s;
+
+	setUnixAddr(&addr, path);
+
+	// Try initializing a socket.
+	if ((s = socket(AF_UNIX, SOCK_STREAM, 0)) == -1) {
+		dsm_panic("Couldn't create unix socket!");
+	}
+
+	// Remove a socket file left behind, then bind.
+	if (unlink(path) == -1 && errno != ENOENT) {
+		dsm_panicf("Couldn't remove stale socket (%s)", path);
+	}
+	if (bind(s, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+		dsm_panicf("Couldn't bind to path (%s)", path);
+	}
+
+	return s;
+}
+
+// Returns a unix domain socket connected to path. Exits fatally on error.
+int dsm_getConnectedUnixSocket (const char *path) {
+	int s;
+
+	if ((s = dsm_getUnixSocketIfListening(path)) == -1) {
+		dsm_panicf("Couldn't connect to %s", path);
+	}
+
+	return s;
+}
+
+// Returns a unix domain socket connected to path, or -1 if nothing listens
+// on it.
+int dsm_getUnixSocketIfListening (const char *path) {
+	struct sockaddr_un addr;
+	int s;
+
+	setUnixAddr(&addr, path);
+
+	// Try initializing a socket.
+	if ((s = socket(AF_UNIX, SOCK_STREAM, 0)) == -1) {
+		dsm_panic("Couldn't create unix socket!");
+	}
+
+	// Try connecting to the socket.
+	if (connect(s, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+		close(s);
+		return -1;
+	}
+
+	return s;
+}
+
+// Passes descriptor fd, with an integer tag, over unix domain socket s.
+// Exits fatally on error.
+void dsm_sendfd (int s, int fd, int tag) {
+	char cbuf[CMSG_SPACE(sizeof(int))];
+	struct iovec iov = {.iov_base = &tag, .iov_len = sizeof(tag)};
+	struct msghdr msg = {.msg_iov = &iov, .msg_iovlen = 1,
+		.msg_control = cbuf, .msg_controllen = sizeof(cbuf)};
+	struct cmsghdr *cp;
+
+	// Attach the descriptor as ancillary data.
+	memset(cbuf, 0, sizeof(cbuf));
+	cp = CMSG_FIRSTHDR(&msg);
+	cp->cmsg_level = SOL_SOCKET;
+	cp->cmsg_type = SCM_RIGHTS;
+	cp->cmsg_len = CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(cp), &fd, sizeof(int));
+
+	// The tag is too small to be sent in part.
+	if (sendmsg(s, &msg, MSG_NOSIGNAL) != sizeof(tag)) {
+		dsm_panic("Couldn't pass descriptor!");
+	}
+	dsm_counters.bytes_sent += sizeof(tag);
+}
+
+// Receives a descriptor, and its tag, passed over unix domain socket s.
+// Returns the descriptor. Exits fatally on error.
+int dsm_recvfd (int s, int *tag) {
+	char cbuf[CMSG_SPACE(sizeof(int))];
+	struct iovec iov = {.iov_base = tag, .iov_len = sizeof(*tag)};
+	struct msghdr msg = {.msg_iov = &iov, .msg_iovlen = 1,
+		.msg_control = cbuf, .msg_controllen = sizeof(cbuf)};
+	struct cmsghdr *cp;
+	int fd;
+
+	if (recvmsg(s, &msg, MSG_WAITALL) != sizeof(*tag) ||
+		(cp = CMSG_FIRSTHDR(&msg)) == NULL || cp->cmsg_type != SCM_RIGHTS) {
+		dsm_panic("Couldn't receive descriptor!");
+	}
+	dsm_counters.bytes_recv += sizeof(*tag);
+	memcpy(&fd, CMSG_DATA(cp), sizeof(int));
+
+	return fd;
 }
 
 // Gets socket address (use buffer length INET6_ADDRSTRLEN) and port.
@@ -184,6 +312,16 @@ void dsm_showSocketInfo (int s) {
 	printf("FD: %d, ADDR: \"%s\", PORT: %u\n", s, b, port);
 }
 
+// Puts fd in non-blocking mode. Exits fatally on error.
+void dsm_setNonBlocking (int fd) {
+	int flags;
+
+	if ((flags = fcntl(fd, F_GETFL)) == -1 || 
+		fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1) {
+		dsm_panicf("Couldn't make socket non-blocking (fd = %d)!", fd);
+	}
+}
+
 // Ensures 'size' data is sent to fd. Exits fatally on error.
 void dsm_sendall (int fd, void *b, size_t size) {
 	size_t sent = 0;
@@ -194,6 +332,8 @@ void dsm_sendall (int fd, void *b, size_t size) {
 			dsm_panic("Syscall error on send!");
 		}
 		sent += n;
+		dsm_counters.send_calls++;
+		dsm_counters.bytes_sent += n;
 	} while (sent < size);
 }
 
@@ -208,13 +348,39 @@ int dsm_recvall (int fd, void *b, size_t size) {
 			dsm_panic("Syscall error on recv!");
 		}
 		
+		dsm_counters.recv_calls++;
+
 		// Check if socket is closed.
 		if (n == 0) {
 			return -1;
 		}
 
 		received += n;
+		dsm_counters.bytes_recv += n;
 	} while (received < size);
 
 	return 0;
 }
+
+// Ensures all 'iovcnt' buffers are sent to fd in one go. The vector is
+// consumed. Exits fatally on error.
+void dsm_sendallv (int fd, struct iovec *iov, int iovcnt) {
+	ssize_t n;
+
+	while (iovcnt > 0) {
+		if ((n = writev(fd, iov, iovcnt)) == -1) {
+			dsm_panic("Syscall error on writev!");
+		}
+		dsm_counters.send_calls++;
+		dsm_counters.bytes_sent += n;
+
+		// Skip fully sent buffers, then advance into the partial one.
+		for (; iovcnt > 0 && (size_t)n >= iov->iov_len; iov++, iovcnt--) {
+			n -= iov->iov_len;
+		}
+		if (iovcnt > 0) {
+			iov->iov_base += n;
+			iov->iov_len -= n;
+		}
+	}
+}
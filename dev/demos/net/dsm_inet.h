@@ -4,6 +4,7 @@
 
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <netdb.h>
 
 
@@ -25,6 +26,29 @@ int dsm_getBoundSocket (int flags, int family, int socktype, const char *port);
 // Returns a socket connected to given address and port. Exits fatally on error.
 int dsm_getConnectedSocket (const char *addr, const char *port);
 
+// Returns a socket connected to given address and port, or -1 if nothing
+// listens there.
+int dsm_getSocketIfListening (const char *addr, const char *port);
+
+// Returns a unix domain socket bound to path. A stale socket file is replaced.
+// Exits fatally on error.
+int dsm_getBoundUnixSocket (const char *path);
+
+// Returns a unix domain socket connected to path. Exits fatally on error.
+int dsm_getConnectedUnixSocket (const char *path);
+
+// Returns a unix domain socket connected to path, or -1 if nothing listens
+// on it.
+int dsm_getUnixSocketIfListening (const char *path);
+
+// Passes descriptor fd, with an integer tag, over unix domain socket s.
+// Exits fatally on error.
+void dsm_sendfd (int s, int fd, int tag);
+
+// Receives a descriptor, and its tag, passed over unix domain socket s.
+// Returns the descriptor. Exits fatally on error.
+int dsm_recvfd (int s, int *tag);
+
 // Gets socket address (use buffer length INET6_ADDRSTRLEN) and port.
 void dsm_getSocketInfo (int s, char *addr_buf, size_t buf_size, 
 	unsigned int *port);
@@ -32,6 +56,9 @@ void dsm_getSocketInfo (int s, char *addr_buf, size_t buf_size,
 // [DEBUG] Outputs socket's address and port.
 void dsm_showSocketInfo (int s);
 
+// Puts fd in non-blocking mode. Exits fatally on error.
+void dsm_setNonBlocking (int fd);
+
 // Ensures 'size' data is sent to fd. Exits fatally on error.
 void dsm_sendall (int fd, void *b, size_t size);
 
@@ -39,5 +66,9 @@ void dsm_sendall (int fd, void *b, size_t size);
 // Returns zero if all is normal. Returns nonzero if connection is closed.
 int dsm_recvall (int fd, void *b, size_t size);
 
+// Ensures all 'iovcnt' buffers are sent to fd in one go. The vector is
+// consumed. Exits fatally on error.
+void dsm_sendallv (int fd, struct iovec *iov, int iovcnt);
+
 
 #endif
\ No newline at end of file
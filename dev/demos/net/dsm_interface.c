@@ -16,6 +16,7 @@
 #include "dsm_util.h"
 #include "dsm_signal.h"
 #include "dsm_sync.h"
+#include "dsm_ring.h"
 
 
 /*
@@ -37,6 +38,12 @@ static int gid = -1;
 // Socket for IPC to arbiter.
 int sock_arbiter = -1;
 
+// Ring pair to the arbiter (in the shared file). NULL if there is none.
+dsm_ring_pair *ring;
+
+// Eventfd waking the arbiter when it sleeps (passed by the arbiter).
+int ring_efd = -1;
+
 // [DEBUG] Temporary holder of STDOUT fd.
 int stdout_fd;
 
@@ -50,23 +57,47 @@ int stdout_fd;
 // Initializes a dsm_shm map at the given aligned-address. Returns pointer.
 static dsm_smap *initSharedMapAt (dsm_smap *addr, size_t size) {
 
-	// Initialize the semaphores.
-	if (sem_init(&(addr->sem_io), 1, 1) == -1 ||
-		sem_init(&(addr->sem_barrier), 1, 1) == -1) {
+	// Initialize the semaphore.
+	if (sem_init(&(addr->sem_io), 1, 1) == -1) {
 		dsm_panic("Couldn't initialize semaphores!");
 	}
 
+	// Barrier starts empty. The arbiter sets the participant count.
+	addr->barrier_count = addr->barrier_epoch = addr->barrier_nproc = 0;
+
+	// No process is parked.
+	addr->park_epoch = addr->nparked = 0;
+
 	// Extra-check: Size of dsm_shm doesn't exceed the size of one page.
 	if (sizeof(dsm_smap) > DSM_PAGESIZE) {
 		dsm_cpanic("dsm_smap", "sizeof(dsm_smap) exceeds pagesize!");
 	}
 
-	// Set the offset: Exactly one memory page from aligned address 'addr'.
-	addr->data_off = DSM_PAGESIZE;
+	// Lock tokens start out at the session server.
+	for (int i = 0; i < DSM_MAX_LOCKS; i++) {
+		addr->locks[i].word = LOCK_REMOTE;
+		addr->locks[i].recalled = 0;
+	}
+
+	// Page write tokens too.
+	for (int i = 0; i < DSM_SHM_NPAGES; i++) {
+		addr->writes[i] = WRITE_REMOTE;
+	}
+
+	// Extra-check: The process rings fit their pages.
+	if (DSM_MAX_RINGS * sizeof(dsm_ring_pair) > 
+		DSM_RING_NPAGES * DSM_PAGESIZE) {
+		dsm_cpanic("dsm_smap", "Process rings exceed their pages!");
+	}
+
+	// Set the offsets: The rings follow the header page. Usable memory
+	// follows the rings.
+	addr->ring_off = DSM_PAGESIZE;
+	addr->data_off = (1 + DSM_RING_NPAGES) * DSM_PAGESIZE;
 
-	// Set the size: Should be > one page.
-	if (size < DSM_PAGESIZE) {
-		dsm_cpanic("initSharedMapAt", "Shared map size must be >= pagesize!");
+	// Set the size: Should be > the header and ring pages.
+	if (size <= addr->data_off) {
+		dsm_cpanic("initSharedMapAt", "Shared map size must exceed the rings!");
 	} else {
 		addr->size = size;
 	}
@@ -121,9 +152,7 @@ static void *mapSharedFile (int fd, size_t size, int prot) {
 		dsm_panicf("Couldn't map shared file to memory (fd = %d)!", fd);
 	}
 
-	// Zero the memory.
-	memset(map, 0, size);
-
+	// (A freshly truncated file is zero-filled: Don't wipe the owner's map).
 	return map;
 }
 
@@ -172,7 +201,56 @@ static void send_addProc (void) {
 	msg.payload.proc.gid = -1;
 
 	// Send message.
-	dsm_sendall(sock_arbiter, &msg, sizeof(msg));
+	dsm_sendmsg(sock_arbiter, &msg);
+}
+
+// Receives the ring pair (if any) and the wake-up eventfd of the arbiter.
+static void recv_ring (void) {
+	int i;
+
+	ring_efd = dsm_recvfd(sock_arbiter, &i);
+	if (i >= DSM_MAX_RINGS) {
+		dsm_cpanic("recv_ring", "Bad ring!");
+	}
+	ring = (i < 0 ? NULL : 
+		(dsm_ring_pair *)((void *)smap + smap->ring_off) + i);
+}
+
+// Asks the host arbiter service on socket s to host session 'sid', whose
+// servers are sp.
+static void send_hostSession (int s, const char *sid, unsigned int nproc,
+	const dsm_servers *sp) {
+	size_t addr_size = strlen(sp->addr) + 1;
+	size_t ports_size = sp->n * sizeof(unsigned int);
+	char data[addr_size + ports_size];
+	dsm_msg msg;
+
+	// Configure message. The server address and ports follow.
+	memset(&msg, 0, sizeof(msg));
+	msg.type = MSG_GET_SESSION;
+	snprintf(msg.payload.get.sid, DSM_SID_SIZE + 1, "%s", sid);
+	msg.payload.get.nproc = nproc;
+	memcpy(data, sp->addr, addr_size);
+	memcpy(data + addr_size, sp->ports, ports_size);
+	msg.data = data;
+	msg.size = sizeof(data);
+
+	// Send message.
+	dsm_sendmsg(s, &msg);
+}
+
+// Reads the reply of the host arbiter service on socket s. Returns nonzero
+// if it doesn't host the session.
+static int recv_hostSession (int s) {
+	dsm_msg msg;
+
+	// Receive message.
+	if (dsm_recvmsg(s, &msg) != 0) {
+		return -1;
+	}
+
+	// Verify message.
+	return (msg.type != MSG_SET_SESSION);
 }
 
 // Reads a reply from the arbiter, and returns the message GID.
@@ -180,7 +258,7 @@ static int recv_gid (void) {
 	dsm_msg msg;
 
 	// Receive message.
-	if (dsm_recvall(sock_arbiter, &msg, sizeof(msg)) != 0) {
+	if (dsm_recvmsg(sock_arbiter, &msg) != 0) {
 		dsm_cpanic("recv_gid", "Lost connection to arbiter!");
 	}
 
@@ -198,7 +276,7 @@ static void recv_waitDone (void) {
 	dsm_msg msg;
 
 	// Receive message.
-	if (dsm_recvall(sock_arbiter, &msg, sizeof(msg)) != 0) {
+	if (dsm_recvmsg(sock_arbiter, &msg) != 0) {
 		dsm_cpanic("recv_waitDone", "Lost connection to arbiter!");
 	}
 
@@ -208,16 +286,94 @@ static void recv_waitDone (void) {
 	}
 }
 
-// Informs arbiter that process is waiting on a barrier.
-static void send_waitBarr (void) {
+// Informs arbiter that all 'nproc' local processes wait on a barrier.
+static void send_waitBarr (unsigned int nproc) {
 	dsm_msg msg;
 
 	// Configure message.
 	memset(&msg, 0, sizeof(msg));
 	msg.type = MSG_WAIT_BARR;
+	msg.payload.done.nproc = nproc;
 
 	// Send message.
-	dsm_sendall(sock_arbiter, &msg, sizeof(msg));
+	dsm_sendmsg(sock_arbiter, &msg);
+}
+
+// Sends a lock message of the given type to the arbiter.
+static void send_lockMsg (dsm_msg_t type, unsigned int id) {
+	dsm_msg msg;
+
+	// Configure message.
+	memset(&msg, 0, sizeof(msg));
+	msg.type = type;
+	msg.payload.lock.id = id;
+
+	// Send message.
+	dsm_sendmsg(sock_arbiter, &msg);
+}
+
+// Reads a lock grant from the arbiter. Returns nonzero if the lock is owned.
+static int recv_lockGrant (unsigned int id) {
+	dsm_msg msg;
+
+	// Receive message.
+	if (dsm_recvmsg(sock_arbiter, &msg) != 0) {
+		dsm_cpanic("recv_lockGrant", "Lost connection to arbiter!");
+	}
+
+	// Verify message.
+	if (msg.type != MSG_LOCK_GRANT || msg.payload.lock.id != id) {
+		dsm_cpanic("recv_lockGrant", "Bad message!");
+	}
+
+	return msg.payload.lock.flag;
+}
+
+// Sends an atomic operation request to the arbiter.
+static void send_atomicReq (int op, off_t offset, int value, int expected) {
+	dsm_msg msg;
+
+	// Configure message.
+	memset(&msg, 0, sizeof(msg));
+	msg.type = MSG_ATOMIC_REQ;
+	msg.payload.atomic.op = op;
+	msg.payload.atomic.offset = offset;
+	msg.payload.atomic.value = value;
+	msg.payload.atomic.expected = expected;
+
+	// Send message.
+	dsm_sendmsg(sock_arbiter, &msg);
+}
+
+// Reads an atomic operation result from the arbiter. Returns the old value.
+static int recv_atomicDone (void) {
+	dsm_msg msg;
+
+	// Receive message.
+	if (dsm_recvmsg(sock_arbiter, &msg) != 0) {
+		dsm_cpanic("recv_atomicDone", "Lost connection to arbiter!");
+	}
+
+	// Verify message.
+	if (msg.type != MSG_ATOMIC_DONE) {
+		dsm_cpanic("recv_atomicDone", "Bad message!");
+	}
+
+	return msg.payload.atomic.value;
+}
+
+// Asks the arbiter to wake up to 'n' waiters on the word on other hosts.
+static void send_notify (off_t offset, int n) {
+	dsm_msg msg;
+
+	// Configure message.
+	memset(&msg, 0, sizeof(msg));
+	msg.type = MSG_NOTIFY;
+	msg.payload.notify.offset = offset;
+	msg.payload.notify.n = n;
+
+	// Send message.
+	dsm_sendmsg(sock_arbiter, &msg);
 }
 
 // Sends an exit message to the arbiter.
@@ -230,7 +386,37 @@ static void send_prgmDone (void) {
 	msg.payload.done.nproc = 1;
 	
 	// Send message.
-	dsm_sendall(sock_arbiter, &msg, sizeof(msg));
+	dsm_sendmsg(sock_arbiter, &msg);
+}
+
+// Starts the arbiter of session 'sid': Hands the session to the host arbiter
+// service if one runs (saving a fork and its server connection setup).
+// Otherwise forks a private arbiter. The servers are found here: Only this
+// process may ask the user for them.
+static void startArbiter (const char *sid, unsigned int nproc, 
+	const char *addr, const char *port) {
+	dsm_servers servers;
+	int s;
+
+	// Find the servers of the session.
+	dsm_findServers(sid, nproc, addr, port, &servers);
+
+	// Try the host arbiter service.
+	if ((s = dsm_getUnixSocketIfListening(DSM_HOST_PATH)) != -1) {
+		send_hostSession(s, sid, nproc, &servers);
+		if (recv_hostSession(s) == 0) {
+			close(s);
+			return;
+		}
+		close(s);
+	}
+
+	// Fork a private arbiter.
+	if (fork() == 0) {
+		close(STDOUT_FILENO);
+		dup(stdout_fd);
+		exit(arbiter(sid, nproc, &servers) == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+	}
 }
 
 
@@ -252,42 +438,32 @@ void dsm_init (const char *sid, const char *addr, const char *port,
 	unsigned int nproc) {
 	int fd, first;
 	off_t size = 0;
+	char path[DSM_ARB_PATH_SIZE];
+	char name[DSM_SHM_NAME_SIZE];
 
 	// Verify state.
 	if (sock_arbiter != -1 || smap != NULL) {
 		dsm_cpanic("dsm_init", "Initializer called twice without destructor!");
 	}
 
-	// Create or open the init-semaphore.
-	sem_start = getSem(DSM_SEM_INIT_NAME, 0);
+	// Create or open the init-semaphore (named by session).
+	snprintf(name, DSM_SHM_NAME_SIZE, DSM_SEM_INIT_FMT, DSM_SID_SIZE, sid);
+	sem_start = getSem(name, 0);
 
 	printf("[%d] sem_start created!\n", getpid()); fflush(stdout);
 
-	// Create or open the shared file.
-	fd = getSharedFile(DSM_SHM_FILE_NAME, &first);
+	// Create or open the shared file (named by session).
+	snprintf(name, DSM_SHM_NAME_SIZE, DSM_SHM_FILE_FMT, DSM_SID_SIZE, sid);
+	fd = getSharedFile(name, &first);
 
 	printf("[%d] shared file created!\n", getpid()); fflush(stdout);
 
-	// Set or get file size.
+	// If first: Size and map the file, setup dsm_smap. Then start arbiter.
 	if (first) {
 		size = setSharedFileSize(fd, DSM_SHM_FILE_SIZE);
-	} else {
-		size = getSharedFileSize(fd);
-	}
-
-	// Map shared file to memory.
-	smap = (dsm_smap *)mapSharedFile(fd, size, PROT_READ|PROT_WRITE);
-
-	printf("[%d] memory map created!\n", getpid()); fflush(stdout);
-
-	// If first: Setup dsm_smap and protect shared page. Then fork arbiter.
-	if (first) {
+		smap = (dsm_smap *)mapSharedFile(fd, size, PROT_READ|PROT_WRITE);
 		initSharedMapAt(smap, size);
-		if (fork() == 0) {
-			close(STDOUT_FILENO);
-			dup(stdout_fd);
-			arbiter(sid, nproc, addr, port);
-		}
+		startArbiter(sid, nproc, addr, port);
 	}
 
 	printf("[%d] Waiting...\n", getpid()); fflush(stdout);
@@ -295,13 +471,24 @@ void dsm_init (const char *sid, const char *addr, const char *port,
 	// Wait on initialization-semaphore for release by arbiter.
 	dsm_down(sem_start);
 
-	// Connect to arbiter.
-	sock_arbiter = dsm_getConnectedSocket(DSM_LOOPBACK_ADDR, 
-		DSM_DEF_ARB_PORT);
+	// Otherwise: Map the file only once the owner has sized and setup it.
+	if (!first) {
+		size = getSharedFileSize(fd);
+		smap = (dsm_smap *)mapSharedFile(fd, size, PROT_READ|PROT_WRITE);
+	}
+
+	printf("[%d] memory map created!\n", getpid()); fflush(stdout);
+
+	// Connect to arbiter: Over its local socket, named by session.
+	snprintf(path, DSM_ARB_PATH_SIZE, DSM_ARB_PATH_FMT, DSM_SID_SIZE, sid);
+	sock_arbiter = dsm_getConnectedUnixSocket(path);
 	
 	// Send registration-message. 
 	send_addProc();
 
+	// Receive the ring pair: Writes are requested and granted over it.
+	recv_ring();
+
 	// Read global identifier.
 	gid = recv_gid();
 
@@ -313,12 +500,10 @@ void dsm_init (const char *sid, const char *addr, const char *port,
 	// Install the signal handlers.
 	dsm_sigaction(SIGSEGV, dsm_sync_sigsegv);
 	dsm_sigaction(SIGILL, dsm_sync_sigill);
-	//dsm_sigaction(SIGCONT, dsm_sync_sigcont);
-	//dsm_sigaction(SIGTSTP, dsm_sync_sigtstp);
 
-	// Protect the shared page.
+	// Protect the shared pages: Copies are fetched on first access.
 	void *page = (void *)smap + smap->data_off;
-	dsm_mprotect(page, DSM_PAGESIZE, PROT_READ);
+	dsm_mprotect(page, smap->size - smap->data_off, PROT_NONE);
 
 	// Block until start message is received.
 	recv_waitDone();
@@ -332,15 +517,171 @@ int dsm_getgid (void) {
 	return gid;
 }
 
-/* Suspends process until all registered processes reach the barrier. */
+/* Suspends process until all registered processes reach the barrier. Only
+ * the last local arrival messages the arbiter.
+*/
 void dsm_barrier (void) {
-	send_waitBarr();
-	if (kill(getpid(), SIGTSTP) == -1) {
-		dsm_panic("Couldn't suspend process!");
+	int epoch = __atomic_load_n(&smap->barrier_epoch, __ATOMIC_SEQ_CST);
+	int nproc = __atomic_load_n(&smap->barrier_nproc, __ATOMIC_SEQ_CST);
+	int park;
+
+	// Last local arrival: Reset the count and inform the arbiter.
+	if (__atomic_add_fetch(&smap->barrier_count, 1, __ATOMIC_SEQ_CST) >= nproc) {
+		__atomic_store_n(&smap->barrier_count, 0, __ATOMIC_SEQ_CST);
+		send_waitBarr(nproc);
+	}
+
+	// Park until the arbiter bumps the epoch.
+	while (1) {
+		park = __atomic_load_n(&smap->park_epoch, __ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&smap->barrier_epoch, __ATOMIC_SEQ_CST) != epoch) {
+			break;
+		}
+		dsm_park(smap, park);
+	}
+}
+
+/* Acquires distributed lock 'id'. While the host caches the lock token and
+ * no remote arbiter waits for it, the lock is taken through the futex word
+ * in the map header without any messages.
+*/
+void dsm_lock (unsigned int id) {
+	dsm_lock_t *lp;
+	int c, waited = 0;
+
+	// Verify state.
+	if (smap == NULL || id >= DSM_MAX_LOCKS) {
+		dsm_cpanic("dsm_lock", "Bad lock or no initialization!");
+	}
+	lp = smap->locks + id;
+
+	for (;;) {
+		c = __atomic_load_n(&lp->word, __ATOMIC_SEQ_CST);
+
+		// Token absent or recalled: Have the arbiter fetch it.
+		if (c == LOCK_REMOTE || __atomic_load_n(&lp->recalled, __ATOMIC_SEQ_CST)) {
+			send_lockMsg(MSG_LOCK_REQ, id);
+			if (recv_lockGrant(id)) {
+				return;
+			}
+			continue;
+		}
+
+		// Fast path: Take the free lock (contended if we slept before).
+		if (c == LOCK_FREE) {
+			if (__atomic_compare_exchange_n(&lp->word, &c, (waited ?
+				LOCK_CONTENDED : LOCK_HELD), 0, __ATOMIC_SEQ_CST,
+				__ATOMIC_SEQ_CST)) {
+				return;
+			}
+			continue;
+		}
+
+		// Held locally: Mark contended, then sleep until released.
+		if (c == LOCK_HELD && !__atomic_compare_exchange_n(&lp->word, &c,
+			LOCK_CONTENDED, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+			continue;
+		}
+		dsm_futexWait(&lp->word, LOCK_CONTENDED);
+		waited = 1;
+	}
+}
+
+/* Releases distributed lock 'id'. Messages the arbiter only if a remote
+ * arbiter has recalled the token.
+*/
+void dsm_unlock (unsigned int id) {
+	dsm_lock_t *lp;
+
+	// Verify state.
+	if (smap == NULL || id >= DSM_MAX_LOCKS) {
+		dsm_cpanic("dsm_unlock", "Bad lock or no initialization!");
+	}
+	lp = smap->locks + id;
+
+	// Release the word: Wake one local waiter if there are any.
+	if (__atomic_exchange_n(&lp->word, LOCK_FREE, __ATOMIC_SEQ_CST) ==
+		LOCK_CONTENDED) {
+		dsm_futexWake(&lp->word, 1);
+	}
+
+	// Let the arbiter return a recalled token.
+	if (__atomic_load_n(&lp->recalled, __ATOMIC_SEQ_CST)) {
+		send_lockMsg(MSG_LOCK_REL, id);
+	}
+}
+
+// Executes atomic operation on the shared word at 'offset'. Returns old value.
+static int atomicOp (int op, off_t offset, int value, int expected) {
+
+	// Verify state, bounds and alignment.
+	if (smap == NULL || offset < 0 || offset % sizeof(int) != 0 ||
+		offset + sizeof(int) > smap->size - smap->data_off) {
+		dsm_cpanic("atomicOp", "Bad shared word or no initialization!");
+	}
+
+	send_atomicReq(op, offset, value, expected);
+	return recv_atomicDone();
+}
+
+/* Atomically adds 'value' to the shared int at 'offset'. Returns old value. */
+int dsm_fetch_add (off_t offset, int value) {
+	return atomicOp(ATOMIC_FETCH_ADD, offset, value, 0);
+}
+
+/* Atomically sets the shared int at 'offset' to 'desired' if it equals
+ * 'expected'. Returns the old value (the swap happened if it is 'expected').
+*/
+int dsm_cas (off_t offset, int expected, int desired) {
+	return atomicOp(ATOMIC_CAS, offset, desired, expected);
+}
+
+/* Atomically sets the shared int at 'offset' to 'value'. Returns old value. */
+int dsm_exchange (off_t offset, int value) {
+	return atomicOp(ATOMIC_EXCHANGE, offset, value, 0);
+}
+
+// Returns pointer to the int-aligned shared word at 'offset'. Panics if bad.
+static int *getSharedWord (const char *caller, off_t offset) {
+	if (smap == NULL || offset < 0 || offset % sizeof(int) != 0 ||
+		offset + sizeof(int) > smap->size - smap->data_off) {
+		dsm_cpanic(caller, "Bad shared word or no initialization!");
 	}
+	return (int *)((void *)smap + smap->data_off + offset);
 }
 
-/* Returns pointer to shared page. Returns NULL on error. */
+/* Sleeps while the shared int at 'offset' equals 'expected'. Returns once an
+ * update to the word, or a dsm_notify, is applied on this host. Callers
+ * should recheck the word: Wake-ups may be spurious.
+*/
+void dsm_wait (off_t offset, int expected) {
+	int *word = getSharedWord("dsm_wait", offset);
+
+	// Touch the word first: A fault here fetches the page copy.
+	if (*(volatile int *)word != expected) {
+		return;
+	}
+
+	// Register as waiter on the word, then sleep on it.
+	dsm_addWaiter(smap, offset);
+	if (__atomic_load_n(word, __ATOMIC_SEQ_CST) == expected) {
+		dsm_futexWait(word, expected);
+	}
+	dsm_removeWaiter(smap, offset);
+}
+
+/* Wakes up to 'n' processes (per host) in dsm_wait on the shared int at
+ * 'offset'. Updates to the word wake its waiters without this call.
+*/
+void dsm_notify (off_t offset, int n) {
+	int *word = getSharedWord("dsm_notify", offset);
+
+	// Wake local waiters, then those on other hosts holding the page.
+	dsm_futexWake(word, n);
+	send_notify(offset, n);
+}
+
+/* Returns pointer to first shared page. Returns NULL on error. */
 void *dsm_getSharedPage (void) {
 
 	// Verify state.
@@ -352,6 +693,36 @@ void *dsm_getSharedPage (void) {
 	return ((void *)smap + smap->data_off);
 }
 
+/* Copies 'size' bytes at 'offset' in the shared region to 'dst'. Never
+ * returns a torn copy: The read is retried if an update overlapped it.
+*/
+void dsm_read (void *dst, off_t offset, size_t size) {
+	void *data = (void *)smap + smap->data_off;
+	unsigned int *seq;
+	size_t n;
+
+	// Verify state and bounds.
+	if (smap == NULL || offset < 0 || offset + size > smap->size - smap->data_off) {
+		dsm_cpanic("dsm_read", "Read outside of shared region!");
+	}
+
+	// Copy page by page: Each page has its own sequence counter.
+	for (; size > 0; offset += n, dst += n, size -= n) {
+		n = MIN(size, DSM_PAGESIZE - offset % DSM_PAGESIZE);
+		seq = smap->seq + offset / DSM_PAGESIZE;
+
+		// Touch the page first: A fault here fetches the copy.
+		*(volatile char *)(data + offset);
+
+		// Retry while an update of the page overlaps the copy.
+		unsigned int start;
+		do {
+			start = dsm_seqReadBegin(seq);
+			memcpy(dst, data + offset, n);
+		} while (dsm_seqReadRetry(seq, start));
+	}
+}
+
 /* Disconnects from the arbiter; unmaps shared object. */
 void dsm_exit (void) {
 
@@ -369,6 +740,11 @@ void dsm_exit (void) {
 	// Reset the socket.
 	sock_arbiter = -1;
 
+	// Release the ring pair (the arbiter frees it).
+	close(ring_efd);
+	ring_efd = -1;
+	ring = NULL;
+
 	// Unmap the shared file.
 	//if (munmap((void *)smap, smap->size) == -1) {
 	//	dsm_panic("Couldn't unmap shared file!");
@@ -404,7 +780,9 @@ int main (void) {
 
 	for (int i = 0; i < 5; i++) {
 
-		while (*turn != whoami);
+		while (*turn != whoami) {
+			dsm_wait(0, 1 - whoami);
+		}
 		if (whoami == 0) {
 			printf("Ping ...\n"); fflush(stdout);
 		} else {
@@ -1,6 +1,11 @@
 #if !defined (DSM_INTERFACE_H)
 #define DSM_INTERFACE_H
 
+#include <sys/types.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
 
 /*
  *******************************************************************************
@@ -25,11 +30,61 @@ int dsm_getgid (void);
 /* Suspends process until all registered processes reach the barrier. */
 void dsm_barrier (void);
 
-/* Returns pointer to shared page. Returns NULL on error. */
+/* Acquires distributed lock 'id' (0 .. DSM_MAX_LOCKS-1). Re-acquisition on
+ * a host that caches the lock token costs no messages.
+*/
+void dsm_lock (unsigned int id);
+
+/* Releases distributed lock 'id'. */
+void dsm_unlock (unsigned int id);
+
+/* Atomic operations on the int-aligned shared int at 'offset'. Executed by
+ * the session server without trapping or shipping the page. All return the
+ * old value. dsm_cas only stores 'desired' if the old value is 'expected'.
+*/
+int dsm_fetch_add (off_t offset, int value);
+int dsm_cas (off_t offset, int expected, int desired);
+int dsm_exchange (off_t offset, int value);
+
+/* Sleeps while the shared int at 'offset' equals 'expected'. Returns once an
+ * update to the word, or a dsm_notify, is applied on this host. Callers
+ * should recheck the word: Wake-ups may be spurious.
+*/
+void dsm_wait (off_t offset, int expected);
+
+/* Wakes up to 'n' processes (per host) in dsm_wait on the shared int at
+ * 'offset'. Updates to the word wake its waiters without this call.
+*/
+void dsm_notify (off_t offset, int n);
+
+/* Returns pointer to first shared page. Returns NULL on error.
+ * The shared region spans DSM_SHM_NPAGES contiguous pages from this address.
+*/
 void *dsm_getSharedPage (void);
 
+/* Copies 'size' bytes at 'offset' in the shared region to 'dst'. Never
+ * returns a torn copy: The read is retried if an update overlapped it.
+*/
+void dsm_read (void *dst, off_t offset, size_t size);
+
 /* Disconnects from the arbiter; unmaps shared object. */
 void dsm_exit (void);
 
 
+#if defined(__cplusplus)
+}
+
+namespace dsm {
+
+/* Returns the value of type T at 'offset' in the shared region. */
+template <typename T>
+T read (off_t offset) {
+	T value;
+	dsm_read(&value, offset, sizeof(T));
+	return value;
+}
+
+}
+#endif
+
 #endif
\ No newline at end of file
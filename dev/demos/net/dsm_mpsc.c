@@ -0,0 +1,71 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "dsm_mpsc.h"
+
+
+/*
+ *******************************************************************************
+ *                            Function Definitions                             *
+ *******************************************************************************
+*/
+
+
+// Initializes queue q to empty.
+void dsm_initMpsc (dsm_mpsc *q) {
+	q->stub.next = NULL;
+	q->head = q->tail = &q->stub;
+}
+
+// Puts node n at the head of queue q. (Any thread).
+void dsm_mpscPut (dsm_mpsc *q, dsm_mpsc_node *n) {
+	dsm_mpsc_node *prev;
+
+	// Claim the head, then link the previous head to n. Until linked, the
+	// consumer stops short of n.
+	n->next = NULL;
+	prev = __atomic_exchange_n(&q->head, n, __ATOMIC_SEQ_CST);
+	__atomic_store_n(&prev->next, n, __ATOMIC_SEQ_CST);
+}
+
+// Takes the node at the tail of queue q. Returns NULL if q is empty, or if
+// its next node is still being put. (Consumer only).
+dsm_mpsc_node *dsm_mpscGet (dsm_mpsc *q) {
+	dsm_mpsc_node *tail = q->tail;
+	dsm_mpsc_node *next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+
+	// Skip the stub.
+	if (tail == &q->stub) {
+		if (next == NULL) {
+			return NULL;
+		}
+		q->tail = tail = next;
+		next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+	}
+
+	// The tail has a successor: Take it.
+	if (next != NULL) {
+		q->tail = next;
+		return tail;
+	}
+
+	// The tail is the last node put, unless a put is midway.
+	if (tail != __atomic_load_n(&q->head, __ATOMIC_ACQUIRE)) {
+		return NULL;
+	}
+
+	// Put the stub behind it, so the tail can be taken.
+	dsm_mpscPut(q, &q->stub);
+	if ((next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE)) != NULL) {
+		q->tail = next;
+		return tail;
+	}
+
+	return NULL;
+}
+
+// Returns nonzero if queue q has no node put. (Consumer only).
+int dsm_isMpscEmpty (dsm_mpsc *q) {
+	return q->tail == &q->stub &&
+		__atomic_load_n(&q->stub.next, __ATOMIC_SEQ_CST) == NULL;
+}
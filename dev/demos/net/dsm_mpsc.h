@@ -0,0 +1,49 @@
+#if !defined(DSM_MPSC_H)
+#define DSM_MPSC_H
+
+
+/*
+ *******************************************************************************
+ *                              Type Definitions                               *
+ *******************************************************************************
+*/
+
+
+// Link of an item in a queue. Embedded as the first member of the item.
+typedef struct dsm_mpsc_node {
+	struct dsm_mpsc_node *next;
+} dsm_mpsc_node;
+
+// Lock-free multi-producer single-consumer queue (intrusive, unbounded).
+// Producers swap themselves in at the head, the consumer takes from the
+// tail. A stub node keeps the queue from ever being empty of nodes, so it
+// mustn't move once initialized.
+typedef struct dsm_mpsc {
+	dsm_mpsc_node *head;	// Last node put (by any producer).
+	dsm_mpsc_node *tail;	// Next node to take (by the consumer).
+	dsm_mpsc_node stub;		// Placeholder node.
+} dsm_mpsc;
+
+
+/*
+ *******************************************************************************
+ *                            Function Declarations                            *
+ *******************************************************************************
+*/
+
+
+// Initializes queue q to empty.
+void dsm_initMpsc (dsm_mpsc *q);
+
+// Puts node n at the head of queue q. (Any thread).
+void dsm_mpscPut (dsm_mpsc *q, dsm_mpsc_node *n);
+
+// Takes the node at the tail of queue q. Returns NULL if q is empty, or if
+// its next node is still being put. (Consumer only).
+dsm_mpsc_node *dsm_mpscGet (dsm_mpsc *q);
+
+// Returns nonzero if queue q has no node put. (Consumer only).
+int dsm_isMpscEmpty (dsm_mpsc *q);
+
+
+#endif
@@ -1,6 +1,331 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <arpa/inet.h>
+#include <sys/sendfile.h>
 #include "dsm_msg.h"
+#include "dsm_inet.h"
+#include "dsm_util.h"
+#include "dsm_stats.h"
+#include "dsm_codec.h"
+
+
+/*
+ *******************************************************************************
+ *                              Global Variables                               *
+ *******************************************************************************
+*/
+
+
+// [Thread-local: A host arbiter service runs each session on a thread].
+
+// Sequence number of the next message sent.
+static __thread uint16_t seq_next;
+
+// [NON-REENTRANT] Receive buffer for variable message data.
+static __thread void *recv_buf;
+
+// Size of the receive buffer.
+static __thread size_t recv_buf_size;
+
+// Buffered connections. Indexed by file-descriptor.
+static __thread dsm_msg_conn *conns;
+
+// Length of the connection table.
+static __thread int conns_length;
+
+// Connections with queued output. Only these are visited by dsm_flushmsgs.
+static __thread int *active_fds;
+
+// Length and capacity of the active connection list.
+static __thread int active_length, active_size;
+
+// Function told of poll event changes. May be NULL.
+static __thread dsm_msg_events_func events_func;
+
+// [NON-REENTRANT] Buffers for coding and decoding message data.
+static __thread void *code_buf, *decode_buf;
+
+// Sizes of the coding and decoding buffers.
+static __thread size_t code_buf_size, decode_buf_size;
+
+
+/*
+ *******************************************************************************
+ *                        Internal Function Definitions                        *
+ *******************************************************************************
+*/
+
+
+// Returns the size of the payload member carried by message 'type'.
+static size_t getPayloadSize (dsm_msg_t type) {
+	switch (type) {
+		case MSG_GET_SESSION:
+			return sizeof(dsm_msg_get);
+		case MSG_SET_SESSION:
+			return sizeof(dsm_msg_set);
+		case MSG_DEL_SESSION:
+			return sizeof(dsm_msg_del);
+		case MSG_SYNC_REQ:
+		case MSG_SYNC_INFO:
+		case MSG_SYNC_PUSH:
+		case MSG_WRITE_OKAY:
+		case MSG_WRITE_RECALL:
+		case MSG_WRITE_REL:
+			return sizeof(dsm_msg_sync);
+		case MSG_CONT_ALL:
+		case MSG_SYNC_DONE:
+		case MSG_WAIT_BARR:
+		case MSG_PRGM_DONE:
+			return sizeof(dsm_msg_done);
+		case MSG_SET_GID:
+		case MSG_ADD_PROC:
+		case MSG_DEL_PROC:
+			return sizeof(dsm_msg_proc);
+		case MSG_PAGE_REQ:
+		case MSG_PAGE_DATA:
+			return sizeof(dsm_msg_page);
+		case MSG_LOCK_REQ:
+		case MSG_LOCK_GRANT:
+		case MSG_LOCK_REL:
+		case MSG_LOCK_RECALL:
+			return sizeof(dsm_msg_lock);
+		case MSG_ATOMIC_REQ:
+		case MSG_ATOMIC_DONE:
+			return sizeof(dsm_msg_atomic);
+		case MSG_NOTIFY:
+			return sizeof(dsm_msg_notify);
+		case MSG_ADD_PEER:
+		case MSG_SET_PEER:
+			return sizeof(dsm_msg_peer);
+		default:
+			return 0;
+	}
+}
+
+// Returns the buffered connection of fd. Grows the table as needed.
+static dsm_msg_conn *getConnection (int fd) {
+	dsm_msg_conn *new_conns;
+	int new_length;
+
+	// Verify file-descriptor.
+	if (fd < 0) {
+		dsm_cpanic("getConnection", "Bad file-descriptor!");
+	}
+
+	// Grow the table to include fd.
+	if (fd >= conns_length) {
+		new_length = MAX(fd + 1, 2 * conns_length);
+		new_conns = dsm_zalloc(new_length * sizeof(dsm_msg_conn));
+		memcpy(new_conns, conns, conns_length * sizeof(dsm_msg_conn));
+		free(conns);
+		conns = new_conns;
+		conns_length = new_length;
+	}
+
+	return conns + fd;
+}
+
+// Lists fd for flushing, if not already listed.
+static void activateConnection (int fd) {
+	dsm_msg_conn *c = conns + fd;
+
+	if (c->active) {
+		return;
+	}
+	if (active_length >= active_size) {
+		active_size = MAX(8, 2 * active_size);
+		if ((active_fds = realloc(active_fds, active_size * sizeof(int)))
+			== NULL) {
+			dsm_cpanic("activateConnection", "realloc failed");
+		}
+	}
+	active_fds[active_length++] = fd;
+	c->active = active_length;
+}
+
+// Unlists the connection at index i of the active list.
+static void deactivateConnection (int i) {
+	conns[active_fds[i]].active = 0;
+	if (i < --active_length) {
+		active_fds[i] = active_fds[active_length];
+		conns[active_fds[i]].active = i + 1;
+	}
+}
+
+// Tells the events function if the poll events of fd changed.
+static void updateEvents (int fd) {
+	dsm_msg_conn *c = conns + fd;
+	short events = dsm_getMsgEvents(fd);
+
+	// Connections start out polled for input only.
+	if (events != (c->events == 0 ? POLLIN : c->events)) {
+		if (events_func != NULL) {
+			events_func(fd, events);
+		}
+	}
+	c->events = events;
+}
+
+// Ensures room for 'n' more bytes in the buffer. Moves pending bytes to the
+// front first: Invalidates pointers into the buffer.
+static void reserveBuffer (dsm_msg_buf *b, size_t n) {
+
+	// Move pending bytes to the front.
+	if (b->head > 0) {
+		memmove(b->buf, b->buf + b->head, b->length - b->head);
+		dsm_counters.bytes_copied += b->length - b->head;
+		b->length -= b->head;
+		b->head = 0;
+	}
+
+	// Grow if needed.
+	if (b->length + n > b->size) {
+		b->size = MAX(b->length + n, 2 * b->size);
+		if ((b->buf = realloc(b->buf, b->size)) == NULL) {
+			dsm_cpanic("reserveBuffer", "Allocation error!");
+		}
+	}
+}
+
+// Appends the header and payload of a frame with 'size' data bytes (coded
+// with codec) to the output of fd. Returns the buffer, for the data.
+static dsm_msg_buf *appendFrame (int fd, dsm_msg *mp, size_t size,
+	dsm_codec codec) {
+	size_t psize = getPayloadSize(mp->type);
+	dsm_msg_conn *c = getConnection(fd);
+	dsm_msg_buf *b = &c->out;
+	dsm_msg_hdr hdr;
+
+	// Make room for the frame.
+	reserveBuffer(b, sizeof(hdr) + psize + size);
+
+	// Configure header.
+	hdr.type = mp->type;
+	hdr.flags = codec;
+	hdr.seq = htons(seq_next++);
+	hdr.length = htonl(psize + size);
+
+	// Append header and payload.
+	memcpy(b->buf + b->length, &hdr, sizeof(hdr));
+	memcpy(b->buf + b->length + sizeof(hdr), &mp->payload, psize);
+	b->length += sizeof(hdr) + psize;
+	c->tail += sizeof(hdr) + psize;
+	dsm_counters.bytes_copied += sizeof(hdr) + psize;
+	dsm_counters.msg_sent++;
+
+	// List for flushing.
+	activateConnection(fd);
+
+	return b;
+}
+
+// Returns a buffer of at least n bytes, grown as needed.
+static void *getBuffer (void **b, size_t *size, size_t n) {
+	if (n > *size) {
+		free(*b);
+		*b = dsm_zalloc(*size = n);
+	}
+	return *b;
+}
+
+// Decodes the data of a received frame with header flags 'codec' (if
+// coded). Decoded data is valid until the next decoded message.
+static void decodeData (dsm_msg *mp, dsm_codec codec) {
+	size_t n;
+
+	if (codec == DSM_CODEC_RAW) {
+		return;
+	}
+	if (mp->size == 0 || (n = dsm_getRawSize(codec, mp->data, mp->size)) == 0 ||
+		n > DSM_MSG_MAX_DATA || dsm_decompress(codec, mp->data, mp->size, 
+		getBuffer(&decode_buf, &decode_buf_size, n)) != 0) {
+		dsm_cpanic("decodeData", "Bad coded message data!");
+	}
+	mp->data = decode_buf;
+	mp->size = n;
+	dsm_counters.bytes_copied += n;
+}
+
+// Returns nonzero if the data of messages of 'type' is worth coding.
+static int isCodedType (dsm_msg_t type) {
+	return (DSM_MSG_COMPRESS && (type == MSG_SYNC_INFO || 
+		type == MSG_SYNC_PUSH || type == MSG_PAGE_DATA));
+}
+
+// Discards the queued output of a connection whose peer has gone. The close
+// is left to the reader to see.
+static void discardOutput (dsm_msg_conn *c) {
+	c->out.head = c->out.length = c->tail = 0;
+	c->files_head = c->files_length = 0;
+	c->file_bytes = 0;
+}
+
+// Sends the queued bytes of fd preceding its next file range (or all, if
+// none), then the file ranges that follow. Stops once the socket is full.
+static void sendConnection (int fd) {
+	dsm_msg_conn *c = conns + fd;
+	dsm_msg_buf *b = &c->out;
+	dsm_msg_file *f;
+	size_t size;
+	ssize_t n;
+
+	while (b->length > b->head || c->files_head < c->files_length) {
+		f = (c->files_head < c->files_length ? c->files + c->files_head : NULL);
+
+		// Send queued bytes: Up to the next file range (more follows).
+		if ((size = (f == NULL ? b->length - b->head : f->skip)) > 0) {
+			n = send(fd, b->buf + b->head, size, 
+				MSG_DONTWAIT|MSG_NOSIGNAL|(f == NULL ? 0 : MSG_MORE));
+			dsm_counters.send_calls++;
+			if (n == -1) {
+				if (errno == EAGAIN || errno == EWOULDBLOCK) {
+					return;
+				}
+				if (errno == EPIPE || errno == ECONNRESET) {
+					discardOutput(c);
+					return;
+				}
+				dsm_panic("Syscall error on send!");
+			}
+			dsm_counters.bytes_sent += n;
+			b->head += n;
+			if (f != NULL) {
+				f->skip -= n;
+			}
+			if (n < size) {
+				return;
+			}
+			continue;
+		}
+
+		// Send file range: The kernel copies from the page cache.
+		n = sendfile(fd, f->fd, &f->offset, f->size);
+		dsm_counters.send_calls++;
+		if (n == -1) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				return;
+			}
+			if (errno == EPIPE || errno == ECONNRESET) {
+				discardOutput(c);
+				return;
+			}
+			dsm_panic("Syscall error on sendfile!");
+		}
+		dsm_counters.bytes_sent += n;
+		dsm_counters.bytes_zerocopy += n;
+		c->file_bytes -= n;
+		if ((f->size -= n) > 0) {
+			return;
+		}
+		if (++c->files_head == c->files_length) {
+			c->files_head = c->files_length = 0;
+		}
+	}
+}
+
 
 /*
  *******************************************************************************
@@ -61,12 +386,9 @@ void dsm_showMsg(dsm_msg *mp) {
 			printf("GID: %d\n", mp->payload.proc.gid);
 			break;
 		}
-		case MSG_STOP_ALL: {
-			printf("TYPE: MSG_STOP_ALL\n");
-			break;
-		}
 		case MSG_CONT_ALL: {
 			printf("TYPE: MSG_CONT_ALL\n");
+			printf("SEQ: %u\n", mp->payload.done.seq);
 			break;
 		}
 		case MSG_WAIT_DONE: {
@@ -75,26 +397,39 @@ void dsm_showMsg(dsm_msg *mp) {
 		}
 		case MSG_WRITE_OKAY: {
 			printf("TYPE: MSG_WRITE_OKAY\n");
+			printf("OFFSET: %ld\n", mp->payload.sync.offset);
+			printf("SEQ: %u (PREV: %u)\n", mp->payload.sync.seq,
+				mp->payload.sync.prev);
+			printf("TOKEN: %d\n", mp->payload.sync.token);
+			break;
+		}
+		case MSG_WRITE_RECALL:
+		case MSG_WRITE_REL: {
+			printf("TYPE: MSG_WRITE_%s\n", (mp->type == MSG_WRITE_RECALL ?
+				"RECALL" : "REL"));
+			printf("OFFSET: %ld\n", mp->payload.sync.offset);
+			printf("SEQ: %u\n", mp->payload.sync.seq);
 			break;
 		}
 		case MSG_SYNC_REQ: {
 			printf("TYPE: MSG_SYNC_REQ\n");
+			printf("OFFSET: %ld\n", mp->payload.sync.offset);
 			break;
 		}
-		case MSG_SYNC_INFO: {
-			printf("TYPE: MSG_SYNC_INFO\n");
+		case MSG_SYNC_INFO:
+		case MSG_SYNC_PUSH: {
+			printf("TYPE: MSG_SYNC_%s\n", (mp->type == MSG_SYNC_INFO ? "INFO" :
+				"PUSH"));
 			printf("OFFSET: %ld\n", mp->payload.sync.offset);
 			printf("SIZE: %zu\n", mp->payload.sync.size);
-			break;
-		}
-		case MSG_STOP_DONE: {
-			printf("TYPE: MSG_STOP_DONE\n");
-			printf("NPROC: %u\n", mp->payload.done.nproc);
+			printf("SEQ: %u (PREV: %u)\n", mp->payload.sync.seq,
+				mp->payload.sync.prev);
 			break;
 		}
 		case MSG_SYNC_DONE: {
 			printf("TYPE: MSG_SYNC_DONE\n");
 			printf("NPROC: %u\n", mp->payload.done.nproc);
+			printf("SEQ: %u\n", mp->payload.done.seq);
 			break;
 		}
 		case MSG_WAIT_BARR: {
@@ -110,9 +445,468 @@ void dsm_showMsg(dsm_msg *mp) {
 			printf("PID: %d\n", mp->payload.proc.pid);
 			break;
 		}
+		case MSG_DEL_PROC: {
+			printf("TYPE: MSG_DEL_PROC\n");
+			printf("GID: %d\n", mp->payload.proc.gid);
+			break;
+		}
+		case MSG_PAGE_REQ: {
+			printf("TYPE: MSG_PAGE_REQ\n");
+			printf("GID: %d\n", mp->payload.page.gid);
+			printf("OFFSET: %ld\n", mp->payload.page.offset);
+			break;
+		}
+		case MSG_PAGE_DATA: {
+			printf("TYPE: MSG_PAGE_DATA\n");
+			printf("GID: %d\n", mp->payload.page.gid);
+			printf("OFFSET: %ld\n", mp->payload.page.offset);
+			printf("SIZE: %zu\n", mp->payload.page.size);
+			printf("SEQ: %u\n", mp->payload.page.seq);
+			break;
+		}
+		case MSG_LOCK_REQ:
+		case MSG_LOCK_GRANT:
+		case MSG_LOCK_REL:
+		case MSG_LOCK_RECALL: {
+			printf("TYPE: MSG_LOCK_%s\n", (mp->type == MSG_LOCK_REQ ? "REQ" :
+				(mp->type == MSG_LOCK_GRANT ? "GRANT" :
+				(mp->type == MSG_LOCK_REL ? "REL" : "RECALL"))));
+			printf("ID: %u\n", mp->payload.lock.id);
+			printf("FLAG: %d\n", mp->payload.lock.flag);
+			break;
+		}
+		case MSG_ATOMIC_REQ:
+		case MSG_ATOMIC_DONE: {
+			printf("TYPE: MSG_ATOMIC_%s\n", (mp->type == MSG_ATOMIC_REQ ?
+				"REQ" : "DONE"));
+			printf("GID: %d\n", mp->payload.atomic.gid);
+			printf("OP: %d\n", mp->payload.atomic.op);
+			printf("OFFSET: %ld\n", mp->payload.atomic.offset);
+			printf("VALUE: %d\n", mp->payload.atomic.value);
+			printf("EXPECTED: %d\n", mp->payload.atomic.expected);
+			break;
+		}
+		case MSG_NOTIFY: {
+			printf("TYPE: MSG_NOTIFY\n");
+			printf("OFFSET: %ld\n", mp->payload.notify.offset);
+			printf("N: %d\n", mp->payload.notify.n);
+			break;
+		}
+		case MSG_ADD_PEER:
+		case MSG_SET_PEER: {
+			printf("TYPE: MSG_%s_PEER\n", (mp->type == MSG_ADD_PEER ? "ADD" :
+				"SET"));
+			printf("ID: %d\n", mp->payload.peer.id);
+			printf("LINK: %d\n", mp->payload.peer.link);
+			printf("ADDR: \"%s\"\n", mp->payload.peer.addr);
+			printf("PORT: %u\n", mp->payload.peer.port);
+			break;
+		}
 		default:
 			printf("TYPE: UNKNOWN\n");
 			break;
 	}
 	printf("###############################\n");
 }
+
+// Sends message as a frame: Header, payload and variable data (if any).
+// Exits fatally on error.
+void dsm_sendmsg (int fd, dsm_msg *mp) {
+	size_t psize = getPayloadSize(mp->type);
+	dsm_msg_hdr hdr;
+	struct iovec iov[3];
+
+	// Verify the variable data.
+	if (mp->size > DSM_MSG_MAX_DATA || (mp->size > 0 && mp->data == NULL)) {
+		dsm_cpanic("dsm_sendmsg", "Bad message data!");
+	}
+
+	// Configure header.
+	hdr.type = mp->type;
+	hdr.flags = 0;
+	hdr.seq = htons(seq_next++);
+	hdr.length = htonl(psize + mp->size);
+
+	// Send header, payload and data together.
+	iov[0] = (struct iovec){.iov_base = &hdr, .iov_len = sizeof(hdr)};
+	iov[1] = (struct iovec){.iov_base = &mp->payload, .iov_len = psize};
+	iov[2] = (struct iovec){.iov_base = mp->data, .iov_len = mp->size};
+	dsm_sendallv(fd, iov, 3);
+	dsm_counters.msg_sent++;
+}
+
+// [NON-REENTRANT] Receives a message frame from fd. Variable data is placed
+// in a static buffer, valid until the next call. Exits fatally on error.
+// Returns zero if all is normal. Returns nonzero if connection is closed.
+int dsm_recvmsg (int fd, dsm_msg *mp) {
+	size_t psize, length;
+	dsm_msg_hdr hdr;
+
+	// Receive header.
+	if (dsm_recvall(fd, &hdr, sizeof(hdr)) != 0) {
+		return -1;
+	}
+
+	// Verify header.
+	length = ntohl(hdr.length);
+	if (hdr.type <= MSG_MIN_VALUE || hdr.type >= MSG_MAX_VALUE ||
+		length < (psize = getPayloadSize(hdr.type)) ||
+		length - psize > DSM_MSG_MAX_DATA) {
+		dsm_cpanic("dsm_recvmsg", "Bad message frame!");
+	}
+
+	// Receive payload.
+	dsm_counters.msg_recv++;
+	memset(mp, 0, sizeof(*mp));
+	mp->type = hdr.type;
+	mp->seq = ntohs(hdr.seq);
+	if (psize > 0 && dsm_recvall(fd, &mp->payload, psize) != 0) {
+		return -1;
+	}
+
+	// Receive variable data (if any). Grow buffer as needed.
+	if ((mp->size = length - psize) == 0) {
+		return 0;
+	}
+	if (mp->size > recv_buf_size) {
+		free(recv_buf);
+		recv_buf = dsm_zalloc(recv_buf_size = mp->size);
+	}
+	mp->data = recv_buf;
+	if (dsm_recvall(fd, mp->data, mp->size) != 0) {
+		return -1;
+	}
+
+	// Decode data (if coded).
+	decodeData(mp, hdr.flags);
+	return 0;
+}
+
+// Queues message as a frame in the output buffer of fd. The payload and
+// data are copied (sync and page data coded, if that saves space). Sent by
+// dsm_flushmsgs.
+void dsm_queuemsg (int fd, dsm_msg *mp) {
+	dsm_msg_buf *b;
+
+	// Verify the variable data.
+	if (mp->size > DSM_MSG_MAX_DATA || (mp->size > 0 && mp->data == NULL)) {
+		dsm_cpanic("dsm_queuemsg", "Bad message data!");
+	}
+
+	// Queue coded if that saves space.
+	if (isCodedType(mp->type) && dsm_queuecompressed(fd, mp)) {
+		return;
+	}
+
+	// Append header and payload, then data.
+	b = appendFrame(fd, mp, mp->size, DSM_CODEC_RAW);
+	if (mp->size > 0) {
+		memcpy(b->buf + b->length, mp->data, mp->size);
+		b->length += mp->size;
+		conns[fd].tail += mp->size;
+		dsm_counters.bytes_copied += mp->size;
+	}
+}
+
+// Queues message as a frame with coded data, if coding saves space (see
+// dsm_compress). Returns nonzero if queued.
+int dsm_queuecompressed (int fd, dsm_msg *mp) {
+	dsm_codec codec;
+	dsm_msg_buf *b;
+	size_t size;
+
+	// Code the data.
+	getBuffer(&code_buf, &code_buf_size, DSM_CODEC_BOUND(mp->size));
+	codec = dsm_compress(mp->data, mp->size, code_buf, &size);
+	dsm_counters.bytes_raw += mp->size;
+	dsm_counters.bytes_coded += (codec == DSM_CODEC_RAW ? mp->size : size);
+	if (codec == DSM_CODEC_RAW) {
+		return 0;
+	}
+
+	// Append header and payload, then coded data.
+	b = appendFrame(fd, mp, size, codec);
+	memcpy(b->buf + b->length, code_buf, size);
+	b->length += size;
+	conns[fd].tail += size;
+	dsm_counters.bytes_copied += size;
+
+	return 1;
+}
+
+// Queues message as a frame whose data is 'size' bytes of file 'file_fd' at
+// 'offset'. The data is not copied: dsm_flushmsgs sends it with sendfile, so
+// it must not change until sent.
+void dsm_queuefile (int fd, dsm_msg *mp, int file_fd, off_t offset, 
+	size_t size) {
+	dsm_msg_conn *c;
+
+	// Verify the variable data.
+	if (size > DSM_MSG_MAX_DATA) {
+		dsm_cpanic("dsm_queuefile", "Bad message data!");
+	}
+
+	// Append header and payload.
+	appendFrame(fd, mp, size, DSM_CODEC_RAW);
+	c = conns + fd;
+
+	// Append file range: Sent after the bytes queued since the last range.
+	if (c->files_length >= c->files_size) {
+		c->files_size = MAX(4, 2 * c->files_size);
+		if ((c->files = realloc(c->files, c->files_size * 
+			sizeof(dsm_msg_file))) == NULL) {
+			dsm_cpanic("dsm_queuefile", "realloc failed");
+		}
+	}
+	c->files[c->files_length++] = (dsm_msg_file) {
+		.skip = c->tail,
+		.fd = file_fd,
+		.offset = offset,
+		.size = size
+	};
+	c->file_bytes += size;
+	c->tail = 0;
+}
+
+// Sends as much queued output as each connection accepts without blocking.
+// One send per connection with queued output (plus one per file range).
+// Connections whose poll events (see dsm_getMsgEvents) change are passed to
+// the events function.
+void dsm_flushmsgs (void) {
+	dsm_msg_conn *c;
+	int fd;
+
+	for (int i = 0; i < active_length; i++) {
+		fd = active_fds[i];
+		c = conns + fd;
+
+		// Send: A full socket buffer leaves the remainder queued.
+		sendConnection(fd);
+
+		// Reset buffer once all is sent.
+		if (c->out.head == c->out.length) {
+			c->out.head = c->out.length = c->tail = 0;
+		}
+
+		// Report changed events. Unlist once all is sent.
+		updateEvents(fd);
+		if (dsm_pendingmsgs(fd) == 0) {
+			deactivateConnection(i--);
+		}
+	}
+}
+
+// Sets the function told of poll event changes by dsm_flushmsgs.
+void dsm_setMsgEventsFunc (dsm_msg_events_func func) {
+	events_func = func;
+}
+
+// Blocks until all output queued for fd is sent.
+void dsm_drainmsgs (int fd) {
+	struct pollfd pfd = {.fd = fd, .events = POLLOUT};
+
+	while (dsm_pendingmsgs(fd) > 0) {
+		if (poll(&pfd, 1, -1) == -1) {
+			dsm_panic("Couldn't poll connection!");
+		}
+		dsm_flushmsgs();
+	}
+}
+
+// Blocks until the other end of fd hangs up. Input received meanwhile is
+// discarded: Closing with unread input resets the connection, which may 
+// lose output the other end has yet to read.
+void dsm_discardmsgs (int fd) {
+	struct pollfd pfd = {.fd = fd, .events = POLLIN};
+	char buf[256];
+	ssize_t n;
+
+	do {
+		if (poll(&pfd, 1, -1) == -1 && errno != EINTR) {
+			dsm_panic("Couldn't poll connection!");
+		}
+		n = recv(fd, buf, sizeof(buf), MSG_DONTWAIT);
+	} while (n > 0 || (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK ||
+		errno == EINTR)));
+}
+
+// Returns the number of bytes queued for sending on fd.
+size_t dsm_pendingmsgs (int fd) {
+	if (fd < 0 || fd >= conns_length) {
+		return 0;
+	}
+	return conns[fd].out.length - conns[fd].out.head + conns[fd].file_bytes;
+}
+
+// Returns the poll events for fd: POLLIN unless its queued output exceeds
+// DSM_MSG_MAX_QUEUED (backpressure), and POLLOUT while output is queued.
+short dsm_getMsgEvents (int fd) {
+	size_t pending = dsm_pendingmsgs(fd);
+	return (pending > DSM_MSG_MAX_QUEUED ? 0 : POLLIN) | 
+		(pending > 0 ? POLLOUT : 0);
+}
+
+// Receives what is available on fd without blocking, for use with
+// dsm_nextmsg. Returns zero if all is normal. Returns nonzero if connection
+// is closed.
+int dsm_fillmsgs (int fd) {
+	dsm_msg_buf *b = &getConnection(fd)->in;
+	ssize_t n;
+
+	// Make room: Frames may span several receives.
+	reserveBuffer(b, DSM_MSG_RECV_SIZE);
+
+	// Receive once: Remaining input keeps the connection readable.
+	n = recv(fd, b->buf + b->length, b->size - b->length, MSG_DONTWAIT);
+	dsm_counters.recv_calls++;
+	if (n == -1) {
+		if (errno == EAGAIN || errno == EWOULDBLOCK) {
+			return 0;
+		}
+		if (errno != ECONNRESET) {
+			dsm_panic("Syscall error on recv!");
+		}
+	}
+
+	// Check if socket is closed (or reset).
+	if (n <= 0) {
+		return -1;
+	}
+
+	b->length += n;
+	dsm_counters.bytes_recv += n;
+	return 0;
+}
+
+// Decodes the next complete message received on fd. Variable data points
+// into the receive buffer, valid until the next dsm_fillmsgs on fd. Returns
+// nonzero if a message was decoded. Exits fatally on a bad frame.
+int dsm_nextmsg (int fd, dsm_msg *mp) {
+	dsm_msg_buf *b;
+	size_t psize, length;
+	dsm_msg_hdr hdr;
+
+	// No buffered input.
+	if (fd < 0 || fd >= conns_length) {
+		return 0;
+	}
+	b = &conns[fd].in;
+
+	// Need a complete header.
+	if (b->length - b->head < sizeof(hdr)) {
+		return 0;
+	}
+	memcpy(&hdr, b->buf + b->head, sizeof(hdr));
+
+	// Verify header.
+	length = ntohl(hdr.length);
+	if (hdr.type <= MSG_MIN_VALUE || hdr.type >= MSG_MAX_VALUE ||
+		length < (psize = getPayloadSize(hdr.type)) ||
+		length - psize > DSM_MSG_MAX_DATA) {
+		dsm_cpanic("dsm_nextmsg", "Bad message frame!");
+	}
+
+	// Need the complete frame.
+	if (b->length - b->head < sizeof(hdr) + length) {
+		return 0;
+	}
+
+	// Decode payload and data.
+	memset(mp, 0, sizeof(*mp));
+	mp->type = hdr.type;
+	mp->seq = ntohs(hdr.seq);
+	memcpy(&mp->payload, b->buf + b->head + sizeof(hdr), psize);
+	if ((mp->size = length - psize) > 0) {
+		mp->data = b->buf + b->head + sizeof(hdr) + psize;
+	}
+	decodeData(mp, hdr.flags);
+	dsm_counters.msg_recv++;
+
+	// Consume frame. Buffer memory stays in place until the next fill.
+	if ((b->head += sizeof(hdr) + length) == b->length) {
+		b->head = b->length = 0;
+	}
+
+	return 1;
+}
+
+// Appends n received bytes to the input of fd, for use with dsm_nextmsg.
+void dsm_putmsgs (int fd, const void *b, size_t n) {
+	dsm_msg_buf *in = &getConnection(fd)->in;
+
+	reserveBuffer(in, n);
+	memcpy(in->buf + in->length, b, n);
+	in->length += n;
+	dsm_counters.bytes_recv += n;
+	dsm_counters.bytes_copied += n;
+}
+
+// Returns the file-descriptors with queued output. Valid until the next
+// queue, flush or take.
+int dsm_activemsgs (const int **fds) {
+	*fds = active_fds;
+	return active_length;
+}
+
+// Swaps the queued output of fd with the empty buffer b, so the caller may
+// send it. The storage of b is reused for later output. Returns the number
+// of bytes taken. Output with file ranges can't be taken.
+size_t dsm_takemsgs (int fd, dsm_msg_buf *b) {
+	dsm_msg_conn *c;
+	dsm_msg_buf t;
+
+	// Verify the buffer is empty, and that fd has no file ranges.
+	if (b->length != b->head) {
+		dsm_cpanic("dsm_takemsgs", "Buffer not empty!");
+	}
+	if (fd < conns_length && conns[fd].file_bytes > 0) {
+		dsm_cpanic("dsm_takemsgs", "Can't take file ranges!");
+	}
+	if (dsm_pendingmsgs(fd) == 0) {
+		return 0;
+	}
+
+	// Swap buffers, and unlist fd.
+	c = conns + fd;
+	t = c->out;
+	c->out = (dsm_msg_buf){.buf = b->buf, .size = b->size};
+	c->tail = 0;
+	*b = t;
+	deactivateConnection(c->active - 1);
+
+	return b->length - b->head;
+}
+
+// Discards buffered input and output of fd. Call before closing it.
+void dsm_dropmsgs (int fd) {
+	if (fd >= 0 && fd < conns_length) {
+		if (conns[fd].active) {
+			deactivateConnection(conns[fd].active - 1);
+		}
+		free(conns[fd].in.buf);
+		free(conns[fd].out.buf);
+		free(conns[fd].files);
+		memset(conns + fd, 0, sizeof(dsm_msg_conn));
+	}
+}
+
+// Frees all connection buffers and message buffers of the calling thread.
+void dsm_freemsgs (void) {
+
+	// Free the connections.
+	for (int fd = 0; fd < conns_length; fd++) {
+		dsm_dropmsgs(fd);
+	}
+	free(conns);
+	free(active_fds);
+	conns = NULL;
+	active_fds = NULL;
+	conns_length = active_length = active_size = 0;
+
+	// Free the receive and coding buffers.
+	free(recv_buf);
+	free(code_buf);
+	free(decode_buf);
+	recv_buf = code_buf = decode_buf = NULL;
+	recv_buf_size = code_buf_size = decode_buf_size = 0;
+}
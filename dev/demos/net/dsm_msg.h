@@ -2,8 +2,33 @@
 #define DSM_MSG_H
 
 #include <sys/types.h>
+#include <stdint.h>
+#include <netinet/in.h>
 
 #include "dsm_htab.h"
+#include "dsm_types.h"
+
+
+/*
+ *******************************************************************************
+ *                             Symbolic Constants                              *
+ *******************************************************************************
+*/
+
+
+// Largest variable data accepted after a message payload.
+#define DSM_MSG_MAX_DATA		(1 << 20)
+
+// Queued output above which a connection is no longer read (backpressure).
+#define DSM_MSG_MAX_QUEUED		(4 << 20)
+
+// Minimum free space for each non-blocking receive.
+#define DSM_MSG_RECV_SIZE		(64 << 10)
+
+// Code sync and page data when that saves space (build with 0 to disable).
+#if !defined(DSM_MSG_COMPRESS)
+#define DSM_MSG_COMPRESS		1
+#endif
 
 
 /*
@@ -13,26 +38,42 @@
 */
 
 
-// TYPE: All message types. (A = arbiter, S = server, D = daemon, P = process).
+// TYPE: All message types. (A = arbiter, S = server, D = daemon, P = process,
+// H = host arbiter service).
 typedef enum {
 	MSG_MIN_VALUE = 0,
 
 	MSG_GET_SESSION,					// [A->D] Request for session info.
+										// [P->H] Host session (addr, port).
 	MSG_SET_SESSION,					// [S->D] Update as session owner.
+										// [H->P] Session is hosted.
 	MSG_DEL_SESSION,					// [S->D] Request session deletion.
 
 	MSG_SET_GID,						// [S->A] Arbiter must set process gid.
-	MSG_STOP_ALL,						// [S->A] Arbiter must suspend proc's.
-	MSG_CONT_ALL,						// [S->A] Arbiter may resume proc's.
-	MSG_WAIT_DONE,						// [S->A] Arbiter can release barrier.
-	MSG_WRITE_OKAY,						// [S->A] Arbiter may write.
+	MSG_SET_PEER,						// [S->A] Address of a peer arbiter.
+	MSG_CONT_ALL,						// [S->A->P] Writer may resume.
+	MSG_WAIT_DONE,						// [S->A->A] Arbiter can release barrier.
+	MSG_WRITE_OKAY,						// [S->A] Arbiter may write (peers follow).
+	MSG_LOCK_RECALL,					// [S->A] Arbiter must return token.
+	MSG_WRITE_RECALL,					// [S->A] Arbiter must return write token.
 
 	MSG_ADD_PROC,						// [P->A->S] Register new process.
+	MSG_PAGE_REQ,						// [P->A->S] Request copy of a page.
+	MSG_PAGE_DATA,						// [S->A->P] Page copy (data follows).
+	MSG_LOCK_REQ,						// [P->A->S] Request for lock token.
+	MSG_LOCK_GRANT,						// [S->A->P] Grants lock token.
+	MSG_LOCK_REL,						// [P->A->S] Releases lock token.
+	MSG_ATOMIC_REQ,						// [P->A->S] Atomic op on shared word.
+	MSG_ATOMIC_DONE,					// [S->A->P] Atomic op old value.
+	MSG_NOTIFY,							// [P->A->S->A] Wake word waiters.
 	MSG_SYNC_REQ,						// [P->A->S] Request for write perms.
 	MSG_SYNC_INFO,						// [P->A->S] Sends sync info.
-	MSG_STOP_DONE,						// [A->S] Confirms all proc's paused.
-	MSG_SYNC_DONE,						// [A->S] Confirms received all data.
-	MSG_WAIT_BARR,						// [A->S] Arbiter is waiting on barrier.
+	MSG_SYNC_PUSH,						// [A->A] Pushes sync info to a peer.
+	MSG_SYNC_DONE,						// [A->A->S] Confirms received all data.
+	MSG_WAIT_BARR,						// [A->A->S] Arbiter is waiting on barrier.
+	MSG_DEL_PROC,						// [A->S] Process has exited.
+	MSG_WRITE_REL,						// [A->S] Returns unused write token.
+	MSG_ADD_PEER,						// [A->S] Register peer listener address.
 	MSG_PRGM_DONE,						// [A->S] Arbiter is exiting.
 
 	MSG_MAX_VALUE
@@ -40,16 +81,19 @@ typedef enum {
 
 // [Not all message types require additional data. See those that do below].
 
-// MSG_GET_SESSION: Initialization message payload.
+// MSG_GET_SESSION: Initialization message payload. [P->H] The daemon address
+// and port follow as two strings.
 typedef struct dsm_msg_get {
 	char sid[DSM_SID_SIZE + 1];			// Session identifier.
 	int nproc;							// Number of expected processes.
 } dsm_msg_get;
 
-// MSG_SET_SESSION: Setup message payload.
+// MSG_SET_SESSION: Setup message payload. [D->A] The ports of all servers of
+// the session follow (in partition order).
 typedef struct dsm_msg_set {
 	char sid[DSM_SID_SIZE + 1];			// Session identifier.
 	unsigned int port;					// Port.
+	unsigned int part;					// [S->D] Page partition of server.
 } dsm_msg_set;
 
 // MSG_DEL_SESSION: Delete session payload.
@@ -57,24 +101,82 @@ typedef struct dsm_msg_del {
 	char sid[DSM_SID_SIZE + 1];			// Session identifier.
 } dsm_msg_del;
 
-// MSG_SYNC_INFO: Sychronization message payload.
+// MSG_SYNC_INFO + MSG_SYNC_PUSH + MSG_SYNC_REQ + MSG_WRITE_OKAY + 
+// MSG_WRITE_RECALL + MSG_WRITE_REL: Sychronization message payload.
 typedef struct dsm_msg_sync {
 	off_t offset;						// Data offset.
-	size_t size;						// Data size.
-	char buf[4];						// Byte buffer [TEMP].
+	size_t size;						// Data size (data follows).
+	unsigned int seq;					// Update sequence number.
+	unsigned int prev;					// Previous update of the page (or 0).
+	int token;							// [S->A] Granted ahead of a request.
+										// [A->P] Take the page's word instead.
 } dsm_msg_sync;
 
-// MSG_SYNC_DONE + MSG_STOP_DONE: Data receival ack and stop ack.
+// MSG_SYNC_DONE + MSG_CONT_ALL: Data receival ack.
 typedef struct dsm_msg_done {
 	unsigned int nproc;
+	unsigned int seq;					// Update acknowledged (or 0).
 } dsm_msg_done;
 
-// MSG_ADD_PROC + MSG_SET_GID: Send process information.
+// MSG_PAGE_REQ + MSG_PAGE_DATA: Page copy request and reply.
+typedef struct dsm_msg_page {
+	int gid;							// Global process ID of requester.
+	off_t offset;						// Page offset.
+	size_t size;						// Size of data following message.
+	unsigned int seq;					// [S->A] Last update in the copy.
+} dsm_msg_page;
+
+// MSG_LOCK_*: Lock message payload.
+typedef struct dsm_msg_lock {
+	unsigned int id;					// Lock identifier.
+	int flag;							// [S->A] Recalled. [A->P] Owned.
+} dsm_msg_lock;
+
+// Atomic operations on shared words (executed at the server).
+typedef enum dsm_atomicOp {
+	ATOMIC_FETCH_ADD = 0,				// word += value.
+	ATOMIC_CAS,							// word = value if word == expected.
+	ATOMIC_EXCHANGE						// word = value.
+} dsm_atomicOp;
+
+// MSG_ATOMIC_REQ + MSG_ATOMIC_DONE: Atomic operation and its result.
+typedef struct dsm_msg_atomic {
+	int gid;							// Global process ID of requester.
+	int op;								// Operation (dsm_atomicOp).
+	off_t offset;						// Word offset.
+	int value;							// Operand. [S->A->P] Old value.
+	int expected;						// Expected value (ATOMIC_CAS).
+} dsm_msg_atomic;
+
+// MSG_NOTIFY: Wake-up of processes waiting on a shared word.
+typedef struct dsm_msg_notify {
+	off_t offset;						// Word offset.
+	int n;								// Max processes to wake (per host).
+} dsm_msg_notify;
+
+// MSG_ADD_PROC + MSG_DEL_PROC + MSG_SET_GID: Send process information.
 typedef struct dsm_msg_proc {
 	int pid;							// Process ID.
 	int gid;							// Global process ID.
+	unsigned int seq[DSM_SHM_NPAGES];	// [A->S] Last update of each page in
+										// the arbiter's copy (acknowledged).
 } dsm_msg_proc;
 
+// Links between arbiters in the broadcast tree (see MSG_SET_PEER).
+typedef enum dsm_treeLink {
+	TREE_NONE = 0,						// Not linked.
+	TREE_PARENT,						// Peer is the parent of the receiver.
+	TREE_CHILD							// Peer is a child of the receiver.
+} dsm_treeLink;
+
+// MSG_ADD_PEER + MSG_SET_PEER: Listener address of an arbiter.
+typedef struct dsm_msg_peer {
+	int id;								// Peer identifier (assigned by server).
+	int link;							// [S->A] Tree link (dsm_treeLink).
+	unsigned int port;					// Listener port.
+	char addr[INET6_ADDRSTRLEN];		// Listener address.
+} dsm_msg_peer;
+
 // UNION: Aggregate describing various message payloads.
 typedef union dsm_msg_payload {
 	dsm_msg_get get;
@@ -83,18 +185,67 @@ typedef union dsm_msg_payload {
 	dsm_msg_sync sync;
 	dsm_msg_done done;
 	dsm_msg_proc proc;
+	dsm_msg_page page;
+	dsm_msg_lock lock;
+	dsm_msg_atomic atomic;
+	dsm_msg_notify notify;
+	dsm_msg_peer peer;
 } dsm_msg_payload;
 
 // Structure describing message format.
 typedef struct dsm_msg {
 	dsm_msg_t type;						// Type.
 	dsm_msg_payload payload;			// Optional payload.
+	void *data;							// Variable data following payload.
+	size_t size;						// Size of variable data.
+	unsigned int seq;					// Sequence number (set on receival).
 } dsm_msg;
 
+// Byte buffer of a connection. Bytes [head, length) are pending.
+typedef struct dsm_msg_buf {
+	void *buf;							// Bytes.
+	size_t size;						// Capacity of buffer.
+	size_t head;						// Consumed or sent bytes.
+	size_t length;						// Filled bytes.
+} dsm_msg_buf;
+
+// File range queued for sending with sendfile (zero-copy frame data).
+typedef struct dsm_msg_file {
+	size_t skip;						// Queued bytes preceding the range.
+	int fd;								// Source file.
+	off_t offset;						// Offset of the unsent part.
+	size_t size;						// Size of the unsent part.
+} dsm_msg_file;
+
+// Buffered (non-blocking) connection.
+typedef struct dsm_msg_conn {
+	dsm_msg_buf in;						// Received frame bytes.
+	dsm_msg_buf out;					// Queued frame bytes.
+	size_t tail;						// Queued bytes after the last range.
+	dsm_msg_file *files;				// Queued file ranges.
+	int files_head, files_length;		// Unsent file ranges.
+	int files_size;						// Capacity of the file range array.
+	size_t file_bytes;					// Unsent file range bytes.
+	short events;						// Last reported poll events (0 = none).
+	int active;							// Index + 1 in the flush list, or 0.
+} dsm_msg_conn;
+
+// Wire header preceding each message. Only the type's payload member and
+// the variable data follow it. Fields are in network byte order.
+typedef struct dsm_msg_hdr {
+	uint8_t type;						// Message type.
+	uint8_t flags;						// Data codec (dsm_codec). Zero if raw.
+	uint16_t seq;						// Sender sequence number.
+	uint32_t length;					// Payload + data length.
+} dsm_msg_hdr;
+
 
 // Type representing a message action function.
 typedef void (*dsm_msg_func) (int, dsm_msg *);
 
+// Type representing a poll events update function: (fd, events).
+typedef void (*dsm_msg_events_func) (int, short);
+
 
 /*
  *******************************************************************************
@@ -112,6 +263,82 @@ dsm_msg_func dsm_getMsgFunc (dsm_msg_t type, dsm_msg_func *fmap);
 // Prints the contents of a message, depending on it's type.
 void dsm_showMsg (dsm_msg *mp);
 
+// Sends message as a frame: Header, payload and variable data (if any).
+// Exits fatally on error.
+void dsm_sendmsg (int fd, dsm_msg *mp);
+
+// [NON-REENTRANT] Receives a message frame from fd. Variable data is placed
+// in a static buffer, valid until the next call. Exits fatally on error.
+// Returns zero if all is normal. Returns nonzero if connection is closed.
+int dsm_recvmsg (int fd, dsm_msg *mp);
+
+// Queues message as a frame in the output buffer of fd. The payload and
+// data are copied (sync and page data coded, if that saves space). Sent by
+// dsm_flushmsgs.
+void dsm_queuemsg (int fd, dsm_msg *mp);
+
+// Queues message as a frame with coded data, if coding saves space (see
+// dsm_compress). Returns nonzero if queued.
+int dsm_queuecompressed (int fd, dsm_msg *mp);
+
+// Queues message as a frame whose data is 'size' bytes of file 'file_fd' at
+// 'offset'. The data is not copied: dsm_flushmsgs sends it with sendfile, so
+// it must not change until sent.
+void dsm_queuefile (int fd, dsm_msg *mp, int file_fd, off_t offset, 
+	size_t size);
+
+// Sends as much queued output as each connection accepts without blocking.
+// One send per connection with queued output (plus one per file range).
+// Connections whose poll events (see dsm_getMsgEvents) change are passed to
+// the events function. Output to a closed connection is discarded.
+void dsm_flushmsgs (void);
+
+// Sets the function told of poll event changes by dsm_flushmsgs.
+void dsm_setMsgEventsFunc (dsm_msg_events_func func);
+
+// Blocks until all output queued for fd is sent.
+void dsm_drainmsgs (int fd);
+
+// Blocks until the other end of fd hangs up. Input received meanwhile is
+// discarded: Closing with unread input resets the connection, which may 
+// lose output the other end has yet to read.
+void dsm_discardmsgs (int fd);
+
+// Returns the number of bytes queued for sending on fd.
+size_t dsm_pendingmsgs (int fd);
+
+// Returns the poll events for fd: POLLIN unless its queued output exceeds
+// DSM_MSG_MAX_QUEUED (backpressure), and POLLOUT while output is queued.
+short dsm_getMsgEvents (int fd);
+
+// Receives what is available on fd without blocking, for use with
+// dsm_nextmsg. Returns zero if all is normal. Returns nonzero if connection
+// is closed.
+int dsm_fillmsgs (int fd);
+
+// Decodes the next complete message received on fd. Variable data points
+// into the receive buffer, valid until the next dsm_fillmsgs on fd. Returns
+// nonzero if a message was decoded. Exits fatally on a bad frame.
+int dsm_nextmsg (int fd, dsm_msg *mp);
+
+// Appends n received bytes to the input of fd, for use with dsm_nextmsg.
+void dsm_putmsgs (int fd, const void *b, size_t n);
+
+// Returns the file-descriptors with queued output. Valid until the next
+// queue, flush or take.
+int dsm_activemsgs (const int **fds);
+
+// Swaps the queued output of fd with the empty buffer b, so the caller may
+// send it. The storage of b is reused for later output. Returns the number
+// of bytes taken. Output with file ranges can't be taken.
+size_t dsm_takemsgs (int fd, dsm_msg_buf *b);
+
+// Discards buffered input and output of fd. Call before closing it.
+void dsm_dropmsgs (int fd);
+
+// Frees all connection buffers and message buffers of the calling thread.
+void dsm_freemsgs (void);
+
 
 
 #endif
\ No newline at end of file
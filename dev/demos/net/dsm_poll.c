@@ -1,11 +1,50 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <unistd.h>
 
 #include "dsm_poll.h"
 #include "dsm_util.h"
 
 
+/*
+ *******************************************************************************
+ *                        Private Function Definitions                         *
+ *******************************************************************************
+*/
+
+
+// Converts poll events to epoll events. Linux defines them equally.
+static uint32_t toEpollEvents (short events) {
+	return (uint32_t)(unsigned short)events;
+}
+
+// Grows the file-descriptor, ready and event arrays to len entries.
+static void resizeSet (pollset *p, unsigned int len) {
+	if ((p->fds = realloc(p->fds, len * sizeof(struct pollfd))) == NULL ||
+		(p->ready = realloc(p->ready, len * sizeof(struct pollfd))) == NULL ||
+		(p->events = realloc(p->events, len * sizeof(struct epoll_event)))
+		== NULL) {
+		dsm_cpanic("Couldn't realloc pollset!", "Unknown");
+	}
+	p->len = len;
+}
+
+// Grows the slot array to hold fd. New slots are empty (-1).
+static void resizeSlots (pollset *p, int fd) {
+	unsigned int len = MAX(fd + 1, 2 * p->slots_len);
+
+	if ((p->slots = realloc(p->slots, len * sizeof(int))) == NULL) {
+		dsm_cpanic("Couldn't realloc pollset!", "Unknown");
+	}
+	for (unsigned int i = p->slots_len; i < len; i++) {
+		p->slots[i] = -1;
+	}
+	p->slots_len = len;
+}
+
+
 /*
  *******************************************************************************
  *                            Function Definitions                             *
@@ -18,56 +57,70 @@ pollset *dsm_initPollSet (unsigned int len) {
 	pollset *p;
 
 	// Allocate set.
-	if ((p = malloc(sizeof(pollset))) == NULL) {
+	if ((p = calloc(1, sizeof(pollset))) == NULL) {
 		dsm_cpanic("Couldn't allocate pollset!", "malloc failed");
 	}
 
-	// Allocate file-descriptor list.
-	if ((p->fds = malloc(len * sizeof(struct pollfd))) == NULL) {
-		dsm_cpanic("Couldn't allocate pollset!", "malloc failed");
+	// Create epoll instance.
+	if ((p->epfd = epoll_create1(EPOLL_CLOEXEC)) == -1) {
+		dsm_panic("Couldn't create epoll instance!");
 	}
 
-	// Setup remaining fields and return.
-	p->fp = 0;
-	p->len = len;
+	// Allocate file-descriptor, ready and event lists.
+	resizeSet(p, MAX(len, 1));
 
 	return p;
 }
 
-// Free's given pollset. 
+// Free's given pollset.
 void dsm_freePollSet (pollset *p) {
 	if (p == NULL) {
 		return;
 	}
+	close(p->epfd);
 	free(p->fds);
+	free(p->slots);
+	free(p->ready);
+	free(p->events);
 	free(p);
 }
 
 // Adds or updates fd with events to pollset. Exits fatally on error.
 void dsm_setPollable (int fd, short events, pollset *p) {
-	
+	struct epoll_event ev = {.events = toEpollEvents(events), .data.fd = fd};
+	int i;
+
 	// Verify argument.
-	if (p == NULL) {
-		dsm_cpanic("dsm_setPollable failed", "NULL pointer argument");
+	if (p == NULL || fd < 0) {
+		dsm_cpanic("dsm_setPollable failed", "Bad argument");
 	}
 
-	// Check if fd exists. If so, update events.
-	for (int i = 0; i < p->fp; i++) {
-		if (p->fds[i].fd == fd) {
+	// Check if fd exists. If so, update events (if changed).
+	if (fd < p->slots_len && (i = p->slots[fd]) != -1) {
+		if (p->fds[i].events != events) {
+			if (epoll_ctl(p->epfd, EPOLL_CTL_MOD, fd, &ev) == -1) {
+				dsm_panic("Couldn't modify pollable!");
+			}
 			p->fds[i].events = events;
-			return;
 		}
+		return;
 	}
 
 	// Check if room exists. Expand set if necessary.
 	if (p->fp >= p->len) {
-		p->len *= 2;
-		if ((p->fds = realloc(p->fds, p->len)) == NULL) {
-			dsm_cpanic("Couldn't realloc pollset!", "Unknown");
-		}
+		resizeSet(p, 2 * p->len);
+	}
+	if (fd >= p->slots_len) {
+		resizeSlots(p, fd);
+	}
+
+	// Register fd.
+	if (epoll_ctl(p->epfd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+		dsm_panic("Couldn't add pollable!");
 	}
 
 	// Install fd.
+	p->slots[fd] = p->fp;
 	p->fds[p->fp++] = (struct pollfd) {
 		.fd = fd,
 		.events = events,
@@ -75,31 +128,64 @@ void dsm_setPollable (int fd, short events, pollset *p) {
 	};
 }
 
-// Removes fd from pollset. Remaing sets are shuffled down.
+// Removes fd from pollset. Ready entries for fd are cleared.
 void dsm_removePollable (int fd, pollset *p) {
-	int i, j;
+	int i;
 
 	// Verify argument.
 	if (p == NULL) {
 		dsm_cpanic("dsm_removePollable failed", "NULL pointer argument");
 	}
 
-	// Search for target.
-	for (i = 0; (i < p->fp && p->fds[i].fd != fd); i++)
-		;
-
 	// If target didn't exist, return early.
-	if (i == p->fp) {
+	if (fd < 0 || fd >= p->slots_len || (i = p->slots[fd]) == -1) {
 		return;
 	}
 
-	// Overwrite and shuffle.
-	for (j = i; j < (p->fp - 1); j++) {
-		p->fds[j] = p->fds[j + 1];
+	// Deregister fd. (Already gone if fd was closed first).
+	if (epoll_ctl(p->epfd, EPOLL_CTL_DEL, fd, NULL) == -1 && errno != EBADF) {
+		dsm_panic("Couldn't remove pollable!");
+	}
+
+	// Overwrite with last entry.
+	p->fds[i] = p->fds[--p->fp];
+	p->slots[p->fds[i].fd] = i;
+	p->slots[fd] = -1;
+
+	// Don't report fd as ready for the remainder of this round.
+	for (unsigned int j = 0; j < p->nready; j++) {
+		if (p->ready[j].fd == fd) {
+			p->ready[j].revents = 0;
+		}
+	}
+}
+
+// Returns nonzero if fd is in the pollset.
+int dsm_isPollable (int fd, pollset *p) {
+	return (fd >= 0 && fd < p->slots_len && p->slots[fd] != -1);
+}
+
+// Waits up to timeout milliseconds (-1 = forever) for ready descriptors.
+// Returns the number placed in p->ready, or -1 on error (see errno).
+int dsm_poll (pollset *p, int timeout) {
+	int n;
+
+	// Wait for events.
+	p->nready = 0;
+	if ((n = epoll_wait(p->epfd, p->events, p->len, timeout)) == -1) {
+		return -1;
+	}
+
+	// Copy out ready descriptors.
+	for (int i = 0; i < n; i++) {
+		p->ready[i] = (struct pollfd) {
+			.fd = p->events[i].data.fd,
+			.events = p->fds[p->slots[p->events[i].data.fd]].events,
+			.revents = (short)p->events[i].events
+		};
 	}
 
-	// Decrement pointer.
-	p->fp--;
+	return (p->nready = n);
 }
 
 // [DEBUG] Prints the pollset.
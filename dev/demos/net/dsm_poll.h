@@ -2,6 +2,7 @@
 #define DSM_POLL_H
 
 #include <sys/poll.h>
+#include <sys/epoll.h>
 
 
 /*
@@ -11,11 +12,18 @@
 */
 
 
-// Describes a set of pollable file-descriptors.
+// Describes a set of pollable file-descriptors. Backed by an epoll instance:
+// Registration and removal are O(1), and dsm_poll only returns ready ones.
 typedef struct pollset {
+	int epfd;				// Epoll instance.
 	unsigned int fp;		// File-descriptor array pointer.
 	unsigned int len;		// Length of the file-descriptor array (capacity).
-	struct pollfd *fds;		// File-descriptor array.		
+	struct pollfd *fds;		// File-descriptor array. Unordered.
+	int *slots;				// Index of each fd in fds, or -1. Indexed by fd.
+	unsigned int slots_len;	// Length of the slot array.
+	unsigned int nready;	// Number of ready file-descriptors.
+	struct pollfd *ready;	// Ready file-descriptors (of last dsm_poll).
+	struct epoll_event *events;	// Event buffer for epoll_wait.
 } pollset;
 
 
@@ -29,15 +37,22 @@ typedef struct pollset {
 // Initializes and returns empty pollset. Exits fatally on error.
 pollset *dsm_initPollSet (unsigned int len);
 
-// Free's given pollset. 
+// Free's given pollset.
 void dsm_freePollSet (pollset *p);
 
 // Adds or updates fd with events to pollset. Exits fatally on error.
 void dsm_setPollable (int fd, short events, pollset *p);
 
-// Removes fd from pollset. Remaing sets are shuffled down.
+// Removes fd from pollset. Ready entries for fd are cleared.
 void dsm_removePollable (int fd, pollset *p);
 
+// Returns nonzero if fd is in the pollset.
+int dsm_isPollable (int fd, pollset *p);
+
+// Waits up to timeout milliseconds (-1 = forever) for ready descriptors.
+// Returns the number placed in p->ready, or -1 on error (see errno).
+int dsm_poll (pollset *p, int timeout);
+
 // [DEBUG] Prints the pollset.
 void dsm_showPollable (pollset *p);
 
@@ -107,6 +107,11 @@ int dsm_dequeueOpQueue (dsm_opqueue *oq) {
 	return val;
 }
 
+// Returns the number of items in the operation-queue.
+unsigned int dsm_getOpQueueLength (dsm_opqueue *oq) {
+	return (oq->head + oq->queueSize - oq->tail) % oq->queueSize;
+}
+
 // Prints the operation-queue.
 void dsm_showOpQueue (dsm_opqueue *oq) {
 	printf("Operation Step = %d\n", oq->step);
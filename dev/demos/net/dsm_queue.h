@@ -23,7 +23,6 @@
 // Enumeration of server states.
 typedef enum dsm_syncStep {
 	STEP_READY = 0,					// No write request is pending. All normal.
-	STEP_WAITING_STOP_ACK,			// Waiting for stop ack from all arbiters.
 	STEP_WAITING_SYNC_INFO,			// Waiting for write data information.
 	STEP_WAITING_SYNC_ACK			// Waiting for data received acks.
 } dsm_syncStep;
@@ -62,6 +61,9 @@ void dsm_enqueueOpQueue (int fd, dsm_opqueue *oq);
 // Dequeues file-descriptor from operation queue. Panics on error.
 int dsm_dequeueOpQueue (dsm_opqueue *oq);
 
+// Returns the number of items in the operation-queue.
+unsigned int dsm_getOpQueueLength (dsm_opqueue *oq);
+
 // Prints the operation-queue.
 void dsm_showOpQueue (dsm_opqueue *oq);
 
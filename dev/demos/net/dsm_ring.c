@@ -0,0 +1,75 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dsm_ring.h"
+#include "dsm_util.h"
+
+
+/*
+ *******************************************************************************
+ *                            Function Definitions                             *
+ *******************************************************************************
+*/
+
+
+// Puts the type and payload of mp in ring r. Returns nonzero if r is full.
+// (Producer only).
+int dsm_ringPut (dsm_ring *r, dsm_msg *mp) {
+	unsigned int tail = r->tail;
+	dsm_ring_msg *sp = r->slots + tail % DSM_RING_SLOTS;
+
+	if (tail - __atomic_load_n(&r->head, __ATOMIC_ACQUIRE) == DSM_RING_SLOTS) {
+		return -1;
+	}
+
+	// Fill the slot, then publish it.
+	sp->type = mp->type;
+	sp->payload = mp->payload;
+	__atomic_store_n(&r->tail, tail + 1, __ATOMIC_RELEASE);
+
+	return 0;
+}
+
+// Takes the next message of ring r into mp. Returns nonzero if r is empty.
+// (Consumer only).
+int dsm_ringGet (dsm_ring *r, dsm_msg *mp) {
+	unsigned int head = r->head;
+	dsm_ring_msg *sp = r->slots + head % DSM_RING_SLOTS;
+
+	if (head == __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE)) {
+		return -1;
+	}
+
+	// Copy the slot out, then release it.
+	memset(mp, 0, sizeof(*mp));
+	mp->type = sp->type;
+	mp->payload = sp->payload;
+	__atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE);
+
+	return 0;
+}
+
+// Returns nonzero if ring r is empty.
+int dsm_isRingEmpty (dsm_ring *r) {
+	return __atomic_load_n(&r->head, __ATOMIC_ACQUIRE) ==
+		__atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+}
+
+// Checks ring r a while for a message. Returns nonzero if it stays empty.
+int dsm_ringSpin (dsm_ring *r) {
+
+	for (int i = 0; i < DSM_RING_SPIN; i++) {
+		if (!dsm_isRingEmpty(r)) {
+			return 0;
+		}
+		__builtin_ia32_pause();
+	}
+
+	return -1;
+}
+
+// Resets ring pair rp to empty and free.
+void dsm_ringReset (dsm_ring_pair *rp) {
+	memset(rp, 0, sizeof(*rp));
+}
@@ -0,0 +1,77 @@
+#if !defined(DSM_RING_H)
+#define DSM_RING_H
+
+
+#include "dsm_msg.h"
+
+
+/*
+ *******************************************************************************
+ *                             Symbolic Constants                              *
+ *******************************************************************************
+*/
+
+
+// Slots of a ring. A power of two.
+#define DSM_RING_SLOTS			8
+
+// Checks of an empty ring before parking.
+#define DSM_RING_SPIN			4096
+
+
+/*
+ *******************************************************************************
+ *                              Type Definitions                               *
+ *******************************************************************************
+*/
+
+
+// A message in a ring: Type and payload. Variable data isn't carried: Both
+// ends map the shared pages.
+typedef struct dsm_ring_msg {
+	dsm_msg_t type;
+	dsm_msg_payload payload;
+} dsm_ring_msg;
+
+// Single-producer single-consumer ring in shared memory. The indices run
+// freely: A message is at slot (index % DSM_RING_SLOTS).
+typedef struct dsm_ring {
+	unsigned int head;		// Messages taken (by the consumer).
+	unsigned int tail;		// Messages put (by the producer).
+	dsm_ring_msg slots[DSM_RING_SLOTS];
+} dsm_ring;
+
+// Ring pair of a process and its arbiter.
+typedef struct dsm_ring_pair {
+	int pid;				// Owning process (0 if free). Set by the arbiter.
+	dsm_ring req;			// Requests: Process to arbiter.
+	dsm_ring rsp;			// Responses: Arbiter to process.
+} dsm_ring_pair;
+
+
+/*
+ *******************************************************************************
+ *                            Function Declarations                            *
+ *******************************************************************************
+*/
+
+
+// Puts the type and payload of mp in ring r. Returns nonzero if r is full.
+// (Producer only).
+int dsm_ringPut (dsm_ring *r, dsm_msg *mp);
+
+// Takes the next message of ring r into mp. Returns nonzero if r is empty.
+// (Consumer only).
+int dsm_ringGet (dsm_ring *r, dsm_msg *mp);
+
+// Returns nonzero if ring r is empty.
+int dsm_isRingEmpty (dsm_ring *r);
+
+// Checks ring r a while for a message. Returns nonzero if it stays empty.
+int dsm_ringSpin (dsm_ring *r);
+
+// Resets ring pair rp to empty and free.
+void dsm_ringReset (dsm_ring_pair *rp);
+
+
+#endif
@@ -1,8 +1,12 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <errno.h>
 #include <unistd.h>
+#include <pthread.h>
 
 #include <sys/types.h>
+#include <sys/eventfd.h>
 #include <sys/socket.h>
 #include <netdb.h>
 
@@ -14,6 +18,10 @@
 #include "dsm_util.h"
 #include "dsm_poll.h"
 #include "dsm_queue.h"
+#include "dsm_types.h"
+#include "dsm_stats.h"
+#include "dsm_uring.h"
+#include "dsm_mpsc.h"
 
 
 /*
@@ -32,9 +40,35 @@
 // Minimum number of queuable operation requests.
 #define DSM_MIN_OPQUEUE_SIZE	32
 
+// Minimum number of updates in flight.
+#define DSM_MIN_UPDATES			32
+
+// Use the io_uring event loop by default (build with -DDSM_URING=1).
+#if !defined(DSM_URING)
+#define DSM_URING				0
+#endif
+
+// Submission queue entries of the io_uring event loop.
+#define DSM_URING_ENTRIES		256
+
+// Number and size of the provided receive buffers of the io_uring loop.
+#define DSM_URING_NBUFS			64
+#define DSM_URING_BUFSIZE		(16 << 10)
+
+// Buffer group of the provided receive buffers.
+#define DSM_URING_BGID			0
+
+// Default fan-out of the arbiter tree (broadcasts and acknowledgements).
+#define DSM_DEF_FANOUT			4
+
+// Default and maximum number of worker threads.
+#define DSM_DEF_WORKERS			1
+#define DSM_MAX_WORKERS			16
+
 // Usage format.
-#define DSM_ARG_FMT	"-nproc=<nproc> [-sid= <session-id> -addr=<address>"\
-					"-port=<port>]"
+#define DSM_ARG_FMT	"-nproc=<nproc> [-loop=<poll|uring>] [-fanout=<k>] "\
+					"[-workers=<n>] [-part=<k>/<n>] "\
+					"[-sid= <session-id> -addr=<address> -port=<port>]"
 
 
 /*
@@ -56,27 +90,127 @@ int gid;
 // Pollable file-descriptor set.
 pollset *pollableSet;
 
-// Function map.
+// Function map (I/O thread).
 dsm_msg_func fmap[MSG_MAX_VALUE];
 
-// Operation queue (current write state, who wants to write next, etc).
-dsm_opqueue *opqueue;
+// Function map of the workers.
+dsm_msg_func wmap[MSG_MAX_VALUE];
+
+// Worker threads. Each owns a range of pages.
+dsm_worker *workers;
+
+// Number of worker threads.
+unsigned int nworkers = DSM_DEF_WORKERS;
+
+// The worker of the calling thread.
+__thread dsm_worker *worker;
+
+// Messages posted by the workers, for the I/O thread to send.
+dsm_mpsc outbox;
+
+// Eventfd waking the I/O thread to send posted messages.
+int wake_efd;
+
+// Read buffer of the wake-up eventfd (io_uring event loop).
+uint64_t wake_count;
+
+// Messages posted by the worker since it last woke the I/O thread.
+__thread int posted;
+
+// Operation queue of each page (write state, who wants to write next, etc).
+// Writes to different pages progress at once. Used by the page's worker.
+dsm_opqueue *opqueues[DSM_SHM_NPAGES];
+
+// Atomic requester (gid) of each queued operation on each page (kept parallel
+// to its opqueue). -1 if it is a write.
+dsm_opqueue *atomicqueues[DSM_SHM_NPAGES];
+
+// Operations queued on each page, and the deepest its queue has been.
+unsigned long queue_ops[DSM_SHM_NPAGES];
+unsigned int queue_depth[DSM_SHM_NPAGES];
+
+// Pending atomic operation of each process. Indexed by gid.
+dsm_msg_atomic *atomics;
+
+// Home copy of the shared pages. Serves copies to new page holders.
+unsigned char *pages;
+
+// Copysets: copyset[page * nproc + gid] is set if gid holds a valid copy.
+unsigned char *copyset;
+
+// Arbiter socket of each process. Indexed by gid (-1 if not registered).
+// Fixed once the session starts: Workers read it.
+int *gid_fd;
 
 // The total number of participant processes.
 unsigned int nproc = -1;
 
-// The number of stopped processes.
-unsigned int nproc_stopped;
-
 // The number of waiting processes (barrier).
 unsigned int nproc_waiting;
 
-// The number of updated processes.
-unsigned int nproc_synced;
-
 // The listener socket.
 int sock_listen;
 
+// Arbiter holding each lock token (-1 if the server holds it).
+int lock_owner[DSM_MAX_LOCKS];
+
+// Arbiters waiting for each lock token.
+dsm_opqueue *lockqueue[DSM_MAX_LOCKS];
+
+// Nonzero if the owner of each lock token has been told to return it.
+int lock_recalled[DSM_MAX_LOCKS];
+
+// Peer listener address of each arbiter. Indexed by fd (port 0 if unknown).
+dsm_msg_peer *peers;
+
+// Length of the peer table.
+int peers_length;
+
+// Updates in flight on the pages of the worker.
+__thread dsm_update *updates;
+
+// Number of updates in flight, and capacity of the update array.
+__thread int updates_length, updates_size;
+
+// Number of sequence numbers taken by the worker.
+__thread unsigned int seq_taken;
+
+// Sequence number of the last update of each page (granted or ordered).
+unsigned int page_seq[DSM_SHM_NPAGES];
+
+// Sequence number of the last update applied to the home copy of each page.
+unsigned int home_seq[DSM_SHM_NPAGES];
+
+// Arbiter of the last ordered write of each page (-1 if none, or if an atomic
+// operation followed it).
+int page_writer[DSM_SHM_NPAGES];
+
+// Arbiters in tree order: Those at i < fanout are the top, and the parent
+// of those below is at i / fanout - 1. Exited arbiters are -1.
+int *tree;
+
+// Length of the arbiter tree.
+int tree_length;
+
+// Fan-out of the arbiter tree.
+unsigned int fanout = DSM_DEF_FANOUT;
+
+// Page partition served (of nparts). The server of partition 0 also runs the
+// session: It registers processes, and keeps the barriers and locks.
+unsigned int part, nparts = 1;
+
+// Nonzero if the io_uring event loop is used instead of poll.
+int withUring = DSM_URING;
+
+// The io_uring instance (io_uring event loop).
+dsm_uring ring;
+
+// Connection states of the io_uring event loop. Indexed by fd.
+dsm_uring_conn *uring_conns;
+
+// Length of the io_uring connection table.
+int uring_conns_length;
+
 
 /*
  *******************************************************************************
@@ -85,8 +219,80 @@ int sock_listen;
 */
 
 
-// Message indicating data was received.
-static void msg_syncDone (int fd, dsm_msg *mp);
+// Returns the number of page holders. If fd >= 0, counts only those at fd.
+static unsigned int countCopyset (int page, int fd);
+
+// Returns nonzero if g holds page, and no holder at its arbiter has a lower
+// gid: Each arbiter with holders is then visited once.
+static int isFirstHolder (int page, int g);
+
+// Sends message to each arbiter with a holder of page, except to 'skip'.
+static void send_copysetMsg (int page, int skip, dsm_msg *mp);
+
+// Passes lock token 'id' to the next queued arbiter, or back to the server.
+static void passLockToken (unsigned int id);
+
+// Applies the atomic operation of update u to the home copy and pushes the
+// result.
+static void applyAtomic (dsm_update *u);
+
+// Adds an update of page by writer (atomic if g != -1), chained to the last
+// update of the page. Returns the update.
+static dsm_update *addUpdate (int writer, int page, int g);
+
+// Returns the update with sequence number seq. Returns NULL if none.
+static dsm_update *getUpdate (unsigned int seq);
+
+// Returns the granted update of page awaiting its sync info. Returns NULL if
+// none.
+static dsm_update *getGrantedUpdate (int page);
+
+// Completes update u if it is ordered and acknowledged by all holders.
+static void checkUpdate (dsm_update *u);
+
+// Returns the peer table entry of fd. Grows the table as needed.
+static dsm_msg_peer *getPeer (int fd);
+
+// Returns nonzero if update u is pushed to fd.
+static int isPushed (dsm_update *u, int fd);
+
+// Queues operation of 'fd' on page (atomic if g != -1). Notes the depth.
+static void queueOperation (int fd, int page, int g);
+
+// Grants the next write of page to the arbiter of its last writer ahead of a
+// request. The arbiter keeps it as a write token until used or recalled.
+static void grantToken (int writer, int page);
+
+// Takes back the unused write token of update u. Starts the queued operations.
+static void releaseToken (dsm_update *u);
+
+// Prints the operations queued on each page, and its deepest queue.
+static void showPageQueues (void);
+
+// Returns the tree link of the arbiter at index j to that at index i.
+static dsm_treeLink getTreeLink (int i, int j);
+
+// Returns the worker owning page: The pages are split in nworkers ranges.
+static dsm_worker *getPageWorker (int page);
+
+// Returns a job with a copy of message mp (and its data), from or to fd.
+static dsm_job *newJob (int fd, dsm_msg *mp);
+
+// Passes a copy of message mp from fd to worker w. Wakes it if it waits.
+static void putJob (dsm_worker *w, int fd, dsm_msg *mp);
+
+// Posts a copy of message mp to fd. The I/O thread sends it. (Workers only).
+static void postMsg (int fd, dsm_msg *mp);
+
+// Queues the messages posted by the workers. Those to connections closed
+// since are dropped.
+static void sendPosted (void);
+
+// Starts the workers. From then on, they own the pages.
+static void startWorkers (void);
+
+// Stops the workers, and waits for them to exit.
+static void stopWorkers (void);
 
 
 /*
@@ -106,18 +312,19 @@ static void send_setSession (const char *sid, const char *addr,
 	memset(&msg, 0, sizeof(msg));
 	msg.type = MSG_SET_SESSION;
 	sprintf(msg.payload.set.sid, "%.*s", DSM_SID_SIZE, sid);
+	msg.payload.set.part = part;
 
 	// Set message port to current port.
 	dsm_getSocketInfo(sock_listen, NULL, 0, &msg.payload.set.port);
 
-	printf("[%d] Sending: TYPE = %u, SID = \"%s\", PORT= %u\n", getpid(),
-		msg.type, msg.payload.set.sid, msg.payload.set.port);
+	printf("[%d] Sending: TYPE = %u, SID = \"%s\", PORT= %u, PART = %u\n",
+		getpid(), msg.type, msg.payload.set.sid, msg.payload.set.port, part);
 
 	// Open socket.
 	s = dsm_getConnectedSocket(addr, port);
 
 	// Send message.
-	dsm_sendall(s, &msg, sizeof(msg));
+	dsm_sendmsg(s, &msg);
 
 	// Close socket.
 	close(s);
@@ -138,13 +345,13 @@ static void send_delSession (const char *sid, const char *addr,
 	s = dsm_getConnectedSocket(addr, port);
 	
 	// Send message.
-	dsm_sendall(s, &msg, sizeof(msg));
+	dsm_sendmsg(s, &msg);
 
 	// Close socket.
 	close(s);
 }
 
-// Sends basic message 'type' to fd. If fd == -1, sends to all file-descriptors.
+// Sends basic message 'type' to fd. If fd == -1, broadcasts down the tree.
 static void send_simpleMsg (int fd, dsm_msg_t type) {
 	dsm_msg msg;
 
@@ -154,16 +361,138 @@ static void send_simpleMsg (int fd, dsm_msg_t type) {
 
 	// If fd is non-negative, send just to fd.
 	if (fd >= 0) {
-		dsm_sendall(fd, &msg, sizeof(msg));
+		dsm_queuemsg(fd, &msg);
 		return;
 	}
 
-	// Otherwise, send to all (skip listener socket at index 0).
-	for (int i = 1; i < pollableSet->fp; i++) {
-		dsm_sendall(pollableSet->fds[i].fd, &msg, sizeof(msg));
+	// Otherwise, send to the top of the arbiter tree. It is forwarded down.
+	for (int i = 0; i < tree_length && i < fanout; i++) {
+		if (tree[i] != -1) {
+			dsm_queuemsg(tree[i], &msg);
+		}
+	}
+}
+
+// Sends message to each arbiter with a holder of page, except to 'skip'.
+static void send_copysetMsg (int page, int skip, dsm_msg *mp) {
+
+	// Send to arbiters with a holder.
+	for (int g = 0; g < nproc; g++) {
+		if (gid_fd[g] != skip && isFirstHolder(page, g)) {
+			postMsg(gid_fd[g], mp);
+		}
+	}
+}
+
+// Arranges the arbiters in a tree. Sends each the listener addresses of all
+// others, with their links to it.
+static void send_peerTable (void) {
+	dsm_msg msg;
+
+	// Order the arbiters with listeners.
+	tree = dsm_zalloc(peers_length * sizeof(int));
+	for (int fd = 0; fd < peers_length; fd++) {
+		if (peers[fd].port != 0) {
+			tree[tree_length++] = fd;
+		}
+	}
+
+	// Configure message.
+	memset(&msg, 0, sizeof(msg));
+	msg.type = MSG_SET_PEER;
+
+	// Send every pair of arbiters.
+	for (int i = 0; i < tree_length; i++) {
+		for (int j = 0; j < tree_length; j++) {
+			if (j != i) {
+				msg.payload.peer = peers[tree[j]];
+				msg.payload.peer.link = getTreeLink(i, j);
+				dsm_queuemsg(tree[i], &msg);
+			}
+		}
 	}
 }
 
+// Sends lock message 'type' for lock 'id' to fd.
+static void send_lockMsg (int fd, dsm_msg_t type, unsigned int id, int flag) {
+	dsm_msg msg;
+
+	// Configure message.
+	memset(&msg, 0, sizeof(msg));
+	msg.type = type;
+	msg.payload.lock.id = id;
+	msg.payload.lock.flag = flag;
+
+	// Send message.
+	dsm_queuemsg(fd, &msg);
+}
+
+// Sends the result of the atomic operation of 'g' to its arbiter.
+static void send_atomicDone (int fd, int g) {
+	dsm_msg msg;
+
+	// Configure message.
+	memset(&msg, 0, sizeof(msg));
+	msg.type = MSG_ATOMIC_DONE;
+	msg.payload.atomic = atomics[g];
+
+	// Send message.
+	postMsg(fd, &msg);
+}
+
+// Starts the operations queued on page in order, while no granted write of
+// the page awaits its sync info: Granting a write waits only for the previous
+// update to be ordered, not for its acknowledgements.
+static void startOperations (int page) {
+	dsm_opqueue *opqueue = opqueues[page];
+	int writer, g;
+	dsm_update *u;
+	dsm_msg msg;
+
+	while (opqueue->step == STEP_READY && !dsm_isOpQueueEmpty(opqueue)) {
+		writer = dsm_dequeueOpQueue(opqueue);
+		g = dsm_dequeueOpQueue(atomicqueues[page]);
+		u = addUpdate(writer, page, g);
+
+		// Atomic operations are carried out (and ordered) here.
+		if (g != -1) {
+			applyAtomic(u);
+			continue;
+		}
+
+		// Name the other arbiters with holders of the page: The writer's
+		// arbiter pushes the update to them directly.
+		u->pushed = dsm_zalloc(MAX(peers_length, 1) * sizeof(int));
+		for (int fd = 0; fd < peers_length; fd++) {
+			if (fd != writer && peers[fd].port != 0 && 
+				countCopyset(page, fd) > 0) {
+				u->pushed[u->npushed++] = fd;
+			}
+		}
+
+		// Grant write access: Holders read around updates via page seqlocks.
+		memset(&msg, 0, sizeof(msg));
+		msg.type = MSG_WRITE_OKAY;
+		msg.payload.sync.offset = page * DSM_PAGESIZE;
+		msg.payload.sync.seq = u->seq;
+		msg.payload.sync.prev = u->prev;
+		msg.data = u->pushed;
+		msg.size = u->npushed * sizeof(int);
+		postMsg(writer, &msg);
+		opqueue->step = STEP_WAITING_SYNC_INFO;
+	}
+
+	// An operation waits behind a write token: Recall it (once).
+	if (opqueue->step != STEP_READY && !dsm_isOpQueueEmpty(opqueue) &&
+		(u = getGrantedUpdate(page)) != NULL && u->token && !u->recalled) {
+		memset(&msg, 0, sizeof(msg));
+		msg.type = MSG_WRITE_RECALL;
+		msg.payload.sync.offset = page * DSM_PAGESIZE;
+		msg.payload.sync.seq = u->seq;
+		postMsg(u->writer, &msg);
+		u->recalled = 1;
+	}
+}
 
 /*
  *******************************************************************************
@@ -173,16 +502,32 @@ static void send_simpleMsg (int fd, dsm_msg_t type) {
 
 // Message from arbiter registering a process.
 static void msg_addProc (int fd, dsm_msg *mp) {
+	int g = mp->payload.proc.gid;
+
+	// Partition servers: The process has its gid. Just remember its arbiter.
+	if (part != 0) {
+		if (g < 0 || g >= nproc || gid_fd[g] != -1) {
+			dsm_cpanic("msg_addProc", "Bad process!");
+		}
+		gid_fd[g] = fd;
+		return;
+	}
 
 	// Ensure this message isn't received after the session has started.
 	if (started == 1) {
 		dsm_cpanic("msg_addProc", "Received out of order message!");
 	}
 
-	// Send a reply with the process global ID.
+	// Ensure no more than nproc processes register.
+	if (gid >= nproc) {
+		dsm_cpanic("msg_addProc", "Too many processes!");
+	}
+
+	// Send a reply with the process global ID. Remember its arbiter.
 	mp->type = MSG_SET_GID;
 	mp->payload.proc.gid = gid++;
-	dsm_sendall(fd, mp, sizeof(*mp));
+	gid_fd[mp->payload.proc.gid] = fd;
+	dsm_queuemsg(fd, mp);
 
 	// If all processes are accounted for, then start.
 	if ((nproc_waiting += 1) >= nproc) {
@@ -190,8 +535,12 @@ static void msg_addProc (int fd, dsm_msg *mp) {
 	
 		// Set global started flag to: true.
 		started = 1;
+
+		// Pass the pages to the workers.
+		startWorkers();
 		
-		// Send start message to all arbiters.
+		// Introduce the arbiters to each other, then send start message.
+		send_peerTable();
 		send_simpleMsg(-1, MSG_WAIT_DONE);
 
 		// Reset the barrier.
@@ -199,137 +548,215 @@ static void msg_addProc (int fd, dsm_msg *mp) {
 	}
 }
 
-// Message requesting write access.
-static void msg_syncRequest (int fd, dsm_msg *mp) {
-	int wasEmpty = 0;
+// Message requesting a copy of a page. Adds requester to the page copyset.
+static void msg_pageReq (int fd, dsm_msg *mp) {
+	dsm_msg_page data = mp->payload.page;
+	int page = data.offset / DSM_PAGESIZE;
 
 	// Ensure session started.
 	if (started == 0) {
-		dsm_cpanic("msg_syncRequest", "Received out of order message!");
+		dsm_cpanic("msg_pageReq", "Received out of order message!");
 	}
 
-	// Remember if the queue is empty.
-	wasEmpty = dsm_isOpQueueEmpty(opqueue);
-
-	// Queue request.
-	dsm_enqueueOpQueue(fd, opqueue);
+	// Verify page and requester.
+	if (page < 0 || page >= DSM_SHM_NPAGES || data.gid < 0 || 
+		data.gid >= nproc || gid_fd[data.gid] != fd) {
+		dsm_cpanic("msg_pageReq", "Bad page request!");
+	}
 
-	// If no other operation in progress, send stop instruction and set step.
-	if (wasEmpty) {
+	// The arbiter's copy is valid only if it has another holder. 
+	mp->type = MSG_PAGE_DATA;
+	mp->payload.page.offset = page * DSM_PAGESIZE;
+	mp->payload.page.size = (countCopyset(page, fd) > 0 ? 0 : DSM_PAGESIZE);
+	mp->payload.page.seq = home_seq[page];
 
-		// Assert current step is STEP_READY.
-		if (opqueue->step != STEP_READY) {
-			dsm_cpanic("msg_syncRequest", "Inconsistent internal state!");
-		}
+	// Add to the copyset: All future updates of the page now reach it.
+	copyset[page * nproc + data.gid] = 1;
 
-		// Send message to stop, advance to next step.
-		send_simpleMsg(-1, MSG_STOP_ALL);
-		opqueue->step = STEP_WAITING_STOP_ACK;
-	}
+	// Reply. Attach a copy of the page if needed.
+	mp->data = pages + page * DSM_PAGESIZE;
+	mp->size = mp->payload.page.size;
+	postMsg(fd, mp);
 }
 
-// Message indicating given machine has stopped all it's processes.
-static void msg_stopDone (int fd, dsm_msg *mp) {
-	dsm_msg_done data = mp->payload.done;
+// Message requesting write access.
+static void msg_syncRequest (int fd, dsm_msg *mp) {
+	int page = mp->payload.sync.offset / DSM_PAGESIZE;
+	dsm_update *u;
 
-	// Verify message is appropriate.
-	if (started == 0 || opqueue->step != STEP_WAITING_STOP_ACK) {
-		dsm_cpanic("msg_stopDone", "Received out of order message!");
+	// Ensure session started.
+	if (started == 0) {
+		dsm_cpanic("msg_syncRequest", "Received out of order message!");
 	}
 
-	// If n processes have stopped: Inform writer, advance to next step.
-	printf("[%d] Received MSG_STOP_DONE (%d/%d needed)\n", getpid(), nproc_stopped + data.nproc, nproc);
-	if ((nproc_stopped += data.nproc) >= nproc) {
-
-		// Ensure writer exists.
-		if (dsm_isOpQueueEmpty(opqueue)) {
-			dsm_cpanic("msg_didStop", "Message to nonexistant writer!");
-		}
+	// Verify page.
+	if (page < 0 || page >= DSM_SHM_NPAGES) {
+		dsm_cpanic("msg_syncRequest", "Bad page!");
+	}
 
-		// Inform writer, increment step, reset stopped count.
-		send_simpleMsg(dsm_getOpQueueHead(opqueue), MSG_WRITE_OKAY);
-		opqueue->step = STEP_WAITING_SYNC_INFO;
-		nproc_stopped = 0;
+	// The arbiter holds the write token of the page: It grants the write.
+	if ((u = getGrantedUpdate(page)) != NULL && u->token && u->writer == fd) {
+		return;
 	}
+
+	// Queue request.
+	queueOperation(fd, page, -1);
+
+	// Grant access now if no granted write of the page is still unordered.
+	startOperations(page);
 }
 
-// Message providing sychronization specifics.
+// Message providing sychronization specifics. Orders the granted update.
 static void msg_syncInfo (int fd, dsm_msg *mp) {
+	dsm_msg_sync data = mp->payload.sync;
+	int page = data.offset / DSM_PAGESIZE;
+	unsigned int seq;
+	dsm_update *u;
 
 	// Verify message is appropriate.
-	if (started == 0 || opqueue->step != STEP_WAITING_SYNC_INFO) {
+	if (started == 0 || data.offset < 0 || page >= DSM_SHM_NPAGES ||
+		opqueues[page]->step != STEP_WAITING_SYNC_INFO || 
+		(u = getGrantedUpdate(page)) == NULL) {
 		dsm_cpanic("msg_syncStart", "Received out of order message!");
 	}
 
 	// Verify sender is current writer.
-	if (dsm_isOpQueueEmpty(opqueue) || dsm_getOpQueueHead(opqueue) != fd) {
+	if (u->writer != fd || data.seq != u->seq || data.prev != u->prev) {
 		dsm_cpanic("msg_syncStart", "Sender is not current writer!");
 	}
 
-	// If there is only one arbiter, the jump to msg_syncDone.
-	if (pollableSet->fp == 2) {
-
-		// Set the step.
-		opqueue->step = STEP_WAITING_SYNC_ACK;
+	// Verify update lies within the granted page.
+	if (data.size != mp->size || data.offset < 0 ||
+		(data.offset / DSM_PAGESIZE) != u->page ||
+		data.offset + data.size > (u->page + 1) * DSM_PAGESIZE) {
+		dsm_cpanic("msg_syncStart", "Update outside of page!");
+	}
 
-		// Rewrite msg as syncDone. Use nproc since all proc on one arbiter.
-		mp->type = MSG_SYNC_DONE;
-		mp->payload.done.nproc = nproc;
-		
-		msg_syncDone(fd, mp);
-		return;
+	// Apply update to the home copy.
+	memcpy(pages + data.offset, mp->data, data.size);
+	home_seq[u->page] = u->seq;
+
+	// The update is ordered. Expect an ack for every holder. The writer's 
+	// arbiter shares the written page: Its holders are up to date.
+	u->ordered = 1;
+	u->expected = countCopyset(u->page, -1);
+	u->synced += countCopyset(u->page, fd);
+
+	// The writer's arbiter pushed the update to the named arbiters. Relay it
+	// to those with holders since (or without a peer listener).
+	for (int g = 0; g < nproc; g++) {
+		if (gid_fd[g] != fd && isPushed(u, gid_fd[g]) == 0 &&
+			isFirstHolder(page, g)) {
+			postMsg(gid_fd[g], mp);
+		}
+	}
+	free(u->pushed);
+	u->pushed = NULL;
+	u->npushed = 0;
+
+	// If nobody waits, and the arbiter wrote the last update too, hand it a
+	// write token: Its repeated writes then don't wait on a request each. The
+	// token goes ahead of the writer's continue, so its next write finds it.
+	opqueues[page]->step = STEP_READY;
+	if (dsm_isOpQueueEmpty(opqueues[page]) && page_writer[page] == fd) {
+		seq = u->seq;
+		grantToken(fd, page);
+		u = getUpdate(seq);
 	}
+	page_writer[page] = fd;
+
+	// Complete the update if nobody else holds the page. Then grant the next.
+	checkUpdate(u);
+	startOperations(page);
+}
 
-	printf("[%d] Received MSG_SYNC_INFO! Forwarding to all others!\n", getpid());
+// Message returning an unused write token. Starts the queued operations.
+static void msg_writeRel (int fd, dsm_msg *mp) {
+	int page = mp->payload.sync.offset / DSM_PAGESIZE;
+	dsm_update *u;
 
-	// Forward to all file-descriptors.
-	for (int i = 1; i < pollableSet->fp; i++) {
-		dsm_sendall(pollableSet->fds[i].fd, mp, sizeof(*mp));
+	// Verify the arbiter holds the token.
+	if ((u = getGrantedUpdate(page)) == NULL || u->token == 0 ||
+		u->writer != fd || u->seq != mp->payload.sync.seq) {
+		dsm_cpanic("msg_writeRel", "Arbiter doesn't hold write token!");
 	}
 
-	// Set state to next step.
-	opqueue->step = STEP_WAITING_SYNC_ACK;
+	releaseToken(u);
+}
+
+// Message indicating arbiter is exiting. Takes back the write tokens it held
+// of the pages of the worker. (Every worker is passed the message).
+static void msg_dropTokens (int fd, dsm_msg *mp) {
+	dsm_update *u;
+
+	for (int page = 0; page < DSM_SHM_NPAGES; page++) {
+		if (getPageWorker(page) == worker &&
+			(u = getGrantedUpdate(page)) != NULL && u->token &&
+			u->writer == fd) {
+			releaseToken(u);
+		}
+	}
 }
 
 // Message indicating data was received.
 static void msg_syncDone (int fd, dsm_msg *mp) {
 	dsm_msg_done data = mp->payload.done;
+	dsm_update *u;
 
 	// Verify message is appropriate.
-	if (started == 0 || opqueue->step != STEP_WAITING_SYNC_ACK) {
+	if (started == 0) {
 		dsm_cpanic("msg_syncDone", "Received out of order message!");
 	}
-	
-	printf("[%d] Received MSG_SYNC_DONE!\n", getpid());
 
-	// If (n-1) processes have updated. Check queue for new write, or continue.
-	if ((nproc_synced += data.nproc) >= nproc) {
+	// Holders that exited may leave an update complete before its last ack.
+	if ((u = getUpdate(data.seq)) == NULL) {
+		dsm_warning("Acknowledgement of completed update!");
+		return;
+	}
+
+	// Pushed updates may be acknowledged before the writer's sync info.
+	u->synced += data.nproc;
+	checkUpdate(u);
+}
 
-		// Dequeue completed write-operation.
-		dsm_dequeueOpQueue(opqueue);
+// Message requesting an atomic operation. Queued behind pending writes.
+static void msg_atomicReq (int fd, dsm_msg *mp) {
+	dsm_msg_atomic data = mp->payload.atomic;
 
-		// Reset counter.
-		nproc_synced = 0;
+	// Ensure session started.
+	if (started == 0) {
+		dsm_cpanic("msg_atomicReq", "Received out of order message!");
+	}
 
-		// Check if another write is pending. Go to step 2. Inform writer.
-		if (!dsm_isOpQueueEmpty(opqueue)) {
-			printf("[%d] Another operation is waiting, doing it next!\n", getpid());
-			opqueue->step = STEP_WAITING_SYNC_INFO;
-			send_simpleMsg(dsm_getOpQueueHead(opqueue), MSG_WRITE_OKAY);
-			return;
-		}
+	// Verify requester, and that the word lies within the shared region.
+	if (data.gid < 0 || data.gid >= nproc || gid_fd[data.gid] != fd ||
+		data.offset < 0 || data.offset % sizeof(int) != 0 ||
+		data.offset + sizeof(int) > DSM_SHM_NPAGES * DSM_PAGESIZE) {
+		dsm_cpanic("msg_atomicReq", "Bad atomic request!");
+	}
 
-		printf("[%d] Informing all participants to continue!\n", getpid());
-		
-		// Inform all processes to continue.
-		send_simpleMsg(-1, MSG_CONT_ALL);
+	// Queue request: Requester blocks, so it has at most one pending.
+	atomics[data.gid] = data;
+	queueOperation(fd, data.offset / DSM_PAGESIZE, data.gid);
+
+	// Carry it out now if no granted write of the page is still unordered.
+	startOperations(data.offset / DSM_PAGESIZE);
+}
 
-		// Reset step to ready.
-		opqueue->step = STEP_READY;
+// Message waking waiters on a shared word. Sent on to other page holders.
+static void msg_notify (int fd, dsm_msg *mp) {
+	off_t offset = mp->payload.notify.offset;
+
+	// Verify the word lies within the shared region.
+	if (offset < 0 || offset >= DSM_SHM_NPAGES * DSM_PAGESIZE) {
+		dsm_cpanic("msg_notify", "Bad offset!");
 	}
+
+	// Waiters hold a copy of the page: Only their arbiters need the message.
+	send_copysetMsg(offset / DSM_PAGESIZE, fd, mp);
 }
 
-// Message indicating arbiter is waiting on a barrier.
+// Message indicating all processes of an arbiter wait on a barrier.
 static void msg_waitBarr (int fd, dsm_msg *mp) {
 
 	// Verify session has started.
@@ -338,11 +765,11 @@ static void msg_waitBarr (int fd, dsm_msg *mp) {
 	}
 
 	// If all processes are waiting, release and reset barrier.
-	if ((nproc_waiting += 1) >= nproc) {
+	if ((nproc_waiting += mp->payload.done.nproc) >= nproc) {
 
 		printf("[%d] Releasing barrier!\n", getpid());
 
-		// Release all.
+		// Release all: One message per arbiter.
 		send_simpleMsg(-1, MSG_WAIT_DONE);
 
 		// Reset barrier.
@@ -350,131 +777,1052 @@ static void msg_waitBarr (int fd, dsm_msg *mp) {
 	}
 }
 
-// Message indicating arbiter is exiting.
-static void msg_prgmDone (int fd, dsm_msg *mp) {
+// Message requesting a lock token. Recalls the token from its owner.
+static void msg_lockReq (int fd, dsm_msg *mp) {
+	unsigned int id = mp->payload.lock.id;
 
-	// Verify session has started.
-	if (started == 0) {
-		dsm_cpanic("msg_prgmDone", "Received out of order message!");
+	// Verify the lock exists.
+	if (id >= DSM_MAX_LOCKS) {
+		dsm_cpanic("msg_lockReq", "Bad lock identifier!");
 	}
 
-	// Close connection, remove from pollable set.
-	dsm_removePollable(fd, pollableSet);
-	close(fd);
+	// If the server holds the token, grant it outright.
+	if (lock_owner[id] == -1) {
+		lock_owner[id] = fd;
+		send_lockMsg(fd, MSG_LOCK_GRANT, id, 0);
+		return;
+	}
 
-	// If no more connections remain, destroy session.
-	alive = (pollableSet->fp > 1);
+	// Otherwise queue the arbiter, and recall the token once.
+	dsm_enqueueOpQueue(fd, lockqueue[id]);
+	if (lock_recalled[id] == 0) {
+		send_lockMsg(lock_owner[id], MSG_LOCK_RECALL, id, 0);
+		lock_recalled[id] = 1;
+	}
 }
 
+// Message returning a lock token. Passes it to the next queued arbiter.
+static void msg_lockRel (int fd, dsm_msg *mp) {
+	unsigned int id = mp->payload.lock.id;
 
-/*
- *******************************************************************************
- *                              Utility Functions                              *
- *******************************************************************************
-*/
-
+	// Verify the lock exists and belongs to the arbiter.
+	if (id >= DSM_MAX_LOCKS || lock_owner[id] != fd) {
+		dsm_cpanic("msg_lockRel", "Arbiter doesn't hold lock token!");
+	}
 
-// Returns length of match if substring is accepted. Otherwise returns zero.
-static int acceptSubstring (const char *substr, const char *str) {
-	int i;
-	for (i = 0; *substr != '\0' && *substr == *str; substr++, str++, i++)
-		;
-	return i * (*substr == '\0');
+	passLockToken(id);
 }
 
-// Parses arguments and sets pointers. Returns nonzero if full args given.
-static int parseArgs (int argc, const char *argv[], const char **sid_p, 
-	const char **addr_p, const char **port_p, unsigned int *nproc_p) {
-	const char *arg;
-	int n;
+// Message indicating a process has exited. Removes it from the copysets of
+// the pages of the worker. (Every worker is passed the message).
+static void msg_delProc (int fd, dsm_msg *mp) {
+	int g = mp->payload.proc.gid, page;
 
-	// Verify argument count.
-	if (argc != 2 && argc != 5) {
-		dsm_panicf("Bad arg count (%d). Format is: " DSM_ARG_FMT, argc);
+	// Verify the process belongs to the arbiter.
+	if (g < 0 || g >= nproc || gid_fd[g] != fd) {
+		dsm_cpanic("msg_delProc", "Unknown process!");
 	}
 
-	// Parse arguments.
-	while (--argc > 0) {
-		arg = *(++argv);
-
-		if (*sid_p == NULL && (n = acceptSubstring("-sid=", arg)) != 0) {
-			*sid_p = arg + n;
-			continue;
-		}
-
-		if (*addr_p == NULL && (n = acceptSubstring("-addr=", arg)) != 0) {
-			*addr_p = arg + n;
-			continue;
-		}
-
-		if (*port_p == NULL && (n = acceptSubstring("-port=", arg)) != 0) {
-			*port_p = arg + n;
-			continue;
+	// Updates ordered while it held their page expect one ack less, unless
+	// its arbiter had applied them: Their acks count it (sent or not yet).
+	// Updates of a page are numbered in order.
+	for (int i = 0; i < updates_length; i++) {
+		if (updates[i].ordered &&
+			updates[i].seq > mp->payload.proc.seq[updates[i].page]) {
+			updates[i].expected -= copyset[updates[i].page * nproc + g];
 		}
+	}
 
-		if (*nproc_p == -1 && (n = acceptSubstring("-nproc=", arg)) != 0) {
-			if (sscanf(arg + n, "%u", nproc_p) == 1) {
-				continue;
-			}
+	// Remove from the copysets.
+	for (page = 0; page < DSM_SHM_NPAGES; page++) {
+		if (getPageWorker(page) == worker) {
+			copyset[page * nproc + g] = 0;
 		}
-
-		dsm_panicf("Unknown/duplicate argument: \"%s\". Format is: "
-			DSM_ARG_FMT, arg);
 	}
 
-	// Ensure -nproc wasn't optional.
-	if (*nproc_p == -1) {
-		dsm_panicf("Required argument missing \"-nproc=<nproc>\"");
+	// Complete those it was the last to acknowledge. (Completing moves the
+	// last update to i: Walk down the array).
+	for (int i = updates_length - 1; i >= 0; i--) {
+		checkUpdate(updates + i);
 	}
+}
 
-	// Ensure -nproc is >= 2.
-	if (*nproc_p < 2) {
-		dsm_cpanic("Invalid input!", "-nproc must be >= 2");
+// Message registering the peer listener address of an arbiter.
+static void msg_addPeer (int fd, dsm_msg *mp) {
+
+	// Ensure this message isn't received after the session has started.
+	if (started == 1) {
+		dsm_cpanic("msg_addPeer", "Received out of order message!");
 	}
 
-	return (*sid_p && *addr_p && *port_p && *nproc_p != -1);
+	// Record the address. The arbiter is known to peers by its fd here.
+	*getPeer(fd) = mp->payload.peer;
+	peers[fd].id = fd;
 }
 
-// Accepts incoming connection, and updates the list of pollable descriptors.
-static void processConnection (int sock_listen) {
-	struct sockaddr_storage newAddr;
-	socklen_t newAddrSize = sizeof(newAddr);
-	int sock_new;
+// Message indicating arbiter is exiting.
+static void msg_prgmDone (int fd, dsm_msg *mp) {
 
-	// Try accepting connection.
-	if ((sock_new = accept(sock_listen, (struct sockaddr *)&newAddr, 
-		&newAddrSize)) == -1) {
-		dsm_panic("Couldn't accept connection!");
+	// Verify session has started.
+	if (started == 0) {
+		dsm_cpanic("msg_prgmDone", "Received out of order message!");
 	}
 
-	// Register connection in pollable descriptor list.
-	dsm_setPollable(sock_new, POLLIN, pollableSet);
+	// Close connection, remove from pollable set.
+	dsm_removePollable(fd, pollableSet);
+	dsm_dropmsgs(fd);
+	close(fd);
+
+	// Remove it from the tree. (Its children have exited before it). Workers
+	// name it to writers only while its processes hold pages.
+	for (int i = 0; i < tree_length; i++) {
+		if (tree[i] == fd) {
+			tree[i] = -1;
+		}
+	}
+
+	// Pass on any lock tokens the arbiter still held.
+	for (unsigned int id = 0; id < DSM_MAX_LOCKS; id++) {
+		if (lock_owner[id] == fd) {
+			passLockToken(id);
+		}
+	}
+
+	// The workers take back its write tokens.
+	for (int i = 0; i < nworkers; i++) {
+		putJob(workers + i, fd, mp);
+	}
+
+	// If no more connections remain (but listener and eventfd), destroy
+	// session.
+	alive = (pollableSet->fp > 2);
 }
 
-// Reads message from fd. Decodes and selects appropriate action.
-static void processMessage (int fd) {
+// Message about a page (or an update of one). Passed to the worker owning
+// the page. Every worker is passed process exits.
+static void msg_forward (int fd, dsm_msg *mp) {
+	off_t offset;
+
+	// Ensure session started.
+	if (started == 0) {
+		dsm_cpanic("msg_forward", "Received out of order message!");
+	}
+
+	// Find the page of the message.
+	switch (mp->type) {
+		case MSG_PAGE_REQ:
+			offset = mp->payload.page.offset;
+			break;
+		case MSG_ATOMIC_REQ:
+			offset = mp->payload.atomic.offset;
+			break;
+		case MSG_NOTIFY:
+			offset = mp->payload.notify.offset;
+			break;
+		case MSG_SYNC_REQ:
+		case MSG_SYNC_INFO:
+		case MSG_WRITE_REL:
+			offset = mp->payload.sync.offset;
+			break;
+
+		// Acknowledgements go to the worker that took the sequence number.
+		case MSG_SYNC_DONE:
+			if (mp->payload.done.seq == 0 ||
+				(mp->payload.done.seq - 1) % nparts != part) {
+				dsm_cpanic("msg_forward", "Bad sequence number!");
+			}
+			putJob(workers + ((mp->payload.done.seq - 1) / nparts) % nworkers,
+				fd, mp);
+			return;
+
+		// Exits concern the pages of all workers.
+		default:
+			for (int i = 0; i < nworkers; i++) {
+				putJob(workers + i, fd, mp);
+			}
+			return;
+	}
+
+	// Verify the offset lies within the shared region, and the partition.
+	if (offset < 0 || offset >= DSM_SHM_NPAGES * DSM_PAGESIZE ||
+		dsm_getPagePart(offset / DSM_PAGESIZE, nparts) != part) {
+		dsm_cpanic("msg_forward", "Bad offset!");
+	}
+
+	putJob(getPageWorker(offset / DSM_PAGESIZE), fd, mp);
+}
+
+
+/*
+ *******************************************************************************
+ *                              Utility Functions                              *
+ *******************************************************************************
+*/
+
+
+// Passes lock token 'id' to the next queued arbiter, or back to the server.
+static void passLockToken (unsigned int id) {
+
+	// If nobody is waiting, the token returns home.
+	if (dsm_isOpQueueEmpty(lockqueue[id])) {
+		lock_owner[id] = -1;
+		lock_recalled[id] = 0;
+		return;
+	}
+
+	// Otherwise grant it, pre-recalled if more arbiters are waiting.
+	lock_owner[id] = dsm_dequeueOpQueue(lockqueue[id]);
+	lock_recalled[id] = !dsm_isOpQueueEmpty(lockqueue[id]);
+	send_lockMsg(lock_owner[id], MSG_LOCK_GRANT, id, lock_recalled[id]);
+}
+
+// Grants the next write of page to the arbiter of its last writer ahead of a
+// request. The arbiter keeps it as a write token until used or recalled.
+static void grantToken (int writer, int page) {
+	dsm_update *u = addUpdate(writer, page, -1);
+	dsm_msg msg;
+
+	// No push list: The server relays the update to all other holders.
+	u->token = 1;
+	memset(&msg, 0, sizeof(msg));
+	msg.type = MSG_WRITE_OKAY;
+	msg.payload.sync.offset = page * DSM_PAGESIZE;
+	msg.payload.sync.seq = u->seq;
+	msg.payload.sync.prev = u->prev;
+	msg.payload.sync.token = 1;
+	postMsg(writer, &msg);
+	opqueues[page]->step = STEP_WAITING_SYNC_INFO;
+}
+
+// Takes back the unused write token of update u. Starts the queued operations.
+static void releaseToken (dsm_update *u) {
+	int page = u->page;
+
+	// The page's last update is again the one before.
+	page_seq[page] = u->prev;
+	*u = updates[--updates_length];
+
+	opqueues[page]->step = STEP_READY;
+	startOperations(page);
+}
+
+// Applies the atomic operation of update u to the home copy and pushes the
+// result.
+static void applyAtomic (dsm_update *u) {
+	dsm_msg_atomic *ap = atomics + u->g;
+	int *word = (int *)(pages + ap->offset), old = *word;
+	dsm_msg msg;
+
+	// Apply operation to the home copy.
+	switch (ap->op) {
+		case ATOMIC_FETCH_ADD: *word = old + ap->value; break;
+		case ATOMIC_CAS: *word = (old == ap->expected ? ap->value : old); break;
+		case ATOMIC_EXCHANGE: *word = ap->value; break;
+		default: dsm_cpanic("applyAtomic", "Unknown operation!");
+	}
+
+	// The reply carries the old value.
+	ap->value = old;
+
+	// The update is ordered. Expect an ack from every holder, but only if the
+	// word changed: Otherwise the page keeps its last update.
+	u->ordered = 1;
+	page_writer[u->page] = -1;
+	if (*word == old) {
+		page_seq[u->page] = u->prev;
+		checkUpdate(u);
+		return;
+	}
+	u->expected = countCopyset(u->page, -1);
+	home_seq[u->page] = u->seq;
+
+	// Push the new word to all arbiters with holders of the page.
+	memset(&msg, 0, sizeof(msg));
+	msg.type = MSG_SYNC_INFO;
+	msg.payload.sync.offset = ap->offset;
+	msg.payload.sync.size = msg.size = sizeof(int);
+	msg.payload.sync.seq = u->seq;
+	msg.payload.sync.prev = u->prev;
+	msg.data = word;
+	send_copysetMsg(u->page, -1, &msg);
+
+	// Completes the operation if there are no holders to wait for.
+	checkUpdate(u);
+}
+
+// Adds an update of page by writer (atomic if g != -1), chained to the last
+// update of the page. Returns the update.
+static dsm_update *addUpdate (int writer, int page, int g) {
+	dsm_update *u;
+
+	// Grow the array as needed.
+	if (updates_length >= updates_size) {
+		updates_size = MAX(DSM_MIN_UPDATES, 2 * updates_size);
+		if ((updates = realloc(updates, updates_size * sizeof(dsm_update))) 
+			== NULL) {
+			dsm_panic("Couldn't grow update array!");
+		}
+	}
+
+	// Chain the update to the last of the page. Sequence numbers are unique
+	// over servers and workers: Server k takes those equal to k + 1 modulo
+	// nparts, and its worker i every nworkers-th of those from the i-th.
+	u = updates + updates_length++;
+	memset(u, 0, sizeof(*u));
+	u->seq = (seq_taken++ * nworkers + worker->id) * nparts + part + 1;
+	u->prev = page_seq[page];
+	u->writer = writer;
+	u->g = g;
+	u->page = page;
+	page_seq[page] = u->seq;
+
+	return u;
+}
+
+// Returns the update with sequence number seq. Returns NULL if none.
+static dsm_update *getUpdate (unsigned int seq) {
+	for (int i = 0; i < updates_length; i++) {
+		if (updates[i].seq == seq) {
+			return updates + i;
+		}
+	}
+	return NULL;
+}
+
+// Returns the granted update of page awaiting its sync info. Returns NULL if
+// none.
+static dsm_update *getGrantedUpdate (int page) {
+	for (int i = 0; i < updates_length; i++) {
+		if (updates[i].ordered == 0 && updates[i].page == page) {
+			return updates + i;
+		}
+	}
+	return NULL;
+}
+
+// Completes update u if it is ordered and acknowledged by all holders.
+static void checkUpdate (dsm_update *u) {
+	dsm_msg msg;
+
+	if (u->ordered == 0 || u->synced < u->expected) {
+		return;
+	}
+
+	// Inform the writer's arbiter that the update is visible everywhere.
+	if (u->g == -1) {
+		memset(&msg, 0, sizeof(msg));
+		msg.type = MSG_CONT_ALL;
+		msg.payload.done.seq = u->seq;
+		postMsg(u->writer, &msg);
+	} else {
+		send_atomicDone(u->writer, u->g);
+	}
+
+	// Remove it: The last update takes its place.
+	*u = updates[--updates_length];
+}
+
+// Returns the peer table entry of fd. Grows the table as needed.
+static dsm_msg_peer *getPeer (int fd) {
+	dsm_msg_peer *new_peers;
+	int new_length;
+
+	if (fd >= peers_length) {
+		new_length = MAX(fd + 1, 2 * peers_length);
+		new_peers = dsm_zalloc(new_length * sizeof(dsm_msg_peer));
+		memcpy(new_peers, peers, peers_length * sizeof(dsm_msg_peer));
+		free(peers);
+		peers = new_peers;
+		peers_length = new_length;
+	}
+
+	return peers + fd;
+}
+
+// Returns nonzero if update u is pushed to fd.
+static int isPushed (dsm_update *u, int fd) {
+	for (int i = 0; i < u->npushed; i++) {
+		if (u->pushed[i] == fd) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+// Queues operation of 'fd' on page (atomic if g != -1). Notes the depth.
+static void queueOperation (int fd, int page, int g) {
+	dsm_enqueueOpQueue(fd, opqueues[page]);
+	dsm_enqueueOpQueue(g, atomicqueues[page]);
+	queue_ops[page]++;
+	queue_depth[page] = MAX(queue_depth[page],
+		dsm_getOpQueueLength(opqueues[page]));
+}
+
+// Prints the operations queued on each page, and its deepest queue.
+static void showPageQueues (void) {
+	printf("[%d] Page queues:\n", getpid());
+	for (int page = 0; page < DSM_SHM_NPAGES; page++) {
+		if (queue_ops[page] > 0) {
+			printf("\tpage %d: ops = %lu, max depth = %u\n", page,
+				queue_ops[page], queue_depth[page]);
+		}
+	}
+}
+
+// Returns the tree link of the arbiter at index j to that at index i.
+static dsm_treeLink getTreeLink (int i, int j) {
+	if (i >= fanout && j == i / fanout - 1) {
+		return TREE_PARENT;
+	}
+	if (j >= fanout && i == j / fanout - 1) {
+		return TREE_CHILD;
+	}
+	return TREE_NONE;
+}
+
+// Returns the worker owning page: The pages are split in nworkers ranges.
+static dsm_worker *getPageWorker (int page) {
+	return workers + page * nworkers / DSM_SHM_NPAGES;
+}
+
+// Returns the number of page holders. If fd >= 0, counts only those at fd.
+static unsigned int countCopyset (int page, int fd) {
+	unsigned int n = 0;
+
+	for (int g = 0; g < nproc; g++) {
+		n += (copyset[page * nproc + g] && (fd < 0 || gid_fd[g] == fd));
+	}
+
+	return n;
+}
+
+// Returns nonzero if g holds page, and no holder at its arbiter has a lower
+// gid: Each arbiter with holders is then visited once.
+static int isFirstHolder (int page, int g) {
+	if (copyset[page * nproc + g] == 0) {
+		return 0;
+	}
+	for (int h = 0; h < g; h++) {
+		if (copyset[page * nproc + h] && gid_fd[h] == gid_fd[g]) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+
+// Returns length of match if substring is accepted. Otherwise returns zero.
+static int acceptSubstring (const char *substr, const char *str) {
+	int i;
+	for (i = 0; *substr != '\0' && *substr == *str; substr++, str++, i++)
+		;
+	return i * (*substr == '\0');
+}
+
+// Parses arguments and sets pointers. Returns nonzero if full args given.
+static int parseArgs (int argc, const char *argv[], const char **sid_p, 
+	const char **addr_p, const char **port_p, unsigned int *nproc_p) {
+	const char *arg, *loop = NULL, *fan = NULL, *work = NULL, *prt = NULL;
+	int n;
+
+	// Verify argument count.
+	if (argc < 2 || argc > 9) {
+		dsm_panicf("Bad arg count (%d). Format is: " DSM_ARG_FMT, argc);
+	}
+
+	// Parse arguments.
+	while (--argc > 0) {
+		arg = *(++argv);
+
+		if (*sid_p == NULL && (n = acceptSubstring("-sid=", arg)) != 0) {
+			*sid_p = arg + n;
+			continue;
+		}
+
+		if (*addr_p == NULL && (n = acceptSubstring("-addr=", arg)) != 0) {
+			*addr_p = arg + n;
+			continue;
+		}
+
+		if (*port_p == NULL && (n = acceptSubstring("-port=", arg)) != 0) {
+			*port_p = arg + n;
+			continue;
+		}
+
+		if (*nproc_p == -1 && (n = acceptSubstring("-nproc=", arg)) != 0) {
+			if (sscanf(arg + n, "%u", nproc_p) == 1) {
+				continue;
+			}
+		}
+
+		if (loop == NULL && (n = acceptSubstring("-loop=", arg)) != 0) {
+			loop = arg + n;
+			if (strcmp(loop, "poll") == 0 || strcmp(loop, "uring") == 0) {
+				withUring = (strcmp(loop, "uring") == 0);
+				continue;
+			}
+		}
+
+		if (fan == NULL && (n = acceptSubstring("-fanout=", arg)) != 0) {
+			fan = arg + n;
+			if (sscanf(fan, "%u", &fanout) == 1 && fanout > 0) {
+				continue;
+			}
+		}
+
+		if (work == NULL && (n = acceptSubstring("-workers=", arg)) != 0) {
+			work = arg + n;
+			if (sscanf(work, "%u", &nworkers) == 1 && nworkers > 0 &&
+				nworkers <= DSM_MAX_WORKERS) {
+				continue;
+			}
+		}
+
+		if (prt == NULL && (n = acceptSubstring("-part=", arg)) != 0) {
+			prt = arg + n;
+			if (sscanf(prt, "%u/%u", &part, &nparts) == 2 && part < nparts &&
+				nparts <= DSM_MAX_SERVERS) {
+				continue;
+			}
+		}
+
+		dsm_panicf("Unknown/duplicate argument: \"%s\". Format is: "
+			DSM_ARG_FMT, arg);
+	}
+
+	// Ensure -nproc wasn't optional.
+	if (*nproc_p == -1) {
+		dsm_panicf("Required argument missing \"-nproc=<nproc>\"");
+	}
+
+	// Ensure -nproc is >= 2.
+	if (*nproc_p < 2) {
+		dsm_cpanic("Invalid input!", "-nproc must be >= 2");
+	}
+
+	// Ensure daemon details are given together.
+	if ((*sid_p || *addr_p || *port_p) && !(*sid_p && *addr_p && *port_p)) {
+		dsm_panicf("Incomplete daemon details. Format is: " DSM_ARG_FMT);
+	}
+
+	return (*sid_p && *addr_p && *port_p && *nproc_p != -1);
+}
+
+// Updates the poll events of fd. Called when its queued output changes.
+static void setPollEvents (int fd, short events) {
+	dsm_setPollable(fd, events, pollableSet);
+}
+
+// Accepts incoming connection, and updates the list of pollable descriptors.
+static void processConnection (int sock_listen) {
+	struct sockaddr_storage newAddr;
+	socklen_t newAddrSize = sizeof(newAddr);
+	int sock_new;
+
+	// Try accepting connection.
+	if ((sock_new = accept(sock_listen, (struct sockaddr *)&newAddr, 
+		&newAddrSize)) == -1) {
+		dsm_panic("Couldn't accept connection!");
+	}
+
+	// Register connection in pollable descriptor list. Never block on it.
+	dsm_setNonBlocking(sock_new);
+	dsm_setPollable(sock_new, POLLIN, pollableSet);
+}
+
+// Decodes and handles each complete message received on fd.
+static void dispatchMessages (int fd) {
 	dsm_msg msg;
 	void (*action)(int, dsm_msg *);
-	
-	printf("[%d] Receiving message...\n", getpid());
 
-	// Read in message: If no connection -> Panic.
-	if (dsm_recvall(fd, &msg, sizeof(msg)) != 0) {
+	// Handle each complete message. (A handler closing fd drops its input).
+	while (dsm_nextmsg(fd, &msg)) {
+
+		// Determine action based on message type.
+		if ((action = dsm_getMsgFunc(msg.type, fmap)) == NULL) {
+			dsm_warning("No action for message type!");
+			dsm_removePollable(fd, pollableSet);
+			dsm_dropmsgs(fd);
+			close(fd);
+			return;
+		}
+
+		// Execute action.
+		action(fd, &msg);
+	}
+}
+
+// Reads available input from fd. Decodes and handles each complete message.
+static void processMessage (int fd) {
+
+	// Read in available input: If no connection -> Panic.
+	if (dsm_fillmsgs(fd) != 0) {
 		dsm_cpanic("Foreign host closed their socket!", "Imminent deadlock!");
 	}
 
-	printf("[%d] Received!\n", getpid());
+	// Handle complete messages.
+	dispatchMessages(fd);
+}
+
+
+/*
+ *******************************************************************************
+ *                              Worker Functions                               *
+ *******************************************************************************
+*/
+
+
+// Returns a job with a copy of message mp (and its data), from or to fd.
+static dsm_job *newJob (int fd, dsm_msg *mp) {
+	dsm_job *jp;
+
+	if ((jp = malloc(sizeof(dsm_job) + mp->size)) == NULL) {
+		dsm_panic("Couldn't allocate job!");
+	}
+	jp->fd = fd;
+	jp->msg = *mp;
+	jp->msg.data = NULL;
+
+	// The data follows the job.
+	if (mp->size > 0) {
+		jp->msg.data = jp + 1;
+		memcpy(jp->msg.data, mp->data, mp->size);
+	}
+
+	return jp;
+}
+
+// Passes a copy of message mp from fd to worker w. Wakes it if it waits.
+static void putJob (dsm_worker *w, int fd, dsm_msg *mp) {
+	dsm_mpscPut(&w->inbox, &newJob(fd, mp)->node);
+
+	// Order the put before the check (the worker does the reverse).
+	if (__atomic_exchange_n(&w->sleeping, 0, __ATOMIC_SEQ_CST) != 0) {
+		dsm_futexWake(&w->sleeping, 1);
+	}
+}
+
+// Posts a copy of message mp to fd. The I/O thread sends it. (Workers only).
+static void postMsg (int fd, dsm_msg *mp) {
+	dsm_mpscPut(&outbox, &newJob(fd, mp)->node);
+	posted++;
+}
+
+// Queues the messages posted by the workers. Those to connections closed
+// since are dropped.
+static void sendPosted (void) {
+	dsm_job *jp;
+
+	while ((jp = (dsm_job *)dsm_mpscGet(&outbox)) != NULL) {
+		if (dsm_isPollable(jp->fd, pollableSet)) {
+			dsm_queuemsg(jp->fd, &jp->msg);
+		}
+		free(jp);
+	}
+}
+
+// Waits until a job is passed to worker w.
+static void waitJobs (dsm_worker *w) {
+
+	// Order the flag before the check (putJob does the reverse).
+	__atomic_store_n(&w->sleeping, 1, __ATOMIC_SEQ_CST);
+	while (dsm_isMpscEmpty(&w->inbox) && 
+		__atomic_load_n(&w->sleeping, __ATOMIC_SEQ_CST) != 0) {
+		dsm_futexWait(&w->sleeping, 1);
+	}
+	__atomic_store_n(&w->sleeping, 0, __ATOMIC_SEQ_CST);
+}
+
+// Runs a worker: Handles the messages passed to it, until passed one without
+// type. Wakes the I/O thread once per batch, to send the replies.
+static void *runWorker (void *arg) {
+	void (*action)(int, dsm_msg *);
+	int running = 1;
+	dsm_job *jp;
+
+	// Set up the state of the worker.
+	worker = (dsm_worker *)arg;
+
+	while (running) {
+
+		// Handle all passed messages.
+		while (running && (jp = (dsm_job *)dsm_mpscGet(&worker->inbox)) 
+			!= NULL) {
+			if (jp->msg.type == MSG_MIN_VALUE) {
+				running = 0;
+			} else if ((action = dsm_getMsgFunc(jp->msg.type, wmap)) != NULL) {
+				action(jp->fd, &jp->msg);
+			}
+			free(jp);
+		}
+
+		// Wake the I/O thread for the replies.
+		if (posted > 0) {
+			eventfd_write(wake_efd, 1);
+			posted = 0;
+		}
+
+		if (running) {
+			waitJobs(worker);
+		}
+	}
+
+	// Clean up.
+	for (int i = 0; i < updates_length; i++) {
+		free(updates[i].pushed);
+	}
+	free(updates);
+
+	return NULL;
+}
+
+// Starts the workers. From then on, they own the pages.
+static void startWorkers (void) {
+
+	// Start the threads.
+	workers = dsm_zalloc(nworkers * sizeof(dsm_worker));
+	for (int i = 0; i < nworkers; i++) {
+		workers[i].id = i;
+		dsm_initMpsc(&workers[i].inbox);
+		if ((errno = pthread_create(&workers[i].thread, NULL, runWorker,
+			workers + i)) != 0) {
+			dsm_panic("Couldn't create worker thread!");
+		}
+	}
+}
+
+// Stops the workers, and waits for them to exit.
+static void stopWorkers (void) {
+	dsm_msg msg;
+
+	// Pass each a message without type.
+	memset(&msg, 0, sizeof(msg));
+	for (int i = 0; i < nworkers; i++) {
+		putJob(workers + i, -1, &msg);
+	}
+	for (int i = 0; i < nworkers; i++) {
+		pthread_join(workers[i].thread, NULL);
+	}
+
+	// Drop their last messages: The connections are closed.
+	sendPosted();
+
+	free(workers);
+}
+
+
+/*
+ *******************************************************************************
+ *                            Event Loop Functions                             *
+ *******************************************************************************
+*/
+
+
+// Polls connections, and handles their messages until the session ends.
+static void pollLoop (void) {
+	struct pollfd *pfd;
+	int new;
+
+	// Poll while no errors and no exit 
+	while (alive && (new = dsm_poll(pollableSet, -1)) != -1) {
+		
+		for (int i = 0; i < new; i++) {
+			pfd = pollableSet->ready + i;
+
+			// If nothing to read, ignore file-descriptor.
+			if ((pfd->revents & POLLIN) == 0) {
+				continue;
+			}
+
+			// If eventfd: Clear it, and queue what the workers posted.
+			if (pfd->fd == wake_efd) {
+				eventfd_read(wake_efd, &(eventfd_t){0});
+				sendPosted();
+				continue;
+			}
+
+			// If listenr socket: Accept connection.
+			if (pfd->fd == sock_listen) {
+				processConnection(sock_listen);
+			} else {
+				processMessage(pfd->fd);
+			}
+		}
+
+		// Send all messages of this round: One send per connection.
+		dsm_flushmsgs();
+	}
+}
+
+// Returns the io_uring state of fd. Grows the table as needed.
+static dsm_uring_conn *getUringConn (int fd) {
+	dsm_uring_conn *new_conns;
+	int new_length;
+
+	if (fd >= uring_conns_length) {
+		new_length = MAX(fd + 1, 2 * uring_conns_length);
+		new_conns = dsm_zalloc(new_length * sizeof(dsm_uring_conn));
+		memcpy(new_conns, uring_conns, 
+			uring_conns_length * sizeof(dsm_uring_conn));
+		free(uring_conns);
+		uring_conns = new_conns;
+		uring_conns_length = new_length;
+	}
 
-	// Determine action based on message type.
-	if ((action = dsm_getMsgFunc(msg.type, fmap)) == NULL) {
-		dsm_warning("No action for message type!");
-		dsm_removePollable(fd, pollableSet);
-		close(fd);
+	return uring_conns + fd;
+}
+
+// Returns the user data of request 'op' on fd: [op:8|gen:24|fd:32].
+static uint64_t getUringData (dsm_uring_op op, int fd) {
+	return ((uint64_t)op << 56) | 
+		((uint64_t)(getUringConn(fd)->gen & 0xFFFFFF) << 32) | (uint32_t)fd;
+}
+
+// Arms a multishot accept on the listener socket.
+static void armAccept (void) {
+	struct io_uring_sqe *sqe = dsm_getUringSqe(&ring);
+
+	sqe->opcode = IORING_OP_ACCEPT;
+	sqe->fd = sock_listen;
+	sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+	sqe->user_data = getUringData(URING_ACCEPT, sock_listen);
+}
+
+// Arms a read of the wake-up eventfd: Workers posted messages once it ends.
+static void armWake (void) {
+	struct io_uring_sqe *sqe = dsm_getUringSqe(&ring);
+
+	sqe->opcode = IORING_OP_READ;
+	sqe->fd = wake_efd;
+	sqe->addr = (unsigned long)&wake_count;
+	sqe->len = sizeof(wake_count);
+	sqe->user_data = getUringData(URING_WAKE, wake_efd);
+}
+
+// Arms a multishot receive into provided buffers on fd (if none is armed).
+static void armReceive (int fd) {
+	dsm_uring_conn *c = getUringConn(fd);
+	struct io_uring_sqe *sqe;
+
+	if (c->receiving) {
+		return;
+	}
+	sqe = dsm_getUringSqe(&ring);
+	sqe->opcode = IORING_OP_RECV;
+	sqe->fd = fd;
+	sqe->ioprio = IORING_RECV_MULTISHOT;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = DSM_URING_BGID;
+	sqe->user_data = getUringData(URING_RECV, fd);
+	c->receiving = 1;
+}
+
+// Cancels the armed receive on fd. It ends with its last completion.
+static void cancelReceive (int fd) {
+	struct io_uring_sqe *sqe;
+
+	if (getUringConn(fd)->receiving == 0) {
 		return;
 	}
+	sqe = dsm_getUringSqe(&ring);
+	sqe->opcode = IORING_OP_ASYNC_CANCEL;
+	sqe->fd = -1;
+	sqe->addr = getUringData(URING_RECV, fd);
+	sqe->user_data = getUringData(URING_CANCEL, fd);
+}
+
+// Sends the rest of the taken output of fd.
+static void submitSend (int fd) {
+	dsm_uring_conn *c = getUringConn(fd);
+	struct io_uring_sqe *sqe = dsm_getUringSqe(&ring);
+
+	sqe->opcode = IORING_OP_SEND;
+	sqe->fd = fd;
+	sqe->addr = (unsigned long)(c->out.buf + c->out.head);
+	sqe->len = c->out.length - c->out.head;
+	sqe->msg_flags = MSG_NOSIGNAL;
+	sqe->user_data = getUringData(URING_SEND, fd);
+	c->sending = 1;
+}
+
+// Pauses receiving on fd while its output exceeds DSM_MSG_MAX_QUEUED 
+// (backpressure), and resumes it once the output drains.
+static void updatePressure (int fd) {
+	dsm_uring_conn *c = getUringConn(fd);
+	size_t pending = c->out.length - c->out.head + dsm_pendingmsgs(fd);
+
+	if (c->paused == 0 && pending > DSM_MSG_MAX_QUEUED) {
+		c->paused = 1;
+		cancelReceive(fd);
+	} else if (c->paused != 0 && pending <= DSM_MSG_MAX_QUEUED) {
+		c->paused = 0;
+		armReceive(fd);
+	}
+}
+
+// Submits a send for each connection with queued output (and no send in
+// flight). Sends are only submitted with the next dsm_submitUring.
+static void submitSends (void) {
+	dsm_uring_conn *c;
+	const int *fds;
+	int fd;
+
+	// Taking unlists fd, moving the last entry to i: Walk down the list.
+	for (int i = dsm_activemsgs(&fds) - 1; i >= 0; i--) {
+		fd = fds[i];
+		c = getUringConn(fd);
+		if (c->sending == 0 && dsm_takemsgs(fd, &c->out) > 0) {
+			submitSend(fd);
+		}
+		updatePressure(fd);
+	}
+}
+
+// Forgets fd after a handler closed it. Late completions of its requests
+// carry the old generation, and are ignored.
+static void closeUringConn (int fd) {
+	dsm_uring_conn *c = getUringConn(fd);
 
-	// Execute action.
-	action(fd, &msg);
+	cancelReceive(fd);
+	c->gen++;
+	c->receiving = c->paused = 0;
+}
+
+// Handles a completion of the io_uring event loop.
+static void processCompletion (struct io_uring_cqe *cqe) {
+	dsm_uring_op op = cqe->user_data >> 56;
+	int fd = (int)(cqe->user_data & 0xFFFFFFFF);
+	unsigned int gen = (cqe->user_data >> 32) & 0xFFFFFF;
+	dsm_uring_conn *c = getUringConn(fd);
+	int stale = (gen != (c->gen & 0xFFFFFF)), bid = -1;
+
+	// Cancellations need no handling.
+	if (op == URING_CANCEL) {
+		return;
+	}
+
+	// Workers posted messages: Queue them, and wait for more.
+	if (op == URING_WAKE) {
+		if (cqe->res < 0) {
+			errno = -cqe->res;
+			dsm_panic("Syscall error on eventfd read!");
+		}
+		sendPosted();
+		armWake();
+		return;
+	}
+
+	// Accepted connection: Register it, and start receiving.
+	if (op == URING_ACCEPT) {
+		if (cqe->res < 0) {
+			errno = -cqe->res;
+			dsm_panic("Couldn't accept connection!");
+		}
+		dsm_setPollable(cqe->res, POLLIN, pollableSet);
+		armReceive(cqe->res);
+		if ((cqe->flags & IORING_CQE_F_MORE) == 0) {
+			armAccept();
+		}
+		return;
+	}
+
+	// Completed send: Continue with the rest, or release the buffer.
+	if (op == URING_SEND) {
+		c->sending = 0;
+		if (stale) {
+			c->out.head = c->out.length = 0;
+			return;
+		}
+		if (cqe->res < 0) {
+			errno = -cqe->res;
+			dsm_panic("Syscall error on send!");
+		}
+		dsm_counters.bytes_sent += cqe->res;
+		if ((c->out.head += cqe->res) == c->out.length) {
+			c->out.head = c->out.length = 0;
+		} else {
+			submitSend(fd);
+		}
+		updatePressure(fd);
+		return;
+	}
+
+	// Received data: Copy out, and return the buffer at once.
+	if (cqe->flags & IORING_CQE_F_BUFFER) {
+		bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+		if (stale == 0 && cqe->res > 0) {
+			dsm_putmsgs(fd, dsm_getUringBuf(&ring, bid), cqe->res);
+		}
+		dsm_putUringBuf(&ring, bid);
+	}
+	if (stale) {
+		return;
+	}
+
+	// Receive ended: Re-armed below unless paused.
+	if ((cqe->flags & IORING_CQE_F_MORE) == 0) {
+		c->receiving = 0;
+	}
+
+	// Check if socket is closed, or failed.
+	if (cqe->res == 0) {
+		dsm_cpanic("Foreign host closed their socket!", "Imminent deadlock!");
+	}
+	if (cqe->res < 0 && cqe->res != -ENOBUFS && cqe->res != -ECANCELED) {
+		errno = -cqe->res;
+		dsm_panic("Syscall error on recv!");
+	}
+
+	// Handle complete messages. Forget fd if a handler closed it.
+	if (cqe->res > 0) {
+		dispatchMessages(fd);
+		if (dsm_isPollable(fd, pollableSet) == 0) {
+			closeUringConn(fd);
+			return;
+		}
+	}
+
+	// Keep receiving.
+	if (c->receiving == 0 && c->paused == 0) {
+		armReceive(fd);
+	}
+}
+
+// Handles connections and messages with io_uring until the session ends.
+// Multishot accept and receive need no syscalls of their own, and all sends
+// of a cycle are submitted together: One kernel entry per cycle.
+static void uringLoop (void) {
+	struct io_uring_cqe *cqe, c;
+
+	// Setup ring, provided receive buffers, and accept connections.
+	if (dsm_initUring(&ring, DSM_URING_ENTRIES) != 0) {
+		dsm_cpanic("Couldn't set up io_uring!", "Use -loop=poll");
+	}
+	dsm_initUringBufs(&ring, DSM_URING_NBUFS, DSM_URING_BUFSIZE, 
+		DSM_URING_BGID);
+	armAccept();
+	armWake();
+
+	while (alive) {
+
+		// Submit the sends of the last cycle, and wait for a completion.
+		submitSends();
+		dsm_submitUring(&ring, 1);
+
+		// Handle all completions.
+		while ((cqe = dsm_peekUring(&ring)) != NULL) {
+			c = *cqe;
+			dsm_seenUring(&ring);
+			processCompletion(&c);
+		}
+	}
+
+	// Tear down ring (cancels all requests), then free send buffers.
+	dsm_freeUring(&ring);
+	for (int i = 0; i < uring_conns_length; i++) {
+		free(uring_conns[i].out.buf);
+	}
+	free(uring_conns);
 }
 
 
@@ -486,34 +1834,78 @@ static void processMessage (int fd) {
 
 
 int main (int argc, const char *argv[]) {
-	int new = 0;							// New count (for poll syscall).
 	int withDaemon = 0;						// Boolean (should contact daemon?)
 	const char *sid = NULL;					// Session-identifier.
 	const char *addr = NULL;				// Daemon address.
 	const char *port = NULL;				// Daemon port.
-	struct pollfd *pfd;						// Pointer to poll structure.
 	
 	// ------------------------------ Setup -----------------------------------
 
 	// Verify and parse arguments.
 	withDaemon = parseArgs(argc, argv, &sid, &addr, &port, &nproc);
 
-	// Set functions.
+	// Set functions. Messages about pages are forwarded to the workers.
 	if (dsm_setMsgFunc(MSG_ADD_PROC, msg_addProc, fmap) != 0 ||
-		dsm_setMsgFunc(MSG_SYNC_REQ, msg_syncRequest, fmap) != 0 ||
-		dsm_setMsgFunc(MSG_STOP_DONE, msg_stopDone, fmap) != 0 ||
-		dsm_setMsgFunc(MSG_SYNC_INFO, msg_syncInfo, fmap) != 0 ||
-		dsm_setMsgFunc(MSG_SYNC_DONE, msg_syncDone, fmap) != 0 ||
+		dsm_setMsgFunc(MSG_SYNC_REQ, msg_forward, fmap) != 0 ||
+		dsm_setMsgFunc(MSG_PAGE_REQ, msg_forward, fmap) != 0 ||
+		dsm_setMsgFunc(MSG_DEL_PROC, msg_forward, fmap) != 0 ||
+		dsm_setMsgFunc(MSG_SYNC_INFO, msg_forward, fmap) != 0 ||
+		dsm_setMsgFunc(MSG_WRITE_REL, msg_forward, fmap) != 0 ||
+		dsm_setMsgFunc(MSG_SYNC_DONE, msg_forward, fmap) != 0 ||
+		dsm_setMsgFunc(MSG_ATOMIC_REQ, msg_forward, fmap) != 0 ||
+		dsm_setMsgFunc(MSG_NOTIFY, msg_forward, fmap) != 0 ||
+		dsm_setMsgFunc(MSG_LOCK_REQ, msg_lockReq, fmap) != 0 ||
+		dsm_setMsgFunc(MSG_LOCK_REL, msg_lockRel, fmap) != 0 ||
 		dsm_setMsgFunc(MSG_WAIT_BARR, msg_waitBarr, fmap) != 0 ||
+		dsm_setMsgFunc(MSG_ADD_PEER, msg_addPeer, fmap) != 0 ||
 		dsm_setMsgFunc(MSG_PRGM_DONE, msg_prgmDone, fmap) != 0) {
 		dsm_cpanic("Couldn't set message functions!", "Unknown");
 	}
 
-	// Initialize pollable-set.
+	// Set worker functions.
+	if (dsm_setMsgFunc(MSG_SYNC_REQ, msg_syncRequest, wmap) != 0 ||
+		dsm_setMsgFunc(MSG_PAGE_REQ, msg_pageReq, wmap) != 0 ||
+		dsm_setMsgFunc(MSG_DEL_PROC, msg_delProc, wmap) != 0 ||
+		dsm_setMsgFunc(MSG_SYNC_INFO, msg_syncInfo, wmap) != 0 ||
+		dsm_setMsgFunc(MSG_WRITE_REL, msg_writeRel, wmap) != 0 ||
+		dsm_setMsgFunc(MSG_PRGM_DONE, msg_dropTokens, wmap) != 0 ||
+		dsm_setMsgFunc(MSG_SYNC_DONE, msg_syncDone, wmap) != 0 ||
+		dsm_setMsgFunc(MSG_ATOMIC_REQ, msg_atomicReq, wmap) != 0 ||
+		dsm_setMsgFunc(MSG_NOTIFY, msg_notify, wmap) != 0) {
+		dsm_cpanic("Couldn't set worker functions!", "Unknown");
+	}
+
+	// Initialize pollable-set. Queued output updates its events.
 	pollableSet = dsm_initPollSet(DSM_MIN_POLLABLE);
+	dsm_setMsgEventsFunc(setPollEvents);
+
+	// Initialize the outbox of the workers, and the eventfd they wake the
+	// I/O thread with.
+	dsm_initMpsc(&outbox);
+	if ((wake_efd = eventfd(0, EFD_NONBLOCK)) == -1) {
+		dsm_panic("Couldn't create eventfd!");
+	}
+	dsm_setPollable(wake_efd, POLLIN, pollableSet);
+
+	// Initialize home copy, copysets, process-arbiter map and atomics.
+	pages = dsm_zalloc(DSM_SHM_NPAGES * DSM_PAGESIZE);
+	copyset = dsm_zalloc(DSM_SHM_NPAGES * nproc);
+	gid_fd = dsm_zalloc(nproc * sizeof(int));
+	atomics = dsm_zalloc(nproc * sizeof(dsm_msg_atomic));
+	memset(gid_fd, -1, nproc * sizeof(int));
+
+	// Initialize the operation queues of the pages.
+	for (int i = 0; i < DSM_SHM_NPAGES; i++) {
+		opqueues[i] = dsm_initOpQueue(DSM_MIN_OPQUEUE_SIZE);
+		atomicqueues[i] = dsm_initOpQueue(DSM_MIN_OPQUEUE_SIZE);
+		page_writer[i] = -1;
+	}
 
-	// Initialize operation-queue.
-	opqueue = dsm_initOpQueue(DSM_MIN_OPQUEUE_SIZE);
+	// Initialize lock tokens: All start at the server.
+	for (int i = 0; i < DSM_MAX_LOCKS; i++) {
+		lock_owner[i] = -1;
+		lockqueue[i] = dsm_initOpQueue(DSM_MIN_OPQUEUE_SIZE);
+	}
 
 	// Setup listener socket: Any port.
 	sock_listen = dsm_getBoundSocket(AI_PASSIVE, AF_UNSPEC, SOCK_STREAM, "0");
@@ -532,40 +1924,32 @@ int main (int argc, const char *argv[]) {
 	printf("addr = %s\n", addr);
 	printf("port = %s\n", port);
 	printf("nproc = %u\n", nproc);
+	printf("loop = %s\n", (withUring ? "uring" : "poll"));
+	printf("fanout = %u\n", fanout);
+	printf("workers = %u\n", nworkers);
+	printf("part = %u/%u\n", part, nparts);
 	printf("================================================\n");
+	fflush(stdout);
 
 	// ----------------------------- Main Body ----------------------------------
+
+	// Partition servers serve pages from the start: Processes are registered
+	// at the first server.
+	if (part != 0) {
+		started = 1;
+		startWorkers();
+	}
 	
 	// If daemon details provided, dispatch update message.
 	if (withDaemon != 0) {
 		send_setSession(sid, addr, port);
 	}
 
-	// Poll while no errors and no exit 
-	while (alive && (new = poll(pollableSet->fds, pollableSet->fp, -1)) != -1) {
-		
-		for (int i = 0; i < pollableSet->fp; i++) {
-			pfd = pollableSet->fds + i;
-
-			// If nothing to read, ignore file-descriptor.
-			if ((pfd->revents & POLLIN) == 0) {
-				continue;
-			}
-
-			// If listenr socket: Accept connection.
-			if (pfd->fd == sock_listen) {
-				processConnection(sock_listen);
-			} else {
-				printf("[%d] New Message!\n", getpid());
-				processMessage(pfd->fd);
-			}
-		}
-
-		printf("[%d] Server State Change:\n", getpid());
-		dsm_showPollable(pollableSet);
-		dsm_showOpQueue(opqueue);
-		printf("================================================\n");
-		putchar('\n');
+	// Run the selected event loop.
+	if (withUring) {
+		uringLoop();
+	} else {
+		pollLoop();
 	}
 	
 
@@ -573,19 +1957,49 @@ int main (int argc, const char *argv[]) {
 
 	printf("[%d] Cleaning up and exiting!\n", getpid());
 
-	// If daemon details provided, dispatch destroy message.
-	if (withDaemon != 0) {
+	// Show message statistics.
+	dsm_showStats("Server");
+
+	// If daemon details provided, dispatch destroy message. (Once: From the
+	// server running the session).
+	if (withDaemon != 0 && part == 0) {
 		send_delSession(sid, addr, port);
 	}
 
-	// Remove listener socket.
+	// Stop the workers.
+	if (workers != NULL) {
+		stopWorkers();
+	}
+
+	// Remove listener socket and eventfd.
 	dsm_removePollable(sock_listen, pollableSet);
+	dsm_removePollable(wake_efd, pollableSet);
 
-	// Close listener socket.
+	// Close listener socket and eventfd.
 	close(sock_listen);
+	close(wake_efd);
+
+	// Free home copy, copysets, process-arbiter map and atomics.
+	free(pages);
+	free(copyset);
+	free(gid_fd);
+	free(atomics);
+
+	// Free peer table and arbiter tree.
+	free(peers);
+	free(tree);
+
+	// Show, then free the operation queues of the pages.
+	showPageQueues();
+	for (int i = 0; i < DSM_SHM_NPAGES; i++) {
+		dsm_freeOpQueue(opqueues[i]);
+		dsm_freeOpQueue(atomicqueues[i]);
+	}
 
-	// Free operation-queue.
-	dsm_freeOpQueue(opqueue);
+	// Free lock queues.
+	for (int i = 0; i < DSM_MAX_LOCKS; i++) {
+		dsm_freeOpQueue(lockqueue[i]);
+	}
 
 	// Free pollable set.
 	dsm_freePollSet(pollableSet);
@@ -2,6 +2,72 @@
 #define DSM_SERVER_H
 
 
+#include <pthread.h>
+
+#include "dsm_msg.h"
+#include "dsm_mpsc.h"
+
+
+/*
+ *******************************************************************************
+ *                              Type Definitions                               *
+ *******************************************************************************
+*/
+
+
+// Request kinds of the io_uring event loop. Kept in the top byte of the
+// request user data, above the connection generation and fd.
+typedef enum dsm_uring_op {
+	URING_ACCEPT = 1,		// Multishot accept on the listener socket.
+	URING_RECV,				// Multishot receive on a connection.
+	URING_SEND,				// Send of taken output on a connection.
+	URING_CANCEL,			// Cancellation of a receive.
+	URING_WAKE				// Read of the wake-up eventfd (workers).
+} dsm_uring_op;
+
+// State of a connection in the io_uring event loop. Indexed by fd.
+typedef struct dsm_uring_conn {
+	unsigned int gen;		// Generation. Bumped when the fd is closed.
+	int receiving;			// Nonzero while a multishot receive is armed.
+	int sending;			// Nonzero while a send is in flight.
+	int paused;				// Nonzero while receiving is paused.
+	dsm_msg_buf out;		// Output being sent (taken from the queue).
+} dsm_uring_conn;
+
+// An update in flight: From its grant (or application, if atomic) until all
+// holders of its page have acknowledged it. Updates of a page are chained by
+// sequence number, so arbiters apply them in order.
+typedef struct dsm_update {
+	unsigned int seq;		// Sequence number.
+	unsigned int prev;		// Previous update of the page (or 0).
+	int writer;				// Arbiter of the writer (or of the atomic requester).
+	int g;					// Atomic requester (gid). -1 if it is a write.
+	int page;				// Page updated.
+	int ordered;			// Nonzero once applied to the home copy.
+	unsigned int expected;	// Acknowledgements expected (once ordered).
+	unsigned int synced;	// Acknowledgements received.
+	int *pushed;			// Arbiters the writer's arbiter pushes it to.
+	int npushed;			// Number of arbiters it is pushed to.
+	int token;				// Granted ahead of a request (a write token).
+	int recalled;			// Nonzero once the write token is recalled.
+} dsm_update;
+
+// A message passed between the I/O thread and a worker. Its data is copied,
+// and follows the job.
+typedef struct dsm_job {
+	dsm_mpsc_node node;		// Queue link.
+	int fd;					// Arbiter the message is from (or to).
+	dsm_msg msg;			// Message.
+} dsm_job;
+
+// A worker thread. Owns the protocol state of a range of pages: Their home
+// copy, copysets, updates and queued operations.
+typedef struct dsm_worker {
+	int id;					// Index of the worker.
+	pthread_t thread;		// Thread.
+	dsm_mpsc inbox;			// Jobs from the I/O thread.
+	int sleeping;			// Futex word: Nonzero while waiting for jobs.
+} dsm_worker;
 
 
 #endif
\ No newline at end of file
@@ -0,0 +1,41 @@
+#include <stdio.h>
+#include <unistd.h>
+#include "dsm_stats.h"
+
+
+/*
+ *******************************************************************************
+ *                              Global Variables                               *
+ *******************************************************************************
+*/
+
+
+// Counters of the calling thread.
+__thread dsm_stats dsm_counters;
+
+
+/*
+ *******************************************************************************
+ *                            Function Definitions                             *
+ *******************************************************************************
+*/
+
+
+// Prints the counters of the calling process, labelled with 'name'.
+void dsm_showStats (const char *name) {
+	dsm_stats s = dsm_counters;
+
+	printf("[%d] %s statistics:\n", getpid(), name);
+	printf("\tSent: %lu msgs, %lu bytes, %lu syscalls (%.2f msgs/syscall)\n",
+		s.msg_sent, s.bytes_sent, s.send_calls,
+		(s.send_calls ? (double)s.msg_sent / s.send_calls : 0.0));
+	printf("\tRecv: %lu msgs, %lu bytes, %lu syscalls (%.2f msgs/syscall)\n",
+		s.msg_recv, s.bytes_recv, s.recv_calls,
+		(s.recv_calls ? (double)s.msg_recv / s.recv_calls : 0.0));
+	printf("\tCopied: %lu bytes, zero-copy: %lu bytes\n", s.bytes_copied,
+		s.bytes_zerocopy);
+	printf("\tCoded: %lu raw bytes as %lu bytes (%.1f%%)\n", s.bytes_raw,
+		s.bytes_coded, (s.bytes_raw ? 100.0 * s.bytes_coded / s.bytes_raw :
+		100.0));
+	fflush(stdout);
+}
@@ -0,0 +1,49 @@
+#if !defined(DSM_STATS_H)
+#define DSM_STATS_H
+
+
+/*
+ *******************************************************************************
+ *                              Type Definitions                               *
+ *******************************************************************************
+*/
+
+
+// Message and syscall counters of a process.
+typedef struct dsm_stats {
+	unsigned long msg_sent;			// Messages sent (or queued for sending).
+	unsigned long msg_recv;			// Messages received.
+	unsigned long send_calls;		// Send syscalls.
+	unsigned long recv_calls;		// Receive syscalls.
+	unsigned long bytes_sent;		// Bytes sent.
+	unsigned long bytes_recv;		// Bytes received.
+	unsigned long bytes_copied;		// Bytes copied in/out of message buffers.
+	unsigned long bytes_zerocopy;	// Bytes sent without copying (sendfile).
+	unsigned long bytes_raw;		// Sync/page data bytes before coding.
+	unsigned long bytes_coded;		// Sync/page data bytes after coding.
+} dsm_stats;
+
+
+/*
+ *******************************************************************************
+ *                              Global Variables                               *
+ *******************************************************************************
+*/
+
+
+// [EXTERN] Counters of the calling thread (one per hosted arbiter).
+extern __thread dsm_stats dsm_counters;
+
+
+/*
+ *******************************************************************************
+ *                            Function Declarations                            *
+ *******************************************************************************
+*/
+
+
+// Prints the counters of the calling process, labelled with 'name'.
+void dsm_showStats (const char *name);
+
+
+#endif
@@ -3,6 +3,7 @@
 #include <string.h>
 #include <unistd.h>
 #include <sys/mman.h>
+#include <sys/eventfd.h>
 #include <ucontext.h>
 
 #include "xed/xed-interface.h"
@@ -11,6 +12,9 @@
 #include "dsm_msg.h"
 #include "dsm_util.h"
 #include "dsm_inet.h"
+#include "dsm_interface.h"
+#include "dsm_signal.h"
+#include "dsm_ring.h"
 
 /*
  *******************************************************************************
@@ -22,6 +26,9 @@
 // Length of the UD2 instruction for isa: x86-64.
 #define UD2_SIZE	2
 
+// Page-fault error code bit set when the faulting access was a write.
+#define PF_WRITE	0x2
+
 
 /*
  *******************************************************************************
@@ -42,6 +49,12 @@ unsigned char ud2_opcodes[UD2_SIZE] = {0x0f, 0x0b};
 // Pointer to memory address at which fault occurred. 
 void *fault_addr;
 
+// Pages of which this process holds a valid copy (its copyset membership).
+static unsigned char valid[DSM_SHM_NPAGES];
+
+// Twin of the page being written. Diffed against it to find the update.
+static unsigned char *twin;
+
 
 /*
  *******************************************************************************
@@ -68,55 +81,207 @@ static xed_uint_t getInstLength (void *addr, xed_state_t *decoderState) {
 	return xed_decoded_inst_get_length(&xedd);
 }
 
-// Prepares to write: Messages the arbiter, waits for an acknowledgement.
-static void takeAccess (void) {
+// Returns the shared page containing 'addr', or -1 if it isn't shared.
+static int getPage (void *addr) {
+	void *start = (void *)smap + smap->data_off;
+	void *end = (void *)smap + smap->size;
+
+	if (addr < start || addr >= end) {
+		return -1;
+	}
+	return (addr - start) / DSM_PAGESIZE;
+}
+
+// Returns the address of the given shared page.
+static void *getPageAddress (int page) {
+	return (void *)smap + smap->data_off + page * DSM_PAGESIZE;
+}
+
+// Sends a request to the arbiter: Over the ring if there is one, otherwise
+// over the socket. The arbiter is only woken (a syscall) if it sleeps.
+static void sendRequest (dsm_msg *mp) {
+
+	if (ring == NULL) {
+		dsm_sendmsg(sock_arbiter, mp);
+		return;
+	}
+
+	// Each request is answered before the next: The ring can't fill.
+	if (dsm_ringPut(&ring->req, mp) != 0) {
+		dsm_cpanic("sendRequest", "Ring is full!");
+	}
+
+	// Order the put before the check (the arbiter does the reverse).
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&smap->arb_sleeping, __ATOMIC_RELAXED) &&
+		eventfd_write(ring_efd, 1) == -1) {
+		dsm_panic("Couldn't wake arbiter!");
+	}
+}
+
+// Receives the reply to a request: Over the ring if there is one, otherwise
+// over the socket. Returns nonzero if the connection is closed.
+static int recvReply (dsm_msg *mp) {
+	int park;
+
+	if (ring == NULL) {
+		return dsm_recvmsg(sock_arbiter, mp);
+	}
+
+	// Check the ring a while (the reply is usually close behind), then park.
+	while (dsm_ringSpin(&ring->rsp) != 0) {
+		park = __atomic_load_n(&smap->park_epoch, __ATOMIC_SEQ_CST);
+		if (dsm_isRingEmpty(&ring->rsp)) {
+			dsm_park(smap, park);
+		}
+	}
+
+	return dsm_ringGet(&ring->rsp, mp);
+}
+
+// Joins copyset of page: Waits for arbiter to validate copy. Maps read-only.
+static void fetchPage (int page) {
 	dsm_msg msg;
 
-	printf("[%d] About to grab semaphore!\n", getpid()); fflush(stdout);
+	// Configure message, and send to arbiter.
+	memset(&msg, 0, sizeof(msg));
+	msg.type = MSG_PAGE_REQ;
+	msg.payload.page.gid = dsm_getgid();
+	msg.payload.page.offset = page * DSM_PAGESIZE;
+	dsm_sendmsg(sock_arbiter, &msg);
+
+	// Wait for the arbiter to install a valid copy.
+	if (dsm_recvmsg(sock_arbiter, &msg) != 0) {
+		dsm_cpanic("fetchPage", "Lost connection to arbiter!");
+	}
 
-	// Seize the I/O semaphore.
-	//dsm_down(&(smap->sem_io));
+	// Verify reply.
+	if (msg.type != MSG_PAGE_DATA) {
+		dsm_cpanic("fetchPage", "Unknown message received!");
+	}
+
+	// Page may now be read.
+	dsm_mprotect(getPageAddress(page), DSM_PAGESIZE, PROT_READ);
+	valid[page] = 1;
+}
 
-	printf("[%d] Grabbed semaphore!\n", getpid()); fflush(stdout);
+// Requests write access from the arbiter, and waits for its reply. Returns
+// nonzero if granted. Returns zero if the host now holds the page's write
+// token: The page's word is then taken instead.
+static int requestAccess (off_t offset) {
+	dsm_msg msg;
 
 	// Configure message, and send to arbiter.
 	memset(&msg, 0, sizeof(msg));
 	msg.type = MSG_SYNC_REQ;
+	msg.payload.sync.offset = offset;
 	
 	printf("[%d] Sent write request!\n", getpid()); fflush(stdout);
-	dsm_sendall(sock_arbiter, &msg, sizeof(msg));
+	sendRequest(&msg);
 
 	// Wait for acknowledgement.
-	dsm_recvall(sock_arbiter, &msg, sizeof(msg));
+	if (recvReply(&msg) != 0) {
+		dsm_cpanic("requestAccess", "Lost connection to arbiter!");
+	}
 	printf("[%d] Received go-ahead!\n", getpid()); fflush(stdout);
 
 	// Verify acknowledgement.
 	if (msg.type != MSG_WRITE_OKAY) {
-		dsm_cpanic("takeAccess", "Unknown message received!");
+		dsm_cpanic("requestAccess", "Unknown message received!");
+	}
+
+	return (msg.payload.sync.token == 0);
+}
+
+// Prepares to write: While the host holds the write token of the page, local
+// writers take turns through the page's word without any messages. Otherwise
+// requests write access from the arbiter.
+static void takeAccess (off_t offset) {
+	int *wp = smap->writes + offset / DSM_PAGESIZE;
+	int c, waited = 0;
+
+	for (;;) {
+		c = __atomic_load_n(wp, __ATOMIC_SEQ_CST);
+
+		// Token not on the host: Have the arbiter request the write.
+		if (c == WRITE_REMOTE) {
+			if (requestAccess(offset)) {
+				break;
+			}
+			continue;
+		}
+
+		// Fast path: Take the unused token (contended if we slept before).
+		if (c == WRITE_FREE) {
+			if (__atomic_compare_exchange_n(wp, &c, (waited ? WRITE_CONTENDED
+				: WRITE_HELD), 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+				break;
+			}
+			continue;
+		}
+
+		// Taken by another local writer: Mark contended, then sleep until the
+		// arbiter holds the next token (or it goes back to the server).
+		if (c == WRITE_HELD && !__atomic_compare_exchange_n(wp, &c,
+			WRITE_CONTENDED, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+			continue;
+		}
+		dsm_futexWait(wp, WRITE_CONTENDED);
+		waited = 1;
 	}
+
+	// Local readers of the page retry until the write completes.
+	dsm_seqBegin(smap->seq + offset / DSM_PAGESIZE);
 }
 
-// Releases access: Messages the arbiter, then suspends itself until continued.
-static void dropAccess (void) {
+// Sets 'offset' and 'size' to the range of the page that differs from its
+// twin. If nothing differs, the range is empty at the fault address.
+static void getDiff (int page, off_t *offset, size_t *size) {
+	unsigned char *data = getPageAddress(page);
+	int first = 0, last = DSM_PAGESIZE - 1;
+
+	// Trim equal bytes from both ends.
+	while (first < DSM_PAGESIZE && data[first] == twin[first]) {
+		first++;
+	}
+	while (last > first && data[last] == twin[last]) {
+		last--;
+	}
+
+	// Express range as an offset in the shared region.
+	if (first == DSM_PAGESIZE) {
+		*offset = fault_addr - getPageAddress(0);
+		*size = 0;
+	} else {
+		*offset = page * DSM_PAGESIZE + first;
+		*size = last - first + 1;
+	}
+}
+
+// Releases access: Messages the arbiter, then blocks until update is visible.
+static void dropAccess (off_t offset, size_t size) {
 	dsm_msg msg;
-	
-	// Release the I/O semaphore.
-	//dsm_up(&(smap->sem_io));
 
-	// Configure synchronization information message.
+	// Configure synchronization information message. The arbiter maps the
+	// written bytes too, so they aren't sent along.
 	memset(&msg, 0, sizeof(msg));
 	msg.type = MSG_SYNC_INFO;
-	msg.payload.sync.offset = fault_addr - ((void *)smap + smap->data_off);
-	msg.payload.sync.size = 4;
-	memcpy(msg.payload.sync.buf, fault_addr, sizeof(int));
+	msg.payload.sync.offset = offset;
+	msg.payload.sync.size = size;
 
 	// Send synchronization information to arbiter.
-	dsm_sendall(sock_arbiter, &msg, sizeof(msg));
+	sendRequest(&msg);
 	printf("[%d] Sent sync info!\n", getpid()); fflush(stdout);
 
-	// Schedule a suspend signal
-	if (kill(getpid(), SIGTSTP) == -1) {
-		dsm_panic("Couldn't suspend process!\n");
+	// Wait until all holders have the update. (A self-suspend could miss a
+	// continue signal sent before it took effect).
+	if (recvReply(&msg) != 0) {
+		dsm_cpanic("dropAccess", "Lost connection to arbiter!");
+	}
+
+	// Verify message.
+	if (msg.type != MSG_CONT_ALL) {
+		dsm_cpanic("dropAccess", "Unknown message received!");
 	}
 }
 
@@ -134,6 +299,9 @@ void dsm_sync_init (void) {
 	// Initialize decoder table.
 	xed_tables_init();
 
+	// Allocate the twin page.
+	twin = dsm_zalloc(DSM_PAGESIZE);
+
 	// Setup machine state.
 	xed_state_init2(&xed_machine_state, XED_MACHINE_MODE_LONG_64,
 		XED_ADDRESS_WIDTH_64b);
@@ -143,12 +311,30 @@ void dsm_sync_init (void) {
 void dsm_sync_sigsegv (int signal, siginfo_t *info, void *ucontext) {
 	ucontext_t *context = (ucontext_t *)ucontext;
 	void *prgm_counter = (void *)context->uc_mcontext.gregs[REG_RIP];
+	int is_write = (context->uc_mcontext.gregs[REG_ERR] & PF_WRITE) != 0;
+	int page = getPage(info->si_addr);
 	xed_uint_t len;
 
 	printf("[%d] SIGSEGV!\n", getpid());
 
-	// Grab semaphore and request write access.
-	takeAccess();
+	// Not a shared page: Restore default action and let the fault recur.
+	if (page == -1) {
+		dsm_sigdefault(SIGSEGV);
+		return;
+	}
+
+	// Fetch a valid copy if the page hasn't been accessed before.
+	if (valid[page] == 0) {
+		fetchPage(page);
+	}
+
+	// A read only needed the copy.
+	if (!is_write) {
+		return;
+	}
+
+	// Request write access.
+	takeAccess(info->si_addr - ((void *)smap + smap->data_off));
 
 	// Get instruction length.
 	len = getInstLength(prgm_counter, &xed_machine_state);
@@ -170,33 +356,34 @@ void dsm_sync_sigsegv (int signal, siginfo_t *info, void *ucontext) {
 	// Set fault address.
 	fault_addr = info->si_addr;
 
-	// Give protected portion of shared page read-write access.
-	void *page = (void *)smap + smap->data_off;
-	dsm_mprotect(page, DSM_PAGESIZE, PROT_WRITE);
+	// Twin the page: The diff against it is the update (of any width).
+	memcpy(twin, getPageAddress(page), DSM_PAGESIZE);
+
+	// Give faulting shared page read-write access.
+	dsm_mprotect(getPageAddress(page), DSM_PAGESIZE, PROT_READ|PROT_WRITE);
 }
 
 // Handler: Synchronization action for SIGILL.
 void dsm_sync_sigill (int signal, siginfo_t *info, void *ucontext) {
 	ucontext_t *context = (ucontext_t *)ucontext;
 	void *prgm_counter = (void *)context->uc_mcontext.gregs[REG_RIP];
+	int page = getPage(fault_addr);
+	size_t size;
+	off_t offset;
 
 	// Restore origin instruction.
 	memcpy(prgm_counter, inst_buf, UD2_SIZE);
 
-	// Protect shared page again.
-	void *page = (void *)smap + smap->data_off;
-	dsm_mprotect(page, DSM_PAGESIZE, PROT_READ);
+	// Protect shared page again. Readers may now use the written data.
+	dsm_mprotect(getPageAddress(page), DSM_PAGESIZE, PROT_READ);
+	dsm_seqEnd(smap->seq + page);
 
-	// Release lock and send sychronization information.
-	dropAccess();
-}
+	// Find the written bytes.
+	getDiff(page, &offset, &size);
 
-// [DEBUG] Handler: Synchronization action for SIGCONT.
-void dsm_sync_sigcont (int signal, siginfo_t *info, void *ucontext) {
-	printf("[%d] SIGCONT!\n", getpid());
-}
+	// Wake local processes waiting on the written words.
+	dsm_wakeWaiters(smap, offset, size);
 
-// [DEBUG] Handler: Synchronization action for SIGTSTP.
-void dsm_sync_sigtstp (int signal, siginfo_t *info, void *ucontext) {
-	printf("[%d] SIGTSTP!\n", getpid());
-}
\ No newline at end of file
+	// Release lock and send sychronization information.
+	dropAccess(offset, size);
+}
@@ -18,6 +18,12 @@ extern dsm_smap *smap;
 // External reference to the arbiter socket.
 extern int sock_arbiter;
 
+// External reference to the ring pair to the arbiter (NULL if none).
+extern struct dsm_ring_pair *ring;
+
+// External reference to the wake-up eventfd of the arbiter.
+extern int ring_efd;
+
 
 /*
  *******************************************************************************
@@ -35,10 +41,4 @@ void dsm_sync_sigsegv (int signal, siginfo_t *info, void *ucontext);
 // Handler: Synchronization action for SIGILL.
 void dsm_sync_sigill (int signal, siginfo_t *info, void *ucontext);
 
-// [DEBUG] Handler: Synchronization action for SIGCONT.
-void dsm_sync_sigcont (int signal, siginfo_t *info, void *ucontext);
-
-// [DEBUG] Handler: Synchronization action for SIGTSTP.
-void dsm_sync_sigtstp (int signal, siginfo_t *info, void *ucontext);
-
 #endif
\ No newline at end of file
@@ -2,6 +2,7 @@
 #define DSM_TYPES_H
 
 #include <semaphore.h>
+#include <netinet/in.h>
 
 /*
  *******************************************************************************
@@ -10,8 +11,19 @@
 */
 
 
-// Default port to which the listener socket is bound.
-#define DSM_DEF_ARB_PORT		"4800"
+// Port to which the peer listener socket is bound: Any. Peers learn it from
+// the server.
+#define DSM_ARB_PEER_PORT		"0"
+
+// Path of the local (unix domain) socket of the arbiter, by session ID.
+#define DSM_ARB_PATH_FMT		"/tmp/dsm_%.*s.sock"
+
+// Size of a buffer for the arbiter socket path.
+#define DSM_ARB_PATH_SIZE		108
+
+// Path of the local socket of the host arbiter service (if one runs). It
+// hosts the arbiters of all sessions on the host.
+#define DSM_HOST_PATH			"/tmp/dsm_host.sock"
 
 // Minimum size of the process table (corresponds to number of open files).
 #define DSM_MIN_NPROC			64
@@ -24,14 +36,36 @@
 */
 
 
-// The name of the shared initialization semaphore.
-#define DSM_SEM_INIT_NAME			"dsm_start"
+// The name of the shared initialization semaphore, by session ID.
+#define DSM_SEM_INIT_FMT			"dsm_start_%.*s"
+
+// The name of the shared file, by session ID.
+#define DSM_SHM_FILE_FMT			"dsm_file_%.*s"
+
+// Size of a buffer for the semaphore and shared file names.
+#define DSM_SHM_NAME_SIZE			64
+
+// The number of distributed locks (dsm_lock identifiers 0 .. n-1).
+#define DSM_MAX_LOCKS				32
 
-// The name of the shared file.
-#define DSM_SHM_FILE_NAME			"dsm_file"
+// The number of shareable data pages following the map header.
+#define DSM_SHM_NPAGES				8
 
-// The minimum size of a shared memory file.
-#define DSM_SHM_FILE_SIZE			(2 * DSM_PAGESIZE)
+// The number of words per page whose waiters (dsm_wait) are registered.
+// Waiters beyond them make updates of the page wake every word written.
+#define DSM_WAIT_SLOTS				4
+
+// The number of process rings (request + response) in the shared file.
+// Processes beyond these message their arbiter over their socket only.
+#define DSM_MAX_RINGS				16
+
+// The number of pages holding the process rings (after the header page).
+#define DSM_RING_NPAGES				5
+
+// The minimum size of a shared memory file (header page + ring pages + data
+// pages).
+#define DSM_SHM_FILE_SIZE			\
+	((1 + DSM_RING_NPAGES + DSM_SHM_NPAGES) * DSM_PAGESIZE)
 
 
 /*
@@ -43,7 +77,7 @@
 
 // Bit-field enumerating possible process states.
 typedef struct dsm_pstate {
-	unsigned int is_stopped;						// Process stopped.
+	unsigned int is_parked;							// Process awaits release.
 	unsigned int is_waiting;						// Process at a barrier.
 	unsigned int is_queued;							// Process in writer-queue.
 } dsm_pstate;
@@ -54,6 +88,10 @@ typedef struct dsm_proc {
 	int gid;										// Global process ID.
 	int pid;										// Process ID.
 	dsm_pstate flags;								// Process state.
+	unsigned char valid[DSM_SHM_NPAGES];			// Pages held (copyset).
+	unsigned int seq;								// Update being written.
+	off_t offset;									// Write requested.
+	int ring;										// Ring pair (or -1).
 } dsm_proc;
 
 // Structure describing process table.
@@ -62,6 +100,14 @@ typedef struct dsm_ptab {
 	dsm_proc *processes;							// Array of pstates.
 } dsm_ptab;
 
+// Structure describing a peer arbiter. Updates are pushed to it directly.
+typedef struct dsm_peer {
+	char addr[INET6_ADDRSTRLEN];					// Listener address.
+	unsigned int port;								// Listener port (0 if unknown).
+	int fd;											// Connection (-1 until used).
+	int link;										// Tree link (dsm_treeLink).
+} dsm_peer;
+
 
 /*
  *******************************************************************************
@@ -70,12 +116,47 @@ typedef struct dsm_ptab {
 */
 
 
+// Enumeration of local lock word states.
+typedef enum dsm_lockState {
+	LOCK_FREE = 0,			// Host holds the token. Lock is free.
+	LOCK_HELD,				// Host holds the token. Lock is held.
+	LOCK_CONTENDED,			// Host holds the token. Lock is held, has waiters.
+	LOCK_REMOTE				// Token is not on this host.
+} dsm_lockState;
+
+// Enumeration of local page write word states.
+typedef enum dsm_writeState {
+	WRITE_FREE = 0,			// Host holds the page's write token. It is unused.
+	WRITE_HELD,				// A local writer took it (or awaits the next).
+	WRITE_CONTENDED,		// As held, and other local writers wait.
+	WRITE_REMOTE			// Token is not on this host.
+} dsm_writeState;
+
+// Host-local view of a distributed lock. The arbiter caches the token.
+typedef struct dsm_lock_t {
+	int word;				// Futex word (dsm_lockState).
+	int recalled;			// Nonzero if a remote arbiter awaits the token.
+} dsm_lock_t;
+
 // Type describing a shared memory instance.
 typedef struct dsm_smap { 
 	sem_t sem_io;			// The I/O semaphore.
-	sem_t sem_barrier;		// The barrier semaphore.
+	int barrier_count;		// Local processes arrived at the barrier.
+	int barrier_epoch;		// Futex word. Bumped when the barrier releases.
+	int barrier_nproc;		// Local processes taking part in barriers.
+	int park_epoch;			// Futex word. Bumped to wake parked processes.
+	int nparked;			// Processes parked on park_epoch.
+	off_t ring_off;			// Offset to the process rings (dsm_ring_pair).
 	off_t data_off;			// Offset to usable memory space.
 	size_t size;			// Size of shared memory. 
+	unsigned int seq[DSM_SHM_NPAGES];	// Page seqlocks (odd while updating).
+	int nwait[DSM_SHM_NPAGES];			// Processes in dsm_wait on each page.
+	int nwait_any[DSM_SHM_NPAGES];		// Of those, waiters without a slot.
+	unsigned long long waits[DSM_SHM_NPAGES][DSM_WAIT_SLOTS];	// Waited
+										// words: (offset + 1) << 32 | count.
+	dsm_lock_t locks[DSM_MAX_LOCKS];		// Distributed locks.
+	int writes[DSM_SHM_NPAGES];			// Futex words (dsm_writeState).
+	int arb_sleeping;		// Nonzero while the arbiter sleeps (in poll).
 } dsm_smap;
 
 
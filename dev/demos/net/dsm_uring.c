@@ -0,0 +1,221 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "dsm_uring.h"
+#include "dsm_util.h"
+#include "dsm_stats.h"
+
+
+/*
+ *******************************************************************************
+ *                        Internal Function Definitions                        *
+ *******************************************************************************
+*/
+
+
+// Syscall: Sets up an io_uring instance.
+static int uring_setup (unsigned int entries, struct io_uring_params *p) {
+	return syscall(__NR_io_uring_setup, entries, p);
+}
+
+// Syscall: Submits entries and waits for completions.
+static int uring_enter (int fd, unsigned int submit, unsigned int wait,
+	unsigned int flags) {
+	return syscall(__NR_io_uring_enter, fd, submit, wait, flags, NULL, 0);
+}
+
+// Syscall: Registers resources with an io_uring instance.
+static int uring_register (int fd, unsigned int op, void *arg,
+	unsigned int n) {
+	return syscall(__NR_io_uring_register, fd, op, arg, n);
+}
+
+
+/*
+ *******************************************************************************
+ *                            Function Definitions                             *
+ *******************************************************************************
+*/
+
+
+// Sets up ring r with 'entries' submission entries. Returns nonzero if
+// io_uring is unavailable.
+int dsm_initUring (dsm_uring *r, unsigned int entries) {
+	struct io_uring_params p;
+	void *sqes;
+
+	memset(r, 0, sizeof(*r));
+	memset(&p, 0, sizeof(p));
+
+	// Create ring: Large completion queue for multishot requests.
+	p.flags = IORING_SETUP_CQSIZE;
+	p.cq_entries = 8 * entries;
+	if ((r->fd = uring_setup(entries, &p)) == -1) {
+		return -1;
+	}
+
+	// Require a single ring mapping and no dropped completions.
+	if ((p.features & IORING_FEAT_SINGLE_MMAP) == 0 ||
+		(p.features & IORING_FEAT_NODROP) == 0) {
+		close(r->fd);
+		return -1;
+	}
+
+	// Map rings.
+	r->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	r->cq_ring_size = p.cq_off.cqes + p.cq_entries *
+		sizeof(struct io_uring_cqe);
+	r->sq_ring_size = r->cq_ring_size = MAX(r->sq_ring_size,
+		r->cq_ring_size);
+	if ((r->sq_ring = mmap(NULL, r->sq_ring_size, PROT_READ|PROT_WRITE,
+		MAP_SHARED|MAP_POPULATE, r->fd, IORING_OFF_SQ_RING)) == MAP_FAILED) {
+		dsm_panic("Couldn't map io_uring rings!");
+	}
+	r->cq_ring = r->sq_ring;
+
+	// Map submission entries.
+	if ((sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe),
+		PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, r->fd,
+		IORING_OFF_SQES)) == MAP_FAILED) {
+		dsm_panic("Couldn't map io_uring entries!");
+	}
+	r->sqes = sqes;
+
+	// Set ring pointers.
+	r->sq_head = r->sq_ring + p.sq_off.head;
+	r->sq_tail = r->sq_ring + p.sq_off.tail;
+	r->sq_array = r->sq_ring + p.sq_off.array;
+	r->sq_mask = *(unsigned int *)(r->sq_ring + p.sq_off.ring_mask);
+	r->sq_entries = p.sq_entries;
+	r->cq_head = r->cq_ring + p.cq_off.head;
+	r->cq_tail = r->cq_ring + p.cq_off.tail;
+	r->cq_mask = *(unsigned int *)(r->cq_ring + p.cq_off.ring_mask);
+	r->cqes = r->cq_ring + p.cq_off.cqes;
+
+	return 0;
+}
+
+// Tears down ring r.
+void dsm_freeUring (dsm_uring *r) {
+	munmap(r->sqes, r->sq_entries * sizeof(struct io_uring_sqe));
+	munmap(r->sq_ring, r->sq_ring_size);
+	if (r->br != NULL) {
+		munmap(r->br, r->br_entries * sizeof(struct io_uring_buf));
+		free(r->br_bufs);
+	}
+	close(r->fd);
+}
+
+// Registers 'n' (power of two) provided buffers of 'size' bytes as buffer
+// group 'bgid', for multishot receives. Exits fatally on error.
+void dsm_initUringBufs (dsm_uring *r, unsigned int n, size_t size, int bgid) {
+	struct io_uring_buf_reg reg;
+
+	// Map the buffer ring (page aligned), and allocate the buffers.
+	if ((r->br = mmap(NULL, n * sizeof(struct io_uring_buf),
+		PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0)) ==
+		MAP_FAILED) {
+		dsm_panic("Couldn't map buffer ring!");
+	}
+	r->br_bufs = dsm_zalloc(n * size);
+	r->br_entries = n;
+	r->br_size = size;
+
+	// Register the ring.
+	memset(&reg, 0, sizeof(reg));
+	reg.ring_addr = (unsigned long)r->br;
+	reg.ring_entries = n;
+	reg.bgid = bgid;
+	if (uring_register(r->fd, IORING_REGISTER_PBUF_RING, &reg, 1) == -1) {
+		dsm_panic("Couldn't register buffer ring!");
+	}
+
+	// Provide all buffers.
+	for (unsigned int bid = 0; bid < n; bid++) {
+		dsm_putUringBuf(r, bid);
+	}
+}
+
+// Returns provided buffer 'bid'.
+void *dsm_getUringBuf (dsm_uring *r, unsigned int bid) {
+	return r->br_bufs + bid * r->br_size;
+}
+
+// Returns provided buffer 'bid' to the kernel.
+void dsm_putUringBuf (dsm_uring *r, unsigned int bid) {
+	unsigned short tail = r->br->tail;
+	struct io_uring_buf *b = &r->br->bufs[tail & (r->br_entries - 1)];
+
+	// Fill entry, then publish it.
+	b->addr = (unsigned long)dsm_getUringBuf(r, bid);
+	b->len = r->br_size;
+	b->bid = bid;
+	__atomic_store_n(&r->br->tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+// Returns a zeroed submission entry. Submits first if the queue is full.
+struct io_uring_sqe *dsm_getUringSqe (dsm_uring *r) {
+	unsigned int tail = *r->sq_tail + r->sq_pending, index;
+	struct io_uring_sqe *sqe;
+
+	// If full: Submit without waiting.
+	if (tail - __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE) >=
+		r->sq_entries) {
+		dsm_submitUring(r, 0);
+		tail = *r->sq_tail;
+	}
+
+	// Claim entry.
+	index = tail & r->sq_mask;
+	sqe = r->sqes + index;
+	memset(sqe, 0, sizeof(*sqe));
+	r->sq_array[index] = index;
+	r->sq_pending++;
+
+	return sqe;
+}
+
+// Submits prepared entries, and waits for 'wait' completions: One syscall.
+// Exits fatally on error.
+void dsm_submitUring (dsm_uring *r, unsigned int wait) {
+	unsigned int submit = r->sq_pending;
+
+	// Publish prepared entries.
+	__atomic_store_n(r->sq_tail, *r->sq_tail + submit, __ATOMIC_RELEASE);
+	r->sq_pending = 0;
+
+	// Enter kernel (retry if interrupted before consuming entries).
+	while (uring_enter(r->fd, submit, wait,
+		(wait > 0 ? IORING_ENTER_GETEVENTS : 0)) == -1) {
+		if (errno != EINTR) {
+			dsm_panic("Couldn't enter io_uring!");
+		}
+	}
+
+	// Count as a send syscall if it carried entries (else a receive).
+	if (submit > 0) {
+		dsm_counters.send_calls++;
+	} else {
+		dsm_counters.recv_calls++;
+	}
+}
+
+// Returns the next completion, or NULL if none. Release with dsm_seenUring.
+struct io_uring_cqe *dsm_peekUring (dsm_uring *r) {
+	unsigned int head = *r->cq_head;
+
+	if (head == __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE)) {
+		return NULL;
+	}
+	return r->cqes + (head & r->cq_mask);
+}
+
+// Releases the completion returned by dsm_peekUring.
+void dsm_seenUring (dsm_uring *r) {
+	__atomic_store_n(r->cq_head, *r->cq_head + 1, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,76 @@
+#if !defined(DSM_URING_H)
+#define DSM_URING_H
+
+
+#include <linux/io_uring.h>
+
+
+/*
+ *******************************************************************************
+ *                              Type Definitions                               *
+ *******************************************************************************
+*/
+
+
+// An io_uring instance, driven with raw syscalls.
+typedef struct dsm_uring {
+	int fd;								// Ring file-descriptor.
+	unsigned int *sq_head;				// Submission queue head (kernel).
+	unsigned int *sq_tail;				// Submission queue tail.
+	unsigned int *sq_array;				// Submission queue index array.
+	unsigned int sq_mask;				// Submission queue mask.
+	unsigned int sq_entries;			// Submission queue length.
+	unsigned int sq_pending;			// Prepared, unsubmitted entries.
+	unsigned int *cq_head;				// Completion queue head.
+	unsigned int *cq_tail;				// Completion queue tail (kernel).
+	unsigned int cq_mask;				// Completion queue mask.
+	struct io_uring_sqe *sqes;			// Submission queue entries.
+	struct io_uring_cqe *cqes;			// Completion queue entries.
+	void *sq_ring, *cq_ring;			// Mapped rings.
+	size_t sq_ring_size, cq_ring_size;	// Sizes of the mapped rings.
+	struct io_uring_buf_ring *br;		// Provided buffer ring.
+	unsigned char *br_bufs;				// Provided buffer memory.
+	unsigned int br_entries;			// Number of provided buffers.
+	size_t br_size;						// Size of each provided buffer.
+} dsm_uring;
+
+
+/*
+ *******************************************************************************
+ *                            Function Declarations                            *
+ *******************************************************************************
+*/
+
+
+// Sets up ring r with 'entries' submission entries. Returns nonzero if
+// io_uring is unavailable.
+int dsm_initUring (dsm_uring *r, unsigned int entries);
+
+// Tears down ring r.
+void dsm_freeUring (dsm_uring *r);
+
+// Registers 'n' (power of two) provided buffers of 'size' bytes as buffer
+// group 'bgid', for multishot receives. Exits fatally on error.
+void dsm_initUringBufs (dsm_uring *r, unsigned int n, size_t size, int bgid);
+
+// Returns provided buffer 'bid'.
+void *dsm_getUringBuf (dsm_uring *r, unsigned int bid);
+
+// Returns provided buffer 'bid' to the kernel.
+void dsm_putUringBuf (dsm_uring *r, unsigned int bid);
+
+// Returns a zeroed submission entry. Submits first if the queue is full.
+struct io_uring_sqe *dsm_getUringSqe (dsm_uring *r);
+
+// Submits prepared entries, and waits for 'wait' completions: One syscall.
+// Exits fatally on error.
+void dsm_submitUring (dsm_uring *r, unsigned int wait);
+
+// Returns the next completion, or NULL if none. Release with dsm_seenUring.
+struct io_uring_cqe *dsm_peekUring (dsm_uring *r);
+
+// Releases the completion returned by dsm_peekUring.
+void dsm_seenUring (dsm_uring *r);
+
+
+#endif
\ No newline at end of file
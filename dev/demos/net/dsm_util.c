@@ -6,12 +6,39 @@
 #include <semaphore.h>
 #include <sys/mman.h>
 #include <stdarg.h>
+#include <setjmp.h>
+#include <time.h>
+#include <limits.h>
 #include <fcntl.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 #include "dsm_util.h"
 
 
+/*
+ *******************************************************************************
+ *                             Symbolic Constants                              *
+ *******************************************************************************
+*/
+
+
+// Waiter count bits of a wait slot (the word offset + 1 is above them).
+#define WAIT_COUNT_MASK			0xffffffffULL
+
+
+/*
+ *******************************************************************************
+ *                              Global Variables                               *
+ *******************************************************************************
+*/
+
+
+// Where panics of this thread jump to instead of exiting (NULL: exit).
+static __thread jmp_buf *panic_env;
+
+
 /*
  *******************************************************************************
  *                          I/O Function Definitions                           *
@@ -19,18 +46,26 @@
 */
 
 
+// Ends a panic: Jumps to the panic point of the thread if set, else exits.
+static void endPanic (void) {
+	if (panic_env != NULL) {
+		longjmp(*panic_env, 1);
+	}
+	exit(EXIT_FAILURE);
+}
+
 // Exits fatally with given error message. Also outputs errno.
 void dsm_panic (const char *msg) {
 	const char *fmt = "[%d] Fatal Error: \"%s\". Errno (%d): \"%s\"\n";
 	fprintf(stderr, fmt, getpid(), msg, errno, strerror(errno));
-	exit(EXIT_FAILURE);
+	endPanic();
 }
 
 // Exits fatally with given error message. Outputs custom errno.
 void dsm_cpanic (const char *msg, const char *reason) {
 	const char *fmt = "[%d] Fatal Error: \"%s\". Reason: \"%s\"\n";
 	fprintf(stderr, fmt, getpid(), msg, reason);
-	exit(EXIT_FAILURE);
+	endPanic();
 }
 
 // Exits fatally with formatted error. Supports tokens: {%s, %d, %f, %u}.
@@ -87,7 +122,13 @@ void dsm_panicf (const char *fmt, ...) {
 	va_end(ap);
 
 	// Exit.
-	exit(EXIT_FAILURE);
+	endPanic();
+}
+
+// Makes panics of the calling thread jump to 'env' (set with setjmp) instead
+// of exiting. NULL makes them exit again.
+void dsm_setPanicJump (jmp_buf *env) {
+	panic_env = env;
 }
 
 // Outputs warning to stderr.
@@ -252,3 +293,220 @@ void dsm_unlinkSharedFile (const char *name) {
 		dsm_panicf("Couldn't unlink shared file: \"%s\"!", name);
 	}
 }
+
+
+/*
+ *******************************************************************************
+ *                          Futex Function Definitions                         *
+ *******************************************************************************
+*/
+
+
+// Sleeps while the shared word at 'addr' holds 'val'. May return spuriously.
+void dsm_futexWait (int *addr, int val) {
+
+	// Shared (non-private) futex: The word lives in a shared mapping.
+	if (syscall(SYS_futex, addr, FUTEX_WAIT, val, NULL, NULL, 0) == -1 &&
+		errno != EAGAIN && errno != EINTR) {
+		dsm_panic("Couldn't wait on futex!");
+	}
+}
+
+// Wakes up to 'n' processes sleeping on the shared word at 'addr'.
+void dsm_futexWake (int *addr, int n) {
+	if (syscall(SYS_futex, addr, FUTEX_WAKE, n, NULL, NULL, 0) == -1) {
+		dsm_panic("Couldn't wake futex!");
+	}
+}
+
+// Parks the caller until the park word of 'smap' moves past 'epoch'. Read
+// 'epoch' before checking the condition waited for.
+void dsm_park (dsm_smap *smap, int epoch) {
+
+	// Count in before the check (the waker bumps before counting).
+	__atomic_add_fetch(&smap->nparked, 1, __ATOMIC_SEQ_CST);
+	while (__atomic_load_n(&smap->park_epoch, __ATOMIC_SEQ_CST) == epoch) {
+		dsm_futexWait(&smap->park_epoch, epoch);
+	}
+	__atomic_sub_fetch(&smap->nparked, 1, __ATOMIC_SEQ_CST);
+}
+
+// Wakes all processes parked on 'smap' (one syscall, if any are parked).
+// Call after making their conditions true.
+void dsm_unpark (dsm_smap *smap) {
+	__atomic_add_fetch(&smap->park_epoch, 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&smap->nparked, __ATOMIC_SEQ_CST) > 0) {
+		dsm_futexWake(&smap->park_epoch, INT_MAX);
+	}
+}
+
+// Registers a process in dsm_wait on the word at data region 'offset' of
+// 'smap'. Check the word only after this.
+void dsm_addWaiter (dsm_smap *smap, off_t offset) {
+	int page = offset / DSM_PAGESIZE;
+	unsigned long long *slots = smap->waits[page], v;
+	unsigned long long key = (unsigned long long)(offset + 1) << 32;
+
+	// Count in on the page: Updates of pages without waiters wake nobody.
+	__atomic_add_fetch(smap->nwait + page, 1, __ATOMIC_SEQ_CST);
+
+	// Join the slot of the word.
+	for (int i = 0; i < DSM_WAIT_SLOTS; i++) {
+		v = __atomic_load_n(slots + i, __ATOMIC_SEQ_CST);
+		while ((v & ~WAIT_COUNT_MASK) == key) {
+			if (__atomic_compare_exchange_n(slots + i, &v, v + 1, 0,
+				__ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+				return;
+			}
+		}
+	}
+
+	// Otherwise claim a free one.
+	for (int i = 0; i < DSM_WAIT_SLOTS; i++) {
+		v = 0;
+		if (__atomic_compare_exchange_n(slots + i, &v, key + 1, 0,
+			__ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+			return;
+		}
+	}
+
+	// None free: Updates of the page wake every word they write.
+	__atomic_add_fetch(smap->nwait_any + page, 1, __ATOMIC_SEQ_CST);
+}
+
+// Leaves a wait slot of key (any: The waiters of a word are alike). The
+// last waiter frees it. Returns nonzero if one was left.
+static int leaveWaitSlot (unsigned long long *slots, unsigned long long key) {
+	unsigned long long v;
+
+	for (int i = 0; i < DSM_WAIT_SLOTS; i++) {
+		v = __atomic_load_n(slots + i, __ATOMIC_SEQ_CST);
+		while ((v & ~WAIT_COUNT_MASK) == key && (v & WAIT_COUNT_MASK) > 0) {
+			if (__atomic_compare_exchange_n(slots + i, &v,
+				((v & WAIT_COUNT_MASK) == 1 ? 0 : v - 1), 0,
+				__ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+				return 1;
+			}
+		}
+	}
+
+	return 0;
+}
+
+// Unregisters a process in dsm_wait on the word at data region 'offset'.
+void dsm_removeWaiter (dsm_smap *smap, off_t offset) {
+	int page = offset / DSM_PAGESIZE;
+	unsigned long long key = (unsigned long long)(offset + 1) << 32;
+
+	// Leave the slot of the word, or the waiters without one.
+	if (leaveWaitSlot(smap->waits[page], key) == 0) {
+		__atomic_sub_fetch(smap->nwait_any + page, 1, __ATOMIC_SEQ_CST);
+	}
+	__atomic_sub_fetch(smap->nwait + page, 1, __ATOMIC_SEQ_CST);
+}
+
+// Wakes processes in dsm_wait on words overlapping the updated data region
+// range [offset, offset + size) of 'smap'. Call after applying the update.
+void dsm_wakeWaiters (dsm_smap *smap, off_t offset, size_t size) {
+	void *data = (void *)smap + smap->data_off;
+	off_t end = offset + size, word;
+	unsigned long long v;
+
+	// Order the update before the waiter checks (waiters do the reverse).
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+	for (int page = offset / DSM_PAGESIZE; page * DSM_PAGESIZE < end; page++) {
+
+		// Only wake up on pages with waiters: Spares a syscall per update.
+		if (__atomic_load_n(smap->nwait + page, __ATOMIC_SEQ_CST) == 0) {
+			continue;
+		}
+
+		// Waiters without a slot: Wake every word written on the page.
+		if (__atomic_load_n(smap->nwait_any + page, __ATOMIC_SEQ_CST) > 0) {
+			word = MAX(offset, page * DSM_PAGESIZE);
+			word -= word % sizeof(int);
+			for (; word < MIN(end, (page + 1) * DSM_PAGESIZE);
+				word += sizeof(int)) {
+				dsm_futexWake((int *)(data + word), INT_MAX);
+			}
+			continue;
+		}
+
+		// Otherwise wake just the waited words that were written.
+		for (int i = 0; i < DSM_WAIT_SLOTS; i++) {
+			v = __atomic_load_n(smap->waits[page] + i, __ATOMIC_SEQ_CST);
+			word = (off_t)(v >> 32) - 1;
+			if ((v & WAIT_COUNT_MASK) > 0 && word + (off_t)sizeof(int) > offset
+				&& word < end) {
+				dsm_futexWake((int *)(data + word), INT_MAX);
+			}
+		}
+	}
+}
+
+// Returns the partition (of 'n') of page: The index of its session server.
+unsigned int dsm_getPagePart (int page, unsigned int n) {
+
+	// Round-robin: Neighbouring pages land on different servers, and every
+	// server gets an equal share of the pages.
+	return (unsigned int)page % n;
+}
+
+
+/*
+ *******************************************************************************
+ *                      Sequence Lock Function Definitions                     *
+ *******************************************************************************
+*/
+
+
+// Marks start of an update guarded by the seqlock (single writer only).
+void dsm_seqBegin (unsigned int *seq) {
+
+	// Odd value: Update in progress. Order before the data stores.
+	__atomic_store_n(seq, *seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+// Marks end of an update guarded by the seqlock.
+void dsm_seqEnd (unsigned int *seq) {
+
+	// Even value: Update complete. Order after the data stores.
+	__atomic_store_n(seq, *seq + 1, __ATOMIC_RELEASE);
+}
+
+// Returns an even sequence value to start a read with. Spins during updates.
+unsigned int dsm_seqReadBegin (const unsigned int *seq) {
+	unsigned int v;
+
+	while ((v = __atomic_load_n(seq, __ATOMIC_ACQUIRE)) & 1) {
+		__builtin_ia32_pause();
+	}
+
+	return v;
+}
+
+// Returns nonzero if a read started at value 'start' must be retried.
+int dsm_seqReadRetry (const unsigned int *seq, unsigned int start) {
+
+	// Order the data loads before re-checking the sequence.
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	return (__atomic_load_n(seq, __ATOMIC_RELAXED) != start);
+}
+
+
+/*
+ *******************************************************************************
+ *                          Time Function Definitions                          *
+ *******************************************************************************
+*/
+
+
+// Returns the monotonic time in nanoseconds.
+double dsm_now (void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
@@ -4,6 +4,8 @@
 #include <stdlib.h>
 #include <sys/poll.h>
 #include <semaphore.h>
+#include <setjmp.h>
+#include "dsm_types.h"
 
 /*
  *******************************************************************************
@@ -44,6 +46,10 @@ void dsm_panicf (const char *fmt, ...);
 // Outputs warning to stderr.
 void dsm_warning (const char *msg);
 
+// Makes panics of the calling thread jump to 'env' (set with setjmp) instead
+// of exiting. NULL makes them exit again.
+void dsm_setPanicJump (jmp_buf *env);
+
 // [DEBUG] Redirects output to named file. Returns new fd.
 int dsm_setStdout (const char *filename);
 
@@ -89,4 +95,72 @@ void *dsm_pageAlloc (void *address, size_t size);
 void dsm_unlinkSharedFile (const char *name);
 
 
+/*
+ *******************************************************************************
+ *                         Futex Function Declarations                         *
+ *******************************************************************************
+*/
+
+
+// Sleeps while the shared word at 'addr' holds 'val'. May return spuriously.
+void dsm_futexWait (int *addr, int val);
+
+// Wakes up to 'n' processes sleeping on the shared word at 'addr'.
+void dsm_futexWake (int *addr, int n);
+
+// Parks the caller until the park word of 'smap' moves past 'epoch'. Read
+// 'epoch' before checking the condition waited for.
+void dsm_park (dsm_smap *smap, int epoch);
+
+// Wakes all processes parked on 'smap' (one syscall, if any are parked).
+// Call after making their conditions true.
+void dsm_unpark (dsm_smap *smap);
+
+// Registers a process in dsm_wait on the word at data region 'offset' of
+// 'smap'. Check the word only after this.
+void dsm_addWaiter (dsm_smap *smap, off_t offset);
+
+// Unregisters a process in dsm_wait on the word at data region 'offset'.
+void dsm_removeWaiter (dsm_smap *smap, off_t offset);
+
+// Wakes processes in dsm_wait on words overlapping the updated data region
+// range [offset, offset + size) of 'smap'. Call after applying the update.
+void dsm_wakeWaiters (dsm_smap *smap, off_t offset, size_t size);
+
+// Returns the partition (of 'n') of page: The index of its session server.
+// Pages are dealt out round-robin, so consecutive pages use different servers.
+unsigned int dsm_getPagePart (int page, unsigned int n);
+
+
+/*
+ *******************************************************************************
+ *                      Sequence Lock Function Declarations                    *
+ *******************************************************************************
+*/
+
+
+// Marks start of an update guarded by the seqlock (single writer only).
+void dsm_seqBegin (unsigned int *seq);
+
+// Marks end of an update guarded by the seqlock.
+void dsm_seqEnd (unsigned int *seq);
+
+// Returns an even sequence value to start a read with. Spins during updates.
+unsigned int dsm_seqReadBegin (const unsigned int *seq);
+
+// Returns nonzero if a read started at value 'start' must be retried.
+int dsm_seqReadRetry (const unsigned int *seq, unsigned int start);
+
+
+/*
+ *******************************************************************************
+ *                          Time Function Declarations                         *
+ *******************************************************************************
+*/
+
+
+// Returns the monotonic time in nanoseconds.
+double dsm_now (void);
+
+
 #endif
\ No newline at end of file
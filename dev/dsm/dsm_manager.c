@@ -224,10 +224,6 @@ void dsm_init (unsigned int nproc) {
 		dsm_initTable(shared_obj, (size_t)size);
 		dsm_down(&(shared_obj->sem_lock));
 
-		// Protect the data page in the shared object.
-		void *data = (void *)shared_obj + shared_obj->data_off;
-		dsm_mprotect(data, PAGESIZE, PROT_READ);
-
 		//printf("[%d] [%d] (ARBITER) Releasing!\n", getpid(), getpgid(0));
 
 		for (int i = nproc; i > 1; i--) {
@@ -238,6 +234,11 @@ void dsm_init (unsigned int nproc) {
 		dsm_down(sem_barrier);
 	}
 
+	// Protect the data page in the shared object: Every process writes it
+	// through the SIGSEGV handler (which also wakes dsm_wait).
+	void *data = (void *)shared_obj + shared_obj->data_off;
+	dsm_mprotect(data, PAGESIZE, PROT_READ);
+
 	// Increment the tally semaphore.
 	dsm_up(sem_tally);
 	
@@ -285,6 +286,20 @@ void dsm_exit (void) {
 	dsm_sigdefault(SIGTSTP);
 }
 
+/*
+ * Sleeps while the shared int at 'offset' in the data region equals
+ * 'expected'. Each write to the word wakes its waiters. Callers should
+ * recheck the word: Wake-ups may be spurious.
+*/
+void dsm_wait (off_t offset, int expected) {
+	int *word = (int *)((void *)shared_obj + shared_obj->data_off + offset);
+
+	// Reading never faults: Only writes take the lock.
+	if (__atomic_load_n(word, __ATOMIC_SEQ_CST) == expected) {
+		dsm_futexWait(word, expected);
+	}
+}
+
 
 /*
  *******************************************************************************
@@ -303,7 +318,9 @@ void childProgram (int nproc, int whoami) {
 
 	for (int i = 0; i < 5; i++) {
 
-		while (*x != whoami);
+		while (*x != whoami) {
+			dsm_wait(0, 1 - whoami);
+		}
 
 		if (whoami == 0) {
 			printf("Ping! ...\n");
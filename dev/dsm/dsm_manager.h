@@ -1,6 +1,8 @@
 #if !defined(DSM_MANAGER_H)
 #define DSM_MANAGER_H
 
+#include <sys/types.h>
+
 
 /*
  *******************************************************************************
@@ -39,6 +41,13 @@ void dsm_init (unsigned int nproc);
 */
 void dsm_exit (void);
 
+/*
+ * Sleeps while the shared int at 'offset' in the data region equals
+ * 'expected'. Each write to the word wakes its waiters. Callers should
+ * recheck the word: Wake-ups may be spurious.
+*/
+void dsm_wait (off_t offset, int expected);
+
 
 
 
@@ -2,6 +2,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <limits.h>
 #include <sys/mman.h>
 #include "dsm_util.h"
 #include "dsm_table.h"
@@ -160,6 +161,10 @@ void dsm_sync_sigill (int signal, siginfo_t *info, void *ucontext) {
 	void *page = (void *)shared_obj + shared_obj->data_off;
 	dsm_mprotect(page, PAGESIZE, PROT_READ);
 
+	// Wake processes in dsm_wait on the written word.
+	uintptr_t word = (uintptr_t)fault_addr & ~(uintptr_t)(sizeof(int) - 1);
+	dsm_futexWake((int *)word, INT_MAX);
+
 	// Release object lock and unfreeze other processes.
 	releaseAccess();
 }
@@ -6,6 +6,8 @@
 #include <semaphore.h>
 #include <sys/mman.h>
 #include <stdarg.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 #include "dsm_util.h"
 
 
@@ -137,3 +139,20 @@ void *dsm_pageAlloc (void *address, size_t size) {
 
 	return address;
 }
+
+// Sleeps while the shared word at 'addr' holds 'val'. May return spuriously.
+void dsm_futexWait (int *addr, int val) {
+
+	// Shared (non-private) futex: The word lives in a shared mapping.
+	if (syscall(SYS_futex, addr, FUTEX_WAIT, val, NULL, NULL, 0) == -1 &&
+		errno != EAGAIN && errno != EINTR) {
+		dsm_panic("Couldn't wait on futex!");
+	}
+}
+
+// Wakes up to 'n' processes sleeping on the shared word at 'addr'.
+void dsm_futexWake (int *addr, int n) {
+	if (syscall(SYS_futex, addr, FUTEX_WAKE, n, NULL, NULL, 0) == -1) {
+		dsm_panic("Couldn't wake futex!");
+	}
+}
@@ -52,4 +52,10 @@ void dsm_mprotect (void *address, size_t size, int flags);
 // Allocates a page-aligned slice of memory. Exits fatally on error.
 void *dsm_pageAlloc (void *address, size_t size);
 
+// Sleeps while the shared word at 'addr' holds 'val'. May return spuriously.
+void dsm_futexWait (int *addr, int val);
+
+// Wakes up to 'n' processes sleeping on the shared word at 'addr'.
+void dsm_futexWake (int *addr, int n);
+
 #endif
\ No newline at end of file